@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+#include "fluid_sim.h"
+#include "utils.h"
+
+#define MAX_RUNS		64u
+#define NAME_SIZE		32u
+#define PHASES			5u
+
+typedef struct result result;
+
+//One scene at one size; phase times are ns/particle/step in the order of phase_names
+struct result
+{
+	char scene[NAME_SIZE];
+	char backend[NAME_SIZE];
+	uint32_t particles;
+	uint32_t threads;
+	uint64_t steps;
+	double ns[PHASES];
+	double rss_mb;
+};
+
+static const char* const scene_names[] = { "block", "dam", "droplets" };
+static const char* const backend_names[] = { "quadtree", "grid", "linear", "hash" };
+static const char* const phase_names[PHASES] = { "index", "density", "force", "integrate", "total" };
+
+static void			usage(void);
+static bool			__parse_list(const char* list, uint32_t* values, uint32_t* count, uint32_t max, const char* const* names,
+								 uint32_t name_count);
+static void			__scale_params(fluid_sim_params* params, uint32_t grid_size);
+static bool			__run(const fluid_sim_params* params, uint64_t steps, uint64_t warmup, result* r);
+static bool			__run_process(const fluid_sim_params* params, uint64_t steps, uint64_t warmup, result* r);
+static bool			__write_results(const char* path, const result* results, uint32_t count);
+static uint32_t		__read_results(const char* path, result* results, uint32_t max);
+static uint32_t		__compare(const result* results, uint32_t count, const result* baseline, uint32_t baseline_count,
+							  double tolerance);
+
+int main(int argc, char** argv)
+{
+	fluid_sim_params params;
+	fluid_sim_default_params(&params);
+	params.seed = 1u;
+	uint32_t scenes[3] = { FLUID_SCENE_BLOCK, FLUID_SCENE_DAM_BREAK, FLUID_SCENE_DROPLETS };
+	uint32_t scene_count = 3u;
+	uint32_t sizes[16] = { 1000u, 10000u, 100000u, 1000000u };
+	uint32_t size_count = 4u;
+	uint64_t steps = 100u;
+	uint64_t warmup = 10u;
+	const char* out_path = "bench.csv";
+	const char* baseline_path = NULL;
+	double tolerance = 0.1;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char* opt = argv[a];
+		const char* val = a + 1 < argc ? argv[a + 1] : NULL;
+		if(!val) { usage(); return 1; }
+		a++;
+		bool ok = true;
+		if(!strcmp(opt, "-scenes"))
+			ok = __parse_list(val, scenes, &scene_count, 3u, scene_names, 3u);
+		else if(!strcmp(opt, "-sizes"))
+			ok = __parse_list(val, sizes, &size_count, 16u, NULL, 0u);
+		else if(!strcmp(opt, "-steps"))
+			steps = strtoull(val, NULL, 10);
+		else if(!strcmp(opt, "-warmup"))
+			warmup = strtoull(val, NULL, 10);
+		else if(!strcmp(opt, "-seed"))
+			params.seed = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-threads"))
+			params.threads = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "grid"))
+			params.neighbor_backend = FLUID_NEIGHBOR_GRID;
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "quadtree"))
+			params.neighbor_backend = FLUID_NEIGHBOR_QUADTREE;
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "linear"))
+			params.neighbor_backend = FLUID_NEIGHBOR_LINEAR_QUADTREE;
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "hash"))
+			params.neighbor_backend = FLUID_NEIGHBOR_HASH;
+		else if(!strcmp(opt, "-pairs"))
+			params.pair_forces = atoi(val) != 0;
+		else if(!strcmp(opt, "-out"))
+			out_path = val;
+		else if(!strcmp(opt, "-baseline"))
+			baseline_path = val;
+		else if(!strcmp(opt, "-tolerance"))
+			tolerance = strtod(val, NULL);
+		else
+			ok = false;
+		if(!ok || !steps)
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	//The baseline is read before anything is written, since it may be out_path itself
+	result* baseline = NULL;
+	uint32_t baseline_count = 0u;
+	if(baseline_path)
+	{
+		baseline = calloc(MAX_RUNS, sizeof *baseline);
+		baseline_count = baseline ? __read_results(baseline_path, baseline, MAX_RUNS) : 0u;
+		if(!baseline_count)
+		{
+			fprintf(stderr, "Failed to read baseline %s\n", baseline_path);
+			free(baseline);
+			return 1;
+		}
+	}
+
+	result* results = calloc(MAX_RUNS, sizeof *results);
+	uint32_t result_count = 0u;
+	printf("%-10s %10s %10s %10s %10s %10s %10s %10s\n", "scene", "particles", "index", "density", "force",
+		"integrate", "total", "rss MB");
+	//Sizes go in the order given. Without fork the runs share this process,
+	//whose peak RSS only grows, so list them ascending there
+	for(uint32_t s = 0; s < scene_count; s++)
+	{
+		for(uint32_t z = 0; z < size_count && result_count < MAX_RUNS; z++)
+		{
+			fluid_sim_params run_params = params;
+			run_params.scene = (fluid_scene)scenes[s];
+			run_params.grid_size = (uint32_t)(sqrt((double)sizes[z]) + 0.5);
+			__scale_params(&run_params, run_params.grid_size);
+			result* r = &results[result_count];
+			if(!__run_process(&run_params, steps, warmup, r))
+			{
+				fprintf(stderr, "Failed to run %s with %u particles\n", scene_names[scenes[s]], sizes[z]);
+				continue;
+			}
+			printf("%-10s %10u %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", r->scene, r->particles,
+				r->ns[0], r->ns[1], r->ns[2], r->ns[3], r->ns[4], r->rss_mb);
+			fflush(stdout);
+			result_count++;
+		}
+	}
+
+	int status = 0;
+	if(!__write_results(out_path, results, result_count))
+	{
+		fprintf(stderr, "Failed to write %s\n", out_path);
+		status = 1;
+	}
+	if(baseline && __compare(results, result_count, baseline, baseline_count, tolerance))
+		status = 2;
+	free(baseline);
+	free(results);
+	return status;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: bench [-scenes block,dam,droplets] [-sizes N,N,...] [-steps N] [-warmup N] [-seed N]\n"
+		"             [-threads N] [-backend grid|quadtree|linear|hash] [-pairs 0|1]\n"
+		"             [-out PATH] [-baseline PATH] [-tolerance F]\n"
+		"exits with 2 when a phase is slower than the baseline by more than the tolerance\n");
+}
+
+
+
+//Comma separated numbers, or names when names is given
+static bool			__parse_list(const char* list, uint32_t* values, uint32_t* count, uint32_t max, const char* const* names,
+								 uint32_t name_count)
+{
+	uint32_t n = 0u;
+	for(const char* item = list; *item;)
+	{
+		size_t len = strcspn(item, ",");
+		if(n == max || !len) { return false; }
+		if(names)
+		{
+			uint32_t k = 0u;
+			while(k < name_count && (strlen(names[k]) != len || strncmp(names[k], item, len)))
+				k++;
+			if(k == name_count) { return false; }
+			values[n++] = k;
+		}
+		else
+		{
+			char* end;
+			values[n++] = (uint32_t)strtoul(item, &end, 10);
+			if(end != item + len) { return false; }
+		}
+		item += len + (item[len] == ',');
+	}
+	*count = n;
+	return n > 0u;
+}
+
+//The defaults are tuned for a 30 x 30 block; keep the same number of
+//neighbors per particle and the same accelerations at any resolution
+static void			__scale_params(fluid_sim_params* params, uint32_t grid_size)
+{
+	float s = 30.0f / (float)grid_size;
+	params->h *= s;
+	params->radius *= s;
+	params->skin *= s;
+	params->dt *= s;
+	params->rest_density /= s * s;
+	params->stiffness_constant *= s;
+	params->viscosity_coefficient *= s * s;
+	params->surface_coefficient *= s * s;
+}
+
+static bool			__run(const fluid_sim_params* params, uint64_t steps, uint64_t warmup, result* r)
+{
+	fluid_sim* sim = fluid_sim_create(params);
+	if(!sim) { return false; }
+	for(uint64_t s = 0; s < warmup; s++)
+		fluid_sim_step(sim);
+	fluid_sim_stats before, after;
+	fluid_sim_get_stats(sim, &before);
+	double t0 = wtime();
+	for(uint64_t s = 0; s < steps; s++)
+		fluid_sim_step(sim);
+	double elapsed = wtime() - t0;
+	fluid_sim_get_stats(sim, &after);
+
+	const fluid_sim_params* p = fluid_sim_get_params(sim);
+	double scale = 1e9 / ((double)steps * fluid_sim_count(sim));
+	snprintf(r->scene, sizeof r->scene, "%s", scene_names[p->scene]);
+	snprintf(r->backend, sizeof r->backend, "%s", backend_names[p->neighbor_backend]);
+	r->particles = fluid_sim_count(sim);
+	r->threads = p->threads;
+	r->steps = steps;
+	r->ns[0] = (after.index_time - before.index_time) * scale;
+	r->ns[1] = (after.density_time - before.density_time) * scale;
+	r->ns[2] = (after.force_time - before.force_time) * scale;
+	r->ns[3] = (after.integrate_time - before.integrate_time) * scale;
+	r->ns[4] = elapsed * scale;
+	r->rss_mb = peak_rss() / 1048576.0;
+	fluid_sim_destroy(sim);
+	return true;
+}
+
+//Each run gets a child process where fork exists, so its peak RSS is not
+//raised by the runs before it; the child sends its result back over a pipe
+static bool			__run_process(const fluid_sim_params* params, uint64_t steps, uint64_t warmup, result* r)
+{
+#ifdef _WIN32
+	return __run(params, steps, warmup, r);
+#else
+	int fds[2];
+	if(pipe(fds) != 0) { return false; }
+	fflush(stdout);
+	pid_t pid = fork();
+	if(pid < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	if(pid == 0)
+	{
+		close(fds[0]);
+		result child;
+		bool ok = __run(params, steps, warmup, &child) && write(fds[1], &child, sizeof child) == (ssize_t)sizeof child;
+		_exit(ok ? 0 : 1);
+	}
+	close(fds[1]);
+	size_t received = 0u;
+	while(received < sizeof *r)
+	{
+		ssize_t n = read(fds[0], (char*)r + received, sizeof *r - received);
+		if(n <= 0) { break; }
+		received += (size_t)n;
+	}
+	close(fds[0]);
+	int status;
+	return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0 && received == sizeof *r;
+#endif
+}
+
+static bool			__write_results(const char* path, const result* results, uint32_t count)
+{
+	FILE* file = fopen(path, "w");
+	if(!file) { return false; }
+	fprintf(file, "scene,backend,particles,threads,steps");
+	for(uint32_t k = 0; k < PHASES; k++)
+		fprintf(file, ",%s_ns", phase_names[k]);
+	fprintf(file, ",peak_rss_mb\n");
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const result* r = &results[i];
+		fprintf(file, "%s,%s,%u,%u,%llu", r->scene, r->backend, r->particles, r->threads, (unsigned long long)r->steps);
+		for(uint32_t k = 0; k < PHASES; k++)
+			fprintf(file, ",%.3f", r->ns[k]);
+		fprintf(file, ",%.1f\n", r->rss_mb);
+	}
+	return fclose(file) == 0;
+}
+
+static uint32_t		__read_results(const char* path, result* results, uint32_t max)
+{
+	FILE* file = fopen(path, "r");
+	if(!file) { return 0u; }
+	char line[512];
+	uint32_t count = 0u;
+	while(count < max && fgets(line, sizeof line, file))
+	{
+		result* r = &results[count];
+		unsigned long long steps;
+		int n = sscanf(line, "%31[^,],%31[^,],%u,%u,%llu,%lf,%lf,%lf,%lf,%lf,%lf", r->scene, r->backend,
+			&r->particles, &r->threads, &steps, &r->ns[0], &r->ns[1], &r->ns[2], &r->ns[3], &r->ns[4], &r->rss_mb);
+		//The header line fails on the particle count
+		if(n != 11) { continue; }
+		r->steps = steps;
+		count++;
+	}
+	fclose(file);
+	return count;
+}
+
+//Prints every phase slower than its baseline by more than tolerance and returns their number
+static uint32_t		__compare(const result* results, uint32_t count, const result* baseline, uint32_t baseline_count,
+							  double tolerance)
+{
+	uint32_t regressions = 0u;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		const result* r = &results[i];
+		const result* b = NULL;
+		for(uint32_t k = 0; k < baseline_count && !b; k++)
+		{
+			if(!strcmp(baseline[k].scene, r->scene) && !strcmp(baseline[k].backend, r->backend) &&
+				baseline[k].particles == r->particles && baseline[k].threads == r->threads)
+				b = &baseline[k];
+		}
+		if(!b)
+		{
+			printf("no baseline: %s %u\n", r->scene, r->particles);
+			continue;
+		}
+		for(uint32_t k = 0; k < PHASES; k++)
+		{
+			if(b->ns[k] <= 0.0 || r->ns[k] <= b->ns[k] * (1.0 + tolerance)) { continue; }
+			printf("REGRESSION %s %u %s: %.1f ns vs %.1f ns (+%.0f%%)\n", r->scene, r->particles, phase_names[k],
+				r->ns[k], b->ns[k], (r->ns[k] / b->ns[k] - 1.0) * 100.0);
+			regressions++;
+		}
+	}
+	if(!regressions)
+		printf("no regressions against baseline (tolerance %.0f%%)\n", tolerance * 100.0);
+	return regressions;
+}
@@ -1,8 +1,15 @@
 @echo off
 cls
-set flags=-fcompare-debug-second -Wall -Wformat=0 -static-libgcc -g -O2 -Wno-unused-variable -Wno-unused-function 
+rem set prof=-DSIMP_PROF to compile in the instrumentation
+set prof=
+set flags=%prof% -fcompare-debug-second -Wall -Wformat=0 -static-libgcc -g -O2 -Wno-unused-variable -Wno-unused-function 
+set sim=fluid_sim.o fluid_simd.o fluid_kernel.o fluid_pair.o fluid_pcisph.o fluid_pbf.o fluid_compact.o fluid_sdf.o fluid_dist.o fluid_snapshot.o fluid_traj.o simp_pool.o simp_prof.o simp_triple.o simp_transport.o simp_queue.o simp_grid.o simp_hash.o simp_nlist.o simp_morton.o simp_quadtree.o simp_lqtree.o simp_list.o utils.o
 gcc %flags% -c *.c
-gcc *.o -o p -lopengl32 -lglfw3 -lglew32 -lgdi32 -lm
+gcc main.o fluid_upload.o fluid_async.o %sim% -o p -lopengl32 -lglfw3 -lglew32 -lgdi32 -lpthread -lm
+gcc headless.o %sim% -o headless -lpthread -lm
+gcc bench.o %sim% -o bench -lpthread -lm
+gcc trajdump.o fluid_traj.o -o trajdump -lpthread
 del /f *.o
 if "%1" equ "x" p
+if "%1" equ "h" headless %2 %3 %4 %5 %6 %7 %8 %9
 @echo on
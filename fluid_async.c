@@ -0,0 +1,129 @@
+#include "fluid_async.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "simp_triple.h"
+#include "simp_queue.h"
+#include "simp_prof.h"
+
+#define COMMAND_CAPACITY 256u
+
+typedef struct slot slot;
+
+struct slot
+{
+	uint64_t step;
+	double time;
+	fluid_vertex vertices[];
+};
+
+typedef struct fluid_async
+{
+	fluid_sim* sim;
+	simp_triple* frames;
+	simp_queue* commands;
+	pthread_t thread;
+	atomic_bool quit;
+}fluid_async;
+
+static void*		__sim_main(void* arg);
+static void			__apply(fluid_sim* sim, const fluid_command* command);
+
+fluid_async*		fluid_async_create(fluid_sim* sim)
+{
+	fluid_async* async = calloc(1u, sizeof *async);
+	if(!async) { return NULL; }
+	async->sim = sim;
+	atomic_init(&async->quit, false);
+	uint32_t count = fluid_sim_count(sim);
+	async->frames = simp_triple_create(sizeof(slot) + count * sizeof(fluid_vertex));
+	async->commands = simp_queue_create(COMMAND_CAPACITY, sizeof(fluid_command));
+	if(!async->frames || !async->commands)
+	{
+		simp_triple_destroy(async->frames);
+		simp_queue_destroy(async->commands);
+		free(async);
+		return NULL;
+	}
+
+	//Publish the initial state so the first frame has something to draw
+	slot* s = simp_triple_back(async->frames);
+	s->step = fluid_sim_steps(sim);
+	s->time = fluid_sim_time(sim);
+	fluid_sim_pack_vertices(sim, s->vertices);
+	simp_triple_publish(async->frames);
+
+	if(pthread_create(&async->thread, NULL, __sim_main, async) != 0)
+	{
+		simp_triple_destroy(async->frames);
+		simp_queue_destroy(async->commands);
+		free(async);
+		return NULL;
+	}
+	return async;
+}
+
+//Stops after the step in progress; the simulation is the caller's again afterwards
+void				fluid_async_destroy(fluid_async* async)
+{
+	if(!async) { return; }
+	atomic_store(&async->quit, true);
+	pthread_join(async->thread, NULL);
+	fluid_command command;
+	while(simp_queue_pop(async->commands, &command))
+		__apply(async->sim, &command);
+	simp_triple_destroy(async->frames);
+	simp_queue_destroy(async->commands);
+	free(async);
+}
+
+//Only one thread may send; false when the queue is full
+bool				fluid_async_send(fluid_async* async, const fluid_command* command)
+{
+	return simp_queue_push(async->commands, command);
+}
+
+//Only one thread may read frames; returns whether a new step arrived since the last call
+bool				fluid_async_frame(fluid_async* async, fluid_frame* frame)
+{
+	bool fresh;
+	const slot* s = simp_triple_front(async->frames, &fresh);
+	frame->step = s->step;
+	frame->time = s->time;
+	frame->count = fluid_sim_count(async->sim);
+	frame->vertices = s->vertices;
+	return fresh;
+}
+
+
+
+static void*		__sim_main(void* arg)
+{
+	fluid_async* async = arg;
+	fluid_sim* sim = async->sim;
+	while(!atomic_load_explicit(&async->quit, memory_order_relaxed))
+	{
+		fluid_command command;
+		while(simp_queue_pop(async->commands, &command))
+			__apply(sim, &command);
+		fluid_sim_step(sim);
+
+		SIMP_PROF_SCOPE("publish");
+		slot* s = simp_triple_back(async->frames);
+		s->step = fluid_sim_steps(sim);
+		s->time = fluid_sim_time(sim);
+		fluid_sim_pack_vertices(sim, s->vertices);
+		simp_triple_publish(async->frames);
+	}
+	return NULL;
+}
+
+static void			__apply(fluid_sim* sim, const fluid_command* command)
+{
+	switch(command->type)
+	{
+		case FLUID_COMMAND_MOUSE:
+			fluid_sim_set_mouse(sim, command->x, command->y, command->buttons);
+			break;
+	}
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "fluid_sim.h"
+
+//Runs a simulation on its own thread. Every completed step is packed into a
+//lock-free triple buffer that the render thread reads without waiting, and
+//input reaches the simulation through a lock-free command queue. While the
+//runner exists the caller must not touch the simulation itself.
+typedef struct fluid_async fluid_async;
+
+typedef enum fluid_command_type
+{
+	FLUID_COMMAND_MOUSE
+}fluid_command_type;
+
+typedef struct fluid_command
+{
+	fluid_command_type type;
+	float x, y;
+	int buttons;
+}fluid_command;
+
+//The latest completed step; vertices stay valid until the next fluid_async_frame
+typedef struct fluid_frame
+{
+	uint64_t step;
+	double time;
+	uint32_t count;
+	const fluid_vertex* vertices;
+}fluid_frame;
+
+fluid_async*		fluid_async_create(fluid_sim* sim);
+void				fluid_async_destroy(fluid_async* async);
+bool				fluid_async_send(fluid_async* async, const fluid_command* command);
+bool				fluid_async_frame(fluid_async* async, fluid_frame* frame);
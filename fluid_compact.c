@@ -0,0 +1,146 @@
+#include "fluid_compact.h"
+#include "fluid.h"
+
+#define STEP_INV	(65535.0f / FLUID_COMPACT_SPAN)
+
+static uint16_t		__fixed(float q);
+static float		__coordinate(uint16_t q);
+
+void				fluid_compact_pack(uint32_t i, float x, float y, uint16_t* pos)
+{
+	pos[2 * i + 0] = __fixed((x - FLUID_COMPACT_MIN) * STEP_INV);
+	pos[2 * i + 1] = __fixed((y - FLUID_COMPACT_MIN) * STEP_INV);
+}
+
+void				fluid_compact_position(uint32_t i, const uint16_t* pos, float* x, float* y)
+{
+	*x = __coordinate(pos[2 * i + 0]);
+	*y = __coordinate(pos[2 * i + 1]);
+}
+
+void				fluid_compact_velocity_pack(uint32_t i, float vx, float vy, uint16_t* vel)
+{
+	vel[2 * i + 0] = f32_to_f16(vx);
+	vel[2 * i + 1] = f32_to_f16(vy);
+}
+
+uint16_t			fluid_compact_density_pack(float dens, float rest_density)
+{
+	return __fixed(dens * (65535.0f / FLUID_COMPACT_DENSITY_SPAN) / rest_density);
+}
+
+float				fluid_compact_density_unpack(uint16_t dens, float rest_density)
+{
+	return (float)dens * (FLUID_COMPACT_DENSITY_SPAN / 65535.0f) * rest_density;
+}
+
+float				fluid_compact_density(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const uint16_t* pos,
+										  const fluid_kernels* kernels)
+{
+	const fluid_kernel* kernel = &kernels->pressure;
+	float h = kernel->h;
+	float density = fluid_kernel_w(kernel, 0.0f);
+	int32_t qx = pos[2 * i + 0];
+	int32_t qy = pos[2 * i + 1];
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j == i) { continue; }
+		float dx = (float)((int32_t)pos[2 * j + 0] - qx) * FLUID_COMPACT_STEP;
+		float dy = (float)((int32_t)pos[2 * j + 1] - qy) * FLUID_COMPACT_STEP;
+		float dd = dx * dx + dy * dy;
+		if(dd <= h * h)
+			density += fluid_kernel_w(kernel, sqrtf(dd));
+	}
+	return density * boundary_weight(__coordinate(pos[2 * i + 0]), __coordinate(pos[2 * i + 1]), h);
+}
+
+//fluid_accel on the compact arrays
+bool				fluid_compact_accel(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const uint16_t* pos,
+										const uint16_t* vel, const uint16_t* dens, const fluid_kernels* kernels,
+										float rest_density, float stiffness_constant, float surface_coefficient,
+										float viscosity_coefficient, float* ax, float* ay)
+{
+	float h = kernels->pressure.h;
+	int32_t qx = pos[2 * i + 0];
+	int32_t qy = pos[2 * i + 1];
+	float dens_scale = FLUID_COMPACT_DENSITY_SPAN / 65535.0f * rest_density;
+	float dens_i = (float)dens[i] * dens_scale;
+	float p = (dens_i - rest_density) * stiffness_constant;
+	float curr_dens_inv = 1.0f / dens_i;
+	float curr_dens_inv2 = curr_dens_inv * curr_dens_inv;
+	float vx = fluid_compact_half(vel[2 * i + 0]);
+	float vy = fluid_compact_half(vel[2 * i + 1]);
+	float curvature = 0.0f;
+	float normal_x = 0.0f;
+	float normal_y = 0.0f;
+	float accel_x = 0.0f, accel_y = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j == i) { continue; }
+		float dx = (float)((int32_t)pos[2 * j + 0] - qx) * FLUID_COMPACT_STEP;
+		float dy = (float)((int32_t)pos[2 * j + 1] - qy) * FLUID_COMPACT_STEP;
+		float dd = dx * dx + dy * dy;
+		if(dd > h * h) { continue; }
+		float d = sqrtf(dd);
+		float dens_j = (float)dens[j] * dens_scale;
+		float weight_grad = fluid_kernel_dw(&kernels->pressure, d);
+		float j_dens_inv = 1.0f / dens_j;
+		float p_other = (dens_j - rest_density) * stiffness_constant;
+		float c = weight_grad * (p * curr_dens_inv2 + p_other * j_dens_inv);
+		if(d < 1e-5)
+		{
+			//Random direction per pair, opposite for (j, i)
+			uint32_t lo = i < j ? i : j, hi = i < j ? j : i;
+			hrand2d(lo * 0x9E3779B1u ^ hi, &dx, &dy);
+			if(i > j)
+			{
+				dx = -dx;
+				dy = -dy;
+			}
+		}
+		else
+		{
+			float weight_surface = fluid_kernel_dw(&kernels->surface, d) * j_dens_inv;
+			normal_x += dx * weight_surface;
+			normal_y += dy * weight_surface;
+			dx /= d;
+			dy /= d;
+			curvature += surface_tension_laplacian(dd, &kernels->surface) * j_dens_inv;
+		}
+		accel_x += c * dx;
+		accel_y += c * dy;
+
+		c = viscosity_coefficient * fluid_kernel_lap(&kernels->viscosity, d) * j_dens_inv;
+		accel_x += c * (fluid_compact_half(vel[2 * j + 0]) - vx);
+		accel_y += c * (fluid_compact_half(vel[2 * j + 1]) - vy);
+	}
+	float normal_d = sqrtf(normal_x * normal_x + normal_y * normal_y);
+	bool surface = normal_d > 2e-1;
+	if(surface)
+	{
+		float c = surface_coefficient * curvature / normal_d;
+		accel_x += c * normal_x;
+		accel_y += c * normal_y;
+	}
+	*ax = accel_x * curr_dens_inv;
+	*ay = accel_y * curr_dens_inv;
+	return surface;
+}
+
+
+
+//Rounds a value in steps to the nearest integer and saturates outside 16 bits
+static uint16_t		__fixed(float q)
+{
+	q += 0.5f;
+	if(!(q > 0.0f)) { return 0u; }
+	if(q >= 65535.0f) { return 65535u; }
+	return (uint16_t)q;
+}
+
+static float		__coordinate(uint16_t q)
+{
+	return FLUID_COMPACT_MIN + (float)q * FLUID_COMPACT_STEP;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "fluid_kernel.h"
+
+//16-bit storage for the per-step state the density and force loops read:
+//predicted positions as fixed point over the walled domain with a margin,
+//densities as fixed point up to FLUID_COMPACT_DENSITY_SPAN times the rest
+//density (saturating above), velocities as half floats. The position and
+//density arrays replace the float ones. Velocities stay float as integration
+//state, since an increment below half a half-float step would be lost, and
+//the half copies are packed with the predicted positions for the force loop.
+//Differences of positions are taken on the integers, so a pair's offset is
+//exact up to the grid step of 1.9e-5. The kernels give the results of
+//sample_density and fluid_accel up to that storage error; the force kernel
+//returns the surface flag instead of writing colors.
+#define FLUID_COMPACT_MIN			-0.125f
+#define FLUID_COMPACT_SPAN			1.25f
+#define FLUID_COMPACT_STEP			(FLUID_COMPACT_SPAN / 65535.0f)
+#define FLUID_COMPACT_DENSITY_SPAN	8.0f
+
+void				fluid_compact_pack(uint32_t i, float x, float y, uint16_t* pos);
+void				fluid_compact_position(uint32_t i, const uint16_t* pos, float* x, float* y);
+void				fluid_compact_velocity_pack(uint32_t i, float vx, float vy, uint16_t* vel);
+uint16_t			fluid_compact_density_pack(float dens, float rest_density);
+float				fluid_compact_density_unpack(uint16_t dens, float rest_density);
+float				fluid_compact_density(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const uint16_t* pos,
+										  const fluid_kernels* kernels);
+bool				fluid_compact_accel(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const uint16_t* pos,
+										const uint16_t* vel, const uint16_t* dens, const fluid_kernels* kernels,
+										float rest_density, float stiffness_constant, float surface_coefficient,
+										float viscosity_coefficient, float* ax, float* ay);
+
+//Half float to float for the lane loops. Shifting the exponent and mantissa
+//into place and scaling by 2^112 rebiases normals and subnormals alike; the
+//packed velocities hold no infinities or NaNs, which this does not keep.
+static inline float	fluid_compact_half(uint16_t h)
+{
+	uint32_t x = (uint32_t)(h & 0x8000u) << 16 | (uint32_t)(h & 0x7FFFu) << 13;
+	float t;
+	memcpy(&t, &x, sizeof t);
+	return t * 0x1p112f;
+}
@@ -0,0 +1,572 @@
+#include "fluid_dist.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+#include "simp_grid.h"
+#include "fluid.h"
+#include "utils.h"
+
+typedef struct ghost ghost;
+typedef struct bounds bounds;
+typedef struct worker worker;
+
+//Predicted position and velocity of a particle owned by another rank
+struct ghost
+{
+	float x, y;
+	float vx, vy;
+};
+
+//Box around a rank's predicted positions, empty when x0 > x1
+struct bounds
+{
+	float x0, y0, x1, y1;
+};
+
+//One rank's view: owned particles as records, and owned then ghost
+//particles as the arrays the kernels read
+struct worker
+{
+	const fluid_sim_params* params;
+	simp_transport* transport;
+	uint32_t rank, ranks;
+	uint32_t cols, rows;
+	float dt;
+	fluid_kernels kernels;
+	simp_grid* grid;
+	fluid_particle* owned;
+	uint32_t owned_count;
+	size_t owned_capacity;
+	uint32_t local_count;
+	uint32_t local_capacity;
+	float* pred;
+	float* velo;
+	float* dens;
+	float* colo;
+	//Per peer: the message to send, the one received and, between the ghost
+	//and density exchanges, the owned particles sent as ghosts
+	void** out;
+	size_t* out_size;
+	size_t* out_capacity;
+	void** in;
+	size_t* in_size;
+	size_t* in_capacity;
+	uint32_t** sent;
+	size_t* sent_capacity;
+	uint32_t* sent_count;
+	bounds* peer_bounds;
+	uint32_t* nbrs;
+	uint32_t nbr_capacity;
+	fluid_dist_stats stats;
+};
+
+#ifndef _WIN32
+static bool			__worker_init(worker* w, const fluid_sim_params* params, const fluid_dist_params* dist,
+								  simp_transport* transport, uint32_t rank, float dt, const fluid_particle* all,
+								  uint32_t count);
+static void			__worker_free(worker* w);
+static bool			__worker_step(worker* w);
+static bool			__migrate(worker* w);
+static bool			__exchange_ghosts(worker* w);
+static bool			__exchange_densities(worker* w);
+static void			__integrate(worker* w, uint32_t i, float ax, float ay);
+static bool			__exchange(worker* w);
+static uint32_t		__owner(const worker* w, float x, float y);
+static bool			__append(worker* w, uint32_t peer, const void* data, size_t size);
+static bool			__reserve(void** p, size_t* capacity, size_t size);
+static bool			__reserve_local(worker* w, uint32_t count);
+static float		__distance(const bounds* b, float x, float y);
+#endif
+static void			__layout(const fluid_dist_params* params, uint32_t* cols, uint32_t* rows);
+
+void				fluid_dist_default_params(fluid_dist_params* params)
+{
+	params->ranks = 4u;
+	params->decomp = FLUID_DECOMP_SLABS;
+	params->transport = SIMP_TRANSPORT_SOCKET;
+	params->channel_capacity = 1u << 20;
+}
+
+#ifndef _WIN32
+//Forks one worker per rank; the parent is the last transport endpoint
+bool				fluid_dist_run(fluid_sim* sim, const fluid_dist_params* params, uint64_t steps,
+								   fluid_dist_stats* stats)
+{
+	const fluid_sim_params* p = fluid_sim_get_params(sim);
+	if(params->ranks < 1u || p->pressure_solver != FLUID_PRESSURE_EOS || p->pair_forces || p->adaptive_dt ||
+	   p->block_levels > 1u || p->sleeping || fluid_sim_get_boundary(sim))
+		return false;
+	uint32_t count = fluid_sim_count(sim);
+	uint32_t ranks = params->ranks;
+	fluid_particle* all = malloc(count * sizeof *all);
+	pid_t* pids = calloc(ranks, sizeof *pids);
+	simp_transport* transport = simp_transport_create(params->transport, ranks + 1u, params->channel_capacity);
+	if(!all || !pids || !transport)
+	{
+		free(all);
+		free(pids);
+		simp_transport_destroy(transport);
+		return false;
+	}
+	fluid_sim_export(sim, all);
+	float dt = fluid_sim_dt(sim);
+
+	bool ok = true;
+	for(uint32_t r = 0; r < ranks && ok; r++)
+	{
+		pids[r] = fork();
+		if(pids[r] < 0)
+			ok = false;
+		else if(pids[r] == 0)
+		{
+			//The child only has this thread; it leaves without touching the
+			//simulation, whose pool threads stayed with the parent
+			worker w = { 0 };
+			bool done = simp_transport_attach(transport, r) &&
+				__worker_init(&w, p, params, transport, r, dt, all, count);
+			for(uint64_t s = 0; done && s < steps; s++)
+				done = __worker_step(&w);
+			if(done)
+			{
+				w.stats.bytes = simp_transport_bytes(transport);
+				done = simp_transport_send(transport, ranks, &w.stats, sizeof w.stats) &&
+					simp_transport_send(transport, ranks, w.owned, w.owned_count * sizeof *w.owned);
+			}
+			if(!done)
+				simp_transport_abort(transport);
+			__worker_free(&w);
+			_exit(done ? 0 : 1);
+		}
+	}
+
+	void* buf = NULL;
+	size_t capacity = 0u, size;
+	fluid_particle* gathered = calloc(count, sizeof *gathered);
+	uint32_t received = 0u;
+	memset(stats, 0, sizeof *stats);
+	ok = ok && gathered && simp_transport_attach(transport, ranks);
+	for(uint32_t r = 0; r < ranks && ok; r++)
+		simp_transport_watch(transport, r, pids[r]);
+	for(uint32_t r = 0; r < ranks && ok; r++)
+	{
+		ok = simp_transport_recv(transport, r, &buf, &capacity, &size) && size == sizeof(fluid_dist_stats);
+		if(!ok) { break; }
+		const fluid_dist_stats* rs = buf;
+		stats->ghosts += rs->ghosts;
+		stats->migrations += rs->migrations;
+		stats->bytes += rs->bytes;
+		stats->exchange_time += rs->exchange_time;
+		stats->compute_time += rs->compute_time;
+		ok = simp_transport_recv(transport, r, &buf, &capacity, &size) && size % sizeof(fluid_particle) == 0u;
+		for(size_t k = 0; ok && k < size / sizeof(fluid_particle); k++)
+		{
+			const fluid_particle* particle = (const fluid_particle*)buf + k;
+			ok = particle->id < count;
+			if(ok)
+				gathered[particle->id] = *particle;
+		}
+		received += (uint32_t)(size / sizeof(fluid_particle));
+	}
+	ok = ok && received == count;
+	if(!ok)
+		simp_transport_abort(transport);
+	for(uint32_t r = 0; r < ranks; r++)
+	{
+		int status;
+		if(pids[r] > 0 && (waitpid(pids[r], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)))
+			ok = false;
+	}
+	if(ok)
+		fluid_sim_import(sim, gathered, steps);
+	free(buf);
+	free(gathered);
+	free(all);
+	free(pids);
+	simp_transport_destroy(transport);
+	return ok;
+}
+#else
+bool				fluid_dist_run(fluid_sim* sim, const fluid_dist_params* params, uint64_t steps,
+								   fluid_dist_stats* stats)
+{
+	return false;
+}
+#endif
+
+const char*			fluid_decomp_name(fluid_decomp decomp)
+{
+	switch(decomp)
+	{
+		case FLUID_DECOMP_SLABS:	return "slabs";
+		case FLUID_DECOMP_TILES:	return "tiles";
+	}
+	return "unknown";
+}
+
+
+
+//Tiles take the most rows that still divide the ranks evenly, up to a square
+static void			__layout(const fluid_dist_params* params, uint32_t* cols, uint32_t* rows)
+{
+	*rows = 1u;
+	if(params->decomp == FLUID_DECOMP_TILES)
+		for(uint32_t r = 2u; r * r <= params->ranks; r++)
+			if(params->ranks % r == 0u)
+				*rows = r;
+	*cols = params->ranks / *rows;
+}
+
+#ifndef _WIN32
+static bool			__worker_init(worker* w, const fluid_sim_params* params, const fluid_dist_params* dist,
+								  simp_transport* transport, uint32_t rank, float dt, const fluid_particle* all,
+								  uint32_t count)
+{
+	memset(w, 0, sizeof *w);
+	w->params = params;
+	w->transport = transport;
+	w->rank = rank;
+	w->ranks = dist->ranks;
+	w->dt = dt;
+	__layout(dist, &w->cols, &w->rows);
+	uint32_t n = w->ranks;
+	w->out = calloc(n, sizeof *w->out);
+	w->out_size = calloc(n, sizeof *w->out_size);
+	w->out_capacity = calloc(n, sizeof *w->out_capacity);
+	w->in = calloc(n, sizeof *w->in);
+	w->in_size = calloc(n, sizeof *w->in_size);
+	w->in_capacity = calloc(n, sizeof *w->in_capacity);
+	w->sent = calloc(n, sizeof *w->sent);
+	w->sent_capacity = calloc(n, sizeof *w->sent_capacity);
+	w->sent_count = calloc(n, sizeof *w->sent_count);
+	w->peer_bounds = calloc(n, sizeof *w->peer_bounds);
+	w->grid = simp_grid_create(0.0f, 0.0f, 1.0f, 1.0f, params->h);
+	bool kernels = fluid_kernels_create(&w->kernels, params->kernel, params->h, params->kernel_table_size);
+	if(!kernels || !w->out || !w->out_size || !w->out_capacity || !w->in || !w->in_size || !w->in_capacity ||
+	   !w->sent || !w->sent_capacity || !w->sent_count || !w->peer_bounds || !w->grid)
+		return false;
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		if(__owner(w, all[i].x, all[i].y) != rank) { continue; }
+		if(!__reserve((void**)&w->owned, &w->owned_capacity, (w->owned_count + 1u) * sizeof *w->owned))
+			return false;
+		w->owned[w->owned_count++] = all[i];
+	}
+	return true;
+}
+
+static void			__worker_free(worker* w)
+{
+	for(uint32_t p = 0; p < w->ranks; p++)
+	{
+		if(w->out) { free(w->out[p]); }
+		if(w->in) { free(w->in[p]); }
+		if(w->sent) { free(w->sent[p]); }
+	}
+	free(w->out);
+	free(w->out_size);
+	free(w->out_capacity);
+	free(w->in);
+	free(w->in_size);
+	free(w->in_capacity);
+	free(w->sent);
+	free(w->sent_capacity);
+	free(w->sent_count);
+	free(w->peer_bounds);
+	free(w->owned);
+	free(w->pred);
+	free(w->velo);
+	free(w->dens);
+	free(w->colo);
+	free(w->nbrs);
+	simp_grid_destroy(w->grid);
+	fluid_kernels_destroy(&w->kernels);
+}
+
+static bool			__worker_step(worker* w)
+{
+	const fluid_sim_params* p = w->params;
+	if(!__migrate(w) || !__exchange_ghosts(w)) { return false; }
+
+	double t0 = wtime();
+	float h = p->h;
+	if(!simp_grid_build(w->grid, w->pred, w->local_count)) { return false; }
+	for(uint32_t i = 0; i < w->owned_count; i++)
+	{
+		float x = w->pred[2 * i + 0], y = w->pred[2 * i + 1];
+		uint32_t nbr_count = simp_grid_query(w->grid, x - h, y - h, x + h, y + h, &w->nbrs, &w->nbr_capacity);
+		w->dens[i] = sample_density(i, w->nbrs, nbr_count, w->pred, &w->kernels);
+	}
+	w->stats.compute_time += wtime() - t0;
+
+	if(!__exchange_densities(w)) { return false; }
+
+	t0 = wtime();
+	for(uint32_t i = 0; i < w->owned_count; i++)
+	{
+		float x = w->pred[2 * i + 0], y = w->pred[2 * i + 1];
+		uint32_t nbr_count = simp_grid_query(w->grid, x - h, y - h, x + h, y + h, &w->nbrs, &w->nbr_capacity);
+		float ax, ay;
+		fluid_accel(i, w->nbrs, nbr_count, w->pred, w->velo, w->dens, w->colo, &w->kernels, p->rest_density,
+				p->stiffness_constant, p->surface_coefficient, p->viscosity_coefficient, &ax, &ay);
+		__integrate(w, i, ax, ay);
+	}
+	w->stats.compute_time += wtime() - t0;
+	return true;
+}
+
+//Hands particles that left the region to their new owner, then lays out the
+//owned part of the kernel arrays
+static bool			__migrate(worker* w)
+{
+	for(uint32_t p = 0; p < w->ranks; p++)
+		w->out_size[p] = 0u;
+	uint32_t kept = 0u;
+	for(uint32_t i = 0; i < w->owned_count; i++)
+	{
+		const fluid_particle* particle = &w->owned[i];
+		uint32_t owner = __owner(w, particle->x, particle->y);
+		if(owner == w->rank)
+			w->owned[kept++] = *particle;
+		else if(!__append(w, owner, particle, sizeof *particle))
+			return false;
+		else
+			w->stats.migrations++;
+	}
+	w->owned_count = kept;
+	if(!__exchange(w)) { return false; }
+
+	for(uint32_t p = 0; p < w->ranks; p++)
+	{
+		uint32_t n = (uint32_t)(w->in_size[p] / sizeof(fluid_particle));
+		if(!n) { continue; }
+		if(!__reserve((void**)&w->owned, &w->owned_capacity, (w->owned_count + n) * sizeof *w->owned))
+			return false;
+		memcpy(w->owned + w->owned_count, w->in[p], n * sizeof *w->owned);
+		w->owned_count += n;
+	}
+	return true;
+}
+
+//Predicts the owned particles as fluid_sim does, then trades bounds and ghosts
+static bool			__exchange_ghosts(worker* w)
+{
+	uint32_t owned = w->owned_count;
+	float fixed_step = 1.1666667f * w->dt;
+	float h = w->params->h;
+	if(!__reserve_local(w, owned)) { return false; }
+	bounds b = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+	for(uint32_t i = 0; i < owned; i++)
+	{
+		const fluid_particle* particle = &w->owned[i];
+		float x = particle->x + particle->vx * fixed_step;
+		float y = particle->y + particle->vy * fixed_step;
+		w->pred[2 * i + 0] = x;
+		w->pred[2 * i + 1] = y;
+		b.x0 = fminf(b.x0, x);
+		b.y0 = fminf(b.y0, y);
+		b.x1 = fmaxf(b.x1, x);
+		b.y1 = fmaxf(b.y1, y);
+	}
+	for(uint32_t p = 0; p < w->ranks; p++)
+	{
+		w->out_size[p] = 0u;
+		if(p != w->rank && !__append(w, p, &b, sizeof b)) { return false; }
+	}
+	if(!__exchange(w)) { return false; }
+	for(uint32_t p = 0; p < w->ranks; p++)
+		if(p != w->rank)
+			memcpy(&w->peer_bounds[p], w->in[p], sizeof(bounds));
+
+	for(uint32_t p = 0; p < w->ranks; p++)
+	{
+		w->out_size[p] = 0u;
+		w->sent_count[p] = 0u;
+		if(p == w->rank || w->in_size[p] != sizeof(bounds)) { continue; }
+		for(uint32_t i = 0; i < owned; i++)
+		{
+			if(__distance(&w->peer_bounds[p], w->pred[2 * i + 0], w->pred[2 * i + 1]) > h) { continue; }
+			ghost g = { w->pred[2 * i + 0], w->pred[2 * i + 1], w->owned[i].vx, w->owned[i].vy };
+			if(!__append(w, p, &g, sizeof g) ||
+			   !__reserve((void**)&w->sent[p], &w->sent_capacity[p], (w->sent_count[p] + 1u) * sizeof(uint32_t)))
+				return false;
+			w->sent[p][w->sent_count[p]++] = i;
+		}
+	}
+	if(!__exchange(w)) { return false; }
+
+	uint32_t count = owned;
+	for(uint32_t p = 0; p < w->ranks; p++)
+		count += (uint32_t)(w->in_size[p] / sizeof(ghost));
+	w->stats.ghosts += count - owned;
+	if(!__reserve_local(w, count)) { return false; }
+	for(uint32_t i = 0; i < owned; i++)
+	{
+		w->velo[2 * i + 0] = w->owned[i].vx;
+		w->velo[2 * i + 1] = w->owned[i].vy;
+	}
+	uint32_t k = owned;
+	for(uint32_t p = 0; p < w->ranks; p++)
+	{
+		const ghost* ghosts = w->in[p];
+		for(size_t g = 0; g < w->in_size[p] / sizeof(ghost); g++, k++)
+		{
+			w->pred[2 * k + 0] = ghosts[g].x;
+			w->pred[2 * k + 1] = ghosts[g].y;
+			w->velo[2 * k + 0] = ghosts[g].vx;
+			w->velo[2 * k + 1] = ghosts[g].vy;
+		}
+	}
+	w->local_count = count;
+	return true;
+}
+
+//Ghosts arrive in the order their owner sent them, so the densities follow the same order
+static bool			__exchange_densities(worker* w)
+{
+	for(uint32_t p = 0; p < w->ranks; p++)
+	{
+		w->out_size[p] = 0u;
+		for(uint32_t k = 0; k < w->sent_count[p]; k++)
+			if(!__append(w, p, &w->dens[w->sent[p][k]], sizeof(float)))
+				return false;
+	}
+	if(!__exchange(w)) { return false; }
+	uint32_t k = w->owned_count;
+	for(uint32_t p = 0; p < w->ranks; p++)
+	{
+		size_t n = w->in_size[p] / sizeof(float);
+		if(n)
+			memcpy(w->dens + k, w->in[p], n * sizeof(float));
+		k += (uint32_t)n;
+	}
+	return k == w->local_count;
+}
+
+//The step of fluid_sim's integrate pass without the mouse and block time steps
+static void			__integrate(worker* w, uint32_t i, float ax, float ay)
+{
+	const fluid_sim_params* p = w->params;
+	fluid_particle* particle = &w->owned[i];
+	float dt = w->dt;
+	float radius = p->radius;
+	float px = particle->x;
+	float py = particle->y;
+	float vx = particle->vx;
+	float vy = particle->vy;
+	particle->px = px;
+	particle->py = py;
+
+	vy += p->gravity * dt;
+	vx += ax * dt;
+	vy += ay * dt;
+	vx = (fabs(vx) > 1e-6) * vx;
+	vy = (fabs(vy) > 1e-6) * vy;
+	px += vx * dt;
+	py += vy * dt;
+	if(px - radius < 0.0f || px + radius > 1.0f)
+	{
+		px = fclamp(px, radius, 1.0f - radius);
+		vx -= 2.0f * p->damp_factor * vx;
+	}
+	if(py - radius < 0.0f || py + radius > 1.0f)
+	{
+		py = fclamp(py, radius, 1.0f - radius);
+		vy -= 2.0f * p->damp_factor * vy;
+	}
+
+	particle->x = px;
+	particle->y = py;
+	particle->vx = vx;
+	particle->vy = vy;
+	particle->ax = ax;
+	particle->ay = ay;
+	particle->dens = w->dens[i];
+	particle->r = w->colo[3 * i + 0];
+	particle->g = w->colo[3 * i + 1];
+	particle->b = w->colo[3 * i + 2];
+}
+
+//Every rank sends out[p] to and receives in[p] from every peer. Each rank
+//visits its pairs in increasing peer order, the lower rank sending first,
+//which is a global order on pairs, so blocking sends cannot deadlock.
+static bool			__exchange(worker* w)
+{
+	double t0 = wtime();
+	bool ok = true;
+	for(uint32_t p = 0; p < w->ranks && ok; p++)
+	{
+		if(p == w->rank) { continue; }
+		if(w->rank < p)
+			ok = simp_transport_send(w->transport, p, w->out[p], w->out_size[p]) &&
+				simp_transport_recv(w->transport, p, &w->in[p], &w->in_capacity[p], &w->in_size[p]);
+		else
+			ok = simp_transport_recv(w->transport, p, &w->in[p], &w->in_capacity[p], &w->in_size[p]) &&
+				simp_transport_send(w->transport, p, w->out[p], w->out_size[p]);
+	}
+	w->in_size[w->rank] = 0u;
+	w->stats.exchange_time += wtime() - t0;
+	return ok;
+}
+
+static uint32_t		__owner(const worker* w, float x, float y)
+{
+	uint32_t cx = (uint32_t)fclamp(x * w->cols, 0.0f, (float)(w->cols - 1u));
+	uint32_t cy = (uint32_t)fclamp(y * w->rows, 0.0f, (float)(w->rows - 1u));
+	return cy * w->cols + cx;
+}
+
+static bool			__append(worker* w, uint32_t peer, const void* data, size_t size)
+{
+	if(!__reserve(&w->out[peer], &w->out_capacity[peer], w->out_size[peer] + size)) { return false; }
+	memcpy((unsigned char*)w->out[peer] + w->out_size[peer], data, size);
+	w->out_size[peer] += size;
+	return true;
+}
+
+//Grows *p to at least size bytes, doubling
+static bool			__reserve(void** p, size_t* capacity, size_t size)
+{
+	if(size <= *capacity) { return true; }
+	size_t grown = *capacity ? 2u * *capacity : 4096u;
+	while(grown < size)
+		grown *= 2u;
+	void* q = realloc(*p, grown);
+	if(!q) { return false; }
+	*p = q;
+	*capacity = grown;
+	return true;
+}
+
+//Grows the kernel arrays to count particles together
+static bool			__reserve_local(worker* w, uint32_t count)
+{
+	if(count <= w->local_capacity) { return true; }
+	uint32_t n = w->local_capacity ? 2u * w->local_capacity : 1024u;
+	while(n < count)
+		n *= 2u;
+	float* pred = realloc(w->pred, 2u * n * sizeof *pred);
+	if(pred) { w->pred = pred; }
+	float* velo = realloc(w->velo, 2u * n * sizeof *velo);
+	if(velo) { w->velo = velo; }
+	float* dens = realloc(w->dens, n * sizeof *dens);
+	if(dens) { w->dens = dens; }
+	float* colo = realloc(w->colo, 3u * n * sizeof *colo);
+	if(colo) { w->colo = colo; }
+	if(!pred || !velo || !dens || !colo) { return false; }
+	w->local_capacity = n;
+	return true;
+}
+
+static float		__distance(const bounds* b, float x, float y)
+{
+	if(b->x0 > b->x1) { return INFINITY; }
+	float dx = fmaxf(fmaxf(b->x0 - x, x - b->x1), 0.0f);
+	float dy = fmaxf(fmaxf(b->y0 - y, y - b->y1), 0.0f);
+	return sqrtf(dx * dx + dy * dy);
+}
+#endif
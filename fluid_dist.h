@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "fluid_sim.h"
+#include "simp_transport.h"
+
+//Domain decomposition over worker processes. The unit square is cut into
+//SLABS of equal width or a near-square grid of TILES, one region per rank,
+//and each rank owns the particles inside its region. Every step the ranks
+//migrate the particles that crossed into another region, swap the bounds of
+//their predicted positions and send each other ghost copies of the particles
+//within h of those bounds: positions and velocities before the density pass,
+//densities before the force pass. sample_density and fluid_accel run
+//unchanged on owned plus ghost particles.
+//
+//Only the equation of state solver with a fixed dt is distributed, on the
+//scalar kernels and the walls of the unit square; the parent process takes
+//no part in the steps and gathers the particles back into the simulation at
+//the end.
+typedef enum fluid_decomp
+{
+	FLUID_DECOMP_SLABS,
+	FLUID_DECOMP_TILES
+}fluid_decomp;
+
+typedef struct fluid_dist_params
+{
+	uint32_t ranks;
+	fluid_decomp decomp;
+	simp_transport_type transport;
+	//Ring size per direction of the shared memory transport
+	size_t channel_capacity;
+}fluid_dist_params;
+
+//Summed over ranks and steps
+typedef struct fluid_dist_stats
+{
+	uint64_t ghosts;
+	uint64_t migrations;
+	uint64_t bytes;
+	//Seconds in exchanges, including waiting for slower ranks, and in the kernels
+	double exchange_time;
+	double compute_time;
+}fluid_dist_stats;
+
+void				fluid_dist_default_params(fluid_dist_params* params);
+bool				fluid_dist_run(fluid_sim* sim, const fluid_dist_params* params, uint64_t steps,
+								   fluid_dist_stats* stats);
+const char*			fluid_decomp_name(fluid_decomp decomp);
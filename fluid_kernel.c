@@ -0,0 +1,196 @@
+#include "fluid_kernel.h"
+#include <stdlib.h>
+#include <math.h>
+
+#define PI 3.14159265359
+
+bool				fluid_kernel_create(fluid_kernel* kernel, fluid_kernel_type type, float h, uint32_t table_size)
+{
+	float h2 = h * h;
+	kernel->type = type;
+	kernel->h = h;
+	kernel->hh = h2;
+	kernel->h_inv = 1.0f / h;
+	kernel->table_size = 0u;
+	kernel->table_scale = 0.0f;
+	kernel->w_table = kernel->dw_table = kernel->lap_table = NULL;
+	switch(type)
+	{
+		case FLUID_KERNEL_SPIKY:		kernel->norm = 10.0f / (PI * h2 * h2 * h); break;
+		case FLUID_KERNEL_POLY6:		kernel->norm = 4.0f / (PI * h2 * h2 * h2 * h2); break;
+		case FLUID_KERNEL_CUBIC_SPLINE:	kernel->norm = 40.0f / (7.0f * PI * h2); break;
+		case FLUID_KERNEL_WENDLAND_C2:	kernel->norm = 7.0f / (PI * h2); break;
+		case FLUID_KERNEL_VISCOSITY:	kernel->norm = 40.0f / (PI * h2 * h2 * h); break;
+	}
+	if(table_size == 0u) { return true; }
+
+	//table_size intervals over [0, h], plus one guard entry for the lerp
+	float* w = malloc((table_size + 2u) * sizeof *w);
+	float* dw = malloc((table_size + 2u) * sizeof *dw);
+	float* lap = malloc((table_size + 2u) * sizeof *lap);
+	if(!w || !dw || !lap)
+	{
+		free(w);
+		free(dw);
+		free(lap);
+		return false;
+	}
+	for(uint32_t i = 0; i <= table_size; i++)
+	{
+		float r = h * (float)i / (float)table_size;
+		w[i] = fluid_kernel_w_exact(kernel, r);
+		dw[i] = fluid_kernel_dw_exact(kernel, r);
+		lap[i] = fluid_kernel_lap_exact(kernel, r);
+	}
+	w[table_size + 1u] = w[table_size];
+	dw[table_size + 1u] = dw[table_size];
+	lap[table_size + 1u] = lap[table_size];
+	kernel->table_size = table_size;
+	kernel->table_scale = (float)table_size / h;
+	kernel->w_table = w;
+	kernel->dw_table = dw;
+	kernel->lap_table = lap;
+	return true;
+}
+
+void				fluid_kernel_destroy(fluid_kernel* kernel)
+{
+	free(kernel->w_table);
+	free(kernel->dw_table);
+	free(kernel->lap_table);
+	kernel->w_table = kernel->dw_table = kernel->lap_table = NULL;
+	kernel->table_size = 0u;
+}
+
+bool				fluid_kernels_create(fluid_kernels* kernels, fluid_kernel_type pressure, float h, uint32_t table_size)
+{
+	bool ok = fluid_kernel_create(&kernels->pressure, pressure, h, table_size);
+	ok = fluid_kernel_create(&kernels->viscosity, FLUID_KERNEL_VISCOSITY, h, table_size) && ok;
+	ok = fluid_kernel_create(&kernels->surface, FLUID_KERNEL_POLY6, h, table_size) && ok;
+	if(!ok) { fluid_kernels_destroy(kernels); }
+	return ok;
+}
+
+void				fluid_kernels_destroy(fluid_kernels* kernels)
+{
+	fluid_kernel_destroy(&kernels->pressure);
+	fluid_kernel_destroy(&kernels->viscosity);
+	fluid_kernel_destroy(&kernels->surface);
+}
+
+const char*			fluid_kernel_name(fluid_kernel_type type)
+{
+	switch(type)
+	{
+		case FLUID_KERNEL_SPIKY:		return "spiky";
+		case FLUID_KERNEL_POLY6:		return "poly6";
+		case FLUID_KERNEL_CUBIC_SPLINE:	return "cubic";
+		case FLUID_KERNEL_WENDLAND_C2:	return "wendland";
+		case FLUID_KERNEL_VISCOSITY:	return "viscosity";
+	}
+	return "unknown";
+}
+
+float				fluid_kernel_w_exact(const fluid_kernel* kernel, float r)
+{
+	float h = kernel->h;
+	float q = r * kernel->h_inv;
+	switch(kernel->type)
+	{
+		case FLUID_KERNEL_SPIKY:
+		{
+			float t = h - r;
+			return kernel->norm * t * t * t;
+		}
+		case FLUID_KERNEL_POLY6:
+		{
+			float t = kernel->hh - r * r;
+			return kernel->norm * t * t * t;
+		}
+		case FLUID_KERNEL_CUBIC_SPLINE:
+		{
+			if(q <= 0.5f) { return kernel->norm * (6.0f * (q * q * q - q * q) + 1.0f); }
+			float t = 1.0f - q;
+			return kernel->norm * 2.0f * t * t * t;
+		}
+		case FLUID_KERNEL_WENDLAND_C2:
+		{
+			float t = 1.0f - q;
+			return kernel->norm * t * t * t * t * (1.0f + 4.0f * q);
+		}
+		case FLUID_KERNEL_VISCOSITY:
+			//Radial potential whose Laplacian is norm * (h - r); only the Laplacian is meant to be used
+			return kernel->norm * (h * r * r / 4.0f - r * r * r / 9.0f - 5.0f * h * h * h / 36.0f);
+	}
+	return 0.0f;
+}
+
+float				fluid_kernel_dw_exact(const fluid_kernel* kernel, float r)
+{
+	float h = kernel->h;
+	float q = r * kernel->h_inv;
+	switch(kernel->type)
+	{
+		case FLUID_KERNEL_SPIKY:
+		{
+			float t = h - r;
+			return -3.0f * kernel->norm * t * t;
+		}
+		case FLUID_KERNEL_POLY6:
+		{
+			float t = kernel->hh - r * r;
+			return -6.0f * kernel->norm * r * t * t;
+		}
+		case FLUID_KERNEL_CUBIC_SPLINE:
+		{
+			if(q <= 0.5f) { return kernel->norm * kernel->h_inv * 6.0f * (3.0f * q * q - 2.0f * q); }
+			float t = 1.0f - q;
+			return -kernel->norm * kernel->h_inv * 6.0f * t * t;
+		}
+		case FLUID_KERNEL_WENDLAND_C2:
+		{
+			float t = 1.0f - q;
+			return -kernel->norm * kernel->h_inv * 20.0f * q * t * t * t;
+		}
+		case FLUID_KERNEL_VISCOSITY:
+			return kernel->norm * (h * r / 2.0f - r * r / 3.0f);
+	}
+	return 0.0f;
+}
+
+//2D Laplacian W'' + W' / r
+float				fluid_kernel_lap_exact(const fluid_kernel* kernel, float r)
+{
+	float h = kernel->h;
+	float q = r * kernel->h_inv;
+	float h_inv2 = kernel->h_inv * kernel->h_inv;
+	switch(kernel->type)
+	{
+		case FLUID_KERNEL_SPIKY:
+		{
+			//Singular at r = 0, clamp to a small distance
+			float t = h - r;
+			float r_safe = fmaxf(r, 1e-3f * h);
+			return kernel->norm * (6.0f * t - 3.0f * t * t / r_safe);
+		}
+		case FLUID_KERNEL_POLY6:
+		{
+			float t = kernel->hh - r * r;
+			return -12.0f * kernel->norm * t * (t - 2.0f * r * r);
+		}
+		case FLUID_KERNEL_CUBIC_SPLINE:
+		{
+			if(q <= 0.5f) { return kernel->norm * h_inv2 * (54.0f * q - 24.0f); }
+			float t = 1.0f - q;
+			return kernel->norm * h_inv2 * (12.0f * t - 6.0f * t * t / q);
+		}
+		case FLUID_KERNEL_WENDLAND_C2:
+		{
+			float t = 1.0f - q;
+			return -kernel->norm * h_inv2 * 20.0f * t * t * (2.0f - 5.0f * q);
+		}
+		case FLUID_KERNEL_VISCOSITY:
+			return kernel->norm * (h - r);
+	}
+	return 0.0f;
+}
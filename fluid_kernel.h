@@ -0,0 +1,85 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+//2D SPH smoothing kernels with support radius h. A kernel is built once per h
+//with its normalization precomputed; w, dw (dW/dr) and lap (Laplacian) are
+//only valid for 0 <= r <= h. With table_size > 0 all three are tabulated and
+//evaluated by linear interpolation.
+typedef enum fluid_kernel_type
+{
+	FLUID_KERNEL_SPIKY,
+	FLUID_KERNEL_POLY6,
+	FLUID_KERNEL_CUBIC_SPLINE,
+	FLUID_KERNEL_WENDLAND_C2,
+	FLUID_KERNEL_VISCOSITY
+}fluid_kernel_type;
+
+typedef struct fluid_kernel
+{
+	fluid_kernel_type type;
+	float h, hh, h_inv;
+	float norm;
+	uint32_t table_size;
+	float table_scale;
+	float* w_table;
+	float* dw_table;
+	float* lap_table;
+}fluid_kernel;
+
+//Kernels used by the solver: pressure is the selectable smoothing kernel for
+//density and pressure gradient, surface is poly6 for the color field
+typedef struct fluid_kernels
+{
+	fluid_kernel pressure;
+	fluid_kernel viscosity;
+	fluid_kernel surface;
+}fluid_kernels;
+
+bool				fluid_kernel_create(fluid_kernel* kernel, fluid_kernel_type type, float h, uint32_t table_size);
+void				fluid_kernel_destroy(fluid_kernel* kernel);
+const char*			fluid_kernel_name(fluid_kernel_type type);
+float				fluid_kernel_w_exact(const fluid_kernel* kernel, float r);
+float				fluid_kernel_dw_exact(const fluid_kernel* kernel, float r);
+float				fluid_kernel_lap_exact(const fluid_kernel* kernel, float r);
+bool				fluid_kernels_create(fluid_kernels* kernels, fluid_kernel_type pressure, float h, uint32_t table_size);
+void				fluid_kernels_destroy(fluid_kernels* kernels);
+
+static inline float	__fluid_kernel_lerp(const fluid_kernel* kernel, const float* table, float r)
+{
+	float t = r * kernel->table_scale;
+	uint32_t i = (uint32_t)t;
+	if(i >= kernel->table_size) { return table[kernel->table_size]; }
+	float f = t - (float)i;
+	return table[i] + f * (table[i + 1] - table[i]);
+}
+
+static inline float	fluid_kernel_w(const fluid_kernel* kernel, float r)
+{
+	if(kernel->w_table) { return __fluid_kernel_lerp(kernel, kernel->w_table, r); }
+	if(kernel->type == FLUID_KERNEL_SPIKY)
+	{
+		float t = kernel->h - r;
+		return kernel->norm * t * t * t;
+	}
+	return fluid_kernel_w_exact(kernel, r);
+}
+
+static inline float	fluid_kernel_dw(const fluid_kernel* kernel, float r)
+{
+	if(kernel->dw_table) { return __fluid_kernel_lerp(kernel, kernel->dw_table, r); }
+	if(kernel->type == FLUID_KERNEL_SPIKY)
+	{
+		float t = kernel->h - r;
+		return -3.0f * kernel->norm * t * t;
+	}
+	return fluid_kernel_dw_exact(kernel, r);
+}
+
+static inline float	fluid_kernel_lap(const fluid_kernel* kernel, float r)
+{
+	if(kernel->lap_table) { return __fluid_kernel_lerp(kernel, kernel->lap_table, r); }
+	if(kernel->type == FLUID_KERNEL_VISCOSITY)
+		return kernel->norm * (kernel->h - r);
+	return fluid_kernel_lap_exact(kernel, r);
+}
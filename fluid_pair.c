@@ -0,0 +1,128 @@
+#include "fluid_pair.h"
+#include "fluid.h"
+
+void				fluid_pair_density(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const float* pos,
+									   const fluid_kernels* kernels, float* acc)
+{
+	const fluid_kernel* kernel = &kernels->pressure;
+	float hh = kernel->hh;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float sum = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j <= i) { continue; }
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		float dd = dx * dx + dy * dy;
+		if(dd <= hh)
+		{
+			float w = fluid_kernel_w(kernel, sqrtf(dd));
+			sum += w;
+			acc[j] += w;
+		}
+	}
+	acc[i] += sum;
+}
+
+float				fluid_pair_density_finish(uint32_t i, float sum, const float* pos, const fluid_kernels* kernels)
+{
+	const fluid_kernel* kernel = &kernels->pressure;
+	float density = fluid_kernel_w(kernel, 0.0f) + sum;
+	return density * boundary_weight(pos[2 * i + 0], pos[2 * i + 1], kernel->h);
+}
+
+//The pressure and viscosity terms of fluid_accel are not antisymmetric (each
+//side divides by the other's density), so both sides get their own
+//coefficient on the shared weights rather than a negated copy
+void				fluid_pair_accel(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const float* pos,
+									 const float* vel, const float* dens, const fluid_kernels* kernels,
+									 float rest_density, float stiffness_constant, float viscosity_coefficient, float* acc)
+{
+	float hh = kernels->pressure.hh;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float vx = vel[2 * i + 0];
+	float vy = vel[2 * i + 1];
+	float dens_inv = 1.0f / dens[i];
+	float p = (dens[i] - rest_density) * stiffness_constant;
+	float p_term = p * dens_inv * dens_inv;
+	float* acc_i = acc + FLUID_PAIR_STRIDE * i;
+	float ax = 0.0f, ay = 0.0f, normal_x = 0.0f, normal_y = 0.0f, curvature = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j <= i) { continue; }
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		float dd = dx * dx + dy * dy;
+		if(dd > hh) { continue; }
+
+		float* acc_j = acc + FLUID_PAIR_STRIDE * j;
+		float d = sqrtf(dd);
+		float weight_grad = fluid_kernel_dw(&kernels->pressure, d);
+		float j_dens_inv = 1.0f / dens[j];
+		float p_other = (dens[j] - rest_density) * stiffness_constant;
+		float c_i = weight_grad * (p_term + p_other * j_dens_inv);
+		float c_j = weight_grad * (p_other * j_dens_inv * j_dens_inv + p * dens_inv);
+		if(d < 1e-5)
+		{
+			//Same per-pair direction as fluid_accel, i < j here
+			hrand2d(i * 0x9E3779B1u ^ j, &dx, &dy);
+		}
+		else
+		{
+			float weight_surface = fluid_kernel_dw(&kernels->surface, d);
+			float lap_surface = surface_tension_laplacian(dd, &kernels->surface);
+			normal_x += dx * weight_surface * j_dens_inv;
+			normal_y += dy * weight_surface * j_dens_inv;
+			curvature += lap_surface * j_dens_inv;
+			acc_j[2] -= dx * weight_surface * dens_inv;
+			acc_j[3] -= dy * weight_surface * dens_inv;
+			acc_j[4] += lap_surface * dens_inv;
+			dx /= d;
+			dy /= d;
+		}
+		ax += c_i * dx;
+		ay += c_i * dy;
+		acc_j[0] -= c_j * dx;
+		acc_j[1] -= c_j * dy;
+
+		float viscosity_weight = viscosity_coefficient * fluid_kernel_lap(&kernels->viscosity, d);
+		float dvx = vel[2 * j + 0] - vx;
+		float dvy = vel[2 * j + 1] - vy;
+		ax += viscosity_weight * j_dens_inv * dvx;
+		ay += viscosity_weight * j_dens_inv * dvy;
+		acc_j[0] -= viscosity_weight * dens_inv * dvx;
+		acc_j[1] -= viscosity_weight * dens_inv * dvy;
+	}
+	acc_i[0] += ax;
+	acc_i[1] += ay;
+	acc_i[2] += normal_x;
+	acc_i[3] += normal_y;
+	acc_i[4] += curvature;
+}
+
+void				fluid_pair_accel_finish(uint32_t i, const float* sum, const float* dens, float surface_coefficient,
+											float* col, float* ax, float* ay)
+{
+	float x = sum[0];
+	float y = sum[1];
+	float normal_x = sum[2];
+	float normal_y = sum[3];
+	float normal_d = sqrtf(normal_x * normal_x + normal_y * normal_y);
+	col[3 * i + 0] = 1.0f;
+	col[3 * i + 1] = 1.0f;
+	col[3 * i + 2] = 1.0f;
+	if(normal_d > 2e-1)
+	{
+		float c = surface_coefficient * sum[4] / normal_d;
+		x += c * normal_x;
+		y += c * normal_y;
+		col[3 * i + 1] = 0.0f;
+		col[3 * i + 2] = 0.0f;
+	}
+	*ax = x / dens[i];
+	*ay = y / dens[i];
+}
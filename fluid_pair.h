@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "fluid_kernel.h"
+
+//Pairwise evaluation: every pair (i, j) with j > i is visited once, its kernel
+//weights are shared, and each side's own contribution is added to both
+//particles' accumulators. Force accumulators hold FLUID_PAIR_STRIDE floats per
+//particle: acceleration before the division by density, color field normal
+//and curvature. The finish functions turn a particle's sums into the values
+//the per-particle path produces.
+#define FLUID_PAIR_STRIDE 5u
+
+void				fluid_pair_density(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const float* pos,
+									   const fluid_kernels* kernels, float* acc);
+float				fluid_pair_density_finish(uint32_t i, float sum, const float* pos, const fluid_kernels* kernels);
+void				fluid_pair_accel(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const float* pos,
+									 const float* vel, const float* dens, const fluid_kernels* kernels,
+									 float rest_density, float stiffness_constant, float viscosity_coefficient, float* acc);
+void				fluid_pair_accel_finish(uint32_t i, const float* sum, const float* dens, float surface_coefficient,
+											float* col, float* ax, float* ay);
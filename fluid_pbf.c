@@ -0,0 +1,126 @@
+#include "fluid_pbf.h"
+#include "fluid.h"
+
+static float		__tensile(float w, float w_dq);
+
+float				fluid_pbf_lambda(const fluid_pcisph* solver, fluid_simd simd, uint32_t i, const uint32_t* nbrs,
+									 uint32_t nbr_count, const float* pos, const fluid_kernels* kernels,
+									 float relaxation, float* dens)
+{
+	float rest_density = solver->rest_density;
+	*dens = fluid_pcisph_density(solver, simd, i, nbrs, nbr_count, pos, kernels);
+	float constraint = *dens / rest_density - 1.0f;
+	if(constraint <= 0.0f) { return 0.0f; }
+
+	const fluid_kernel* kernel = &kernels->pressure;
+	float hh = kernel->hh;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float sum_x, sum_y;
+	fluid_pcisph_wall(solver, x, y, &sum_x, &sum_y);
+	float sum_sq = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j == i) { continue; }
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		float dd = dx * dx + dy * dy;
+		if(dd > hh) { continue; }
+		float dw = fluid_kernel_dw(kernel, sqrtf(dd));
+		//grad_i W_ij points from j towards i for a positive dW/dr
+		float c = dd > 1e-10f ? -dw / sqrtf(dd) : 0.0f;
+		sum_x += c * dx;
+		sum_y += c * dy;
+		sum_sq += dw * dw;
+	}
+	float gradient_sum = sum_x * sum_x + sum_y * sum_y + sum_sq + relaxation * solver->gradient_sum;
+	return gradient_sum > 0.0f ? -constraint * rest_density * rest_density / gradient_sum : 0.0f;
+}
+
+void				fluid_pbf_delta(const fluid_pcisph* solver, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									const float* pos, const float* lambda, const fluid_kernels* kernels,
+									float* dx_out, float* dy_out)
+{
+	const fluid_kernel* kernel = &kernels->pressure;
+	float hh = kernel->hh;
+	float w_dq = fluid_kernel_w(kernel, FLUID_PBF_TENSILE_DQ * kernel->h);
+	//s_corr in units of lambda, as if it were a density error of k at r = dq h
+	float tensile_scale = solver->gradient_sum > 0.0f ?
+		solver->rest_density * solver->rest_density / solver->gradient_sum : 0.0f;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float lambda_i = lambda[i];
+	float sum_x = 0.0f, sum_y = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j == i) { continue; }
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		float dd = dx * dx + dy * dy;
+		if(dd > hh) { continue; }
+		float d = sqrtf(dd);
+		float s = lambda_i + lambda[j] + tensile_scale * __tensile(fluid_kernel_w(kernel, d), w_dq);
+		//dW/dr is negative, so a negative s moves i away from j
+		float c = fluid_kernel_dw(kernel, d) * s;
+		if(d < 1e-5f)
+		{
+			//Same per-pair direction as fluid_accel
+			uint32_t lo = i < j ? i : j, hi = i < j ? j : i;
+			hrand2d(lo * 0x9E3779B1u ^ hi, &dx, &dy);
+			if(i > j)
+			{
+				dx = -dx;
+				dy = -dy;
+			}
+		}
+		else
+			c /= d;
+		sum_x -= c * dx;
+		sum_y -= c * dy;
+	}
+	float gx, gy;
+	fluid_pcisph_wall(solver, x, y, &gx, &gy);
+	*dx_out = (sum_x + lambda_i * gx) / solver->rest_density;
+	*dy_out = (sum_y + lambda_i * gy) / solver->rest_density;
+}
+
+void				fluid_pbf_xsph(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const float* pos,
+								   const float* vel, const float* dens, const fluid_kernels* kernels, float c,
+								   float* vx, float* vy)
+{
+	const fluid_kernel* kernel = &kernels->pressure;
+	float hh = kernel->hh;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float vix = vel[2 * i + 0];
+	float viy = vel[2 * i + 1];
+	float sum_x = 0.0f, sum_y = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j == i) { continue; }
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		float dd = dx * dx + dy * dy;
+		if(dd > hh || dens[j] <= 0.0f) { continue; }
+		float w = fluid_kernel_w(kernel, sqrtf(dd)) / dens[j];
+		sum_x += (vel[2 * j + 0] - vix) * w;
+		sum_y += (vel[2 * j + 1] - viy) * w;
+	}
+	*vx = vix + c * sum_x;
+	*vy = viy + c * sum_y;
+}
+
+
+
+static float		__tensile(float w, float w_dq)
+{
+	if(w_dq <= 0.0f) { return 0.0f; }
+	float r = w / w_dq;
+	float rn = 1.0f;
+	for(int k = 0; k < FLUID_PBF_TENSILE_N; k++)
+		rn *= r;
+	return -FLUID_PBF_TENSILE_K * rn;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "fluid_kernel.h"
+#include "fluid_simd.h"
+#include "fluid_pcisph.h"
+
+//Position-based fluids (Macklin and Mueller 2013) with unit particle mass.
+//Each Jacobi iteration solves the density constraint C_i = rho_i / rho0 - 1
+//at the predicted positions for lambda_i = -C_i / (sum_k |grad_k C_i|^2 + eps)
+//and then moves every particle by
+//	dp_i = (sum_j (lambda_i + lambda_j + s_corr) grad W_ij + lambda_i grad rho_wall) / rho0
+//Only compression is corrected. The artificial pressure
+//s_corr = -k (W(r) / W(dq h))^n keeps particles from clustering where the
+//neighborhood is sparse; it is scaled by the prototype's lambda per unit
+//error, so k reads as a density error. Walls use the PCISPH wall density,
+//and eps is relaxation times the prototype's gradient sum.
+#define FLUID_PBF_TENSILE_K		1e-3f
+#define FLUID_PBF_TENSILE_N		4
+#define FLUID_PBF_TENSILE_DQ	0.2f
+
+//Lambda of particle i, its density goes to dens
+float				fluid_pbf_lambda(const fluid_pcisph* solver, fluid_simd simd, uint32_t i, const uint32_t* nbrs,
+									 uint32_t nbr_count, const float* pos, const fluid_kernels* kernels,
+									 float relaxation, float* dens);
+void				fluid_pbf_delta(const fluid_pcisph* solver, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									const float* pos, const float* lambda, const fluid_kernels* kernels,
+									float* dx, float* dy);
+//XSPH: v_i + c sum (v_j - v_i) W_ij / rho_j
+void				fluid_pbf_xsph(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const float* pos,
+								   const float* vel, const float* dens, const fluid_kernels* kernels, float c,
+								   float* vx, float* vy);
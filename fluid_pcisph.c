@@ -0,0 +1,217 @@
+#include "fluid_pcisph.h"
+#include "fluid.h"
+
+#define WALL_SAMPLES 256u
+#define LATTICE_STEPS 48u
+
+static void			__init_wall(fluid_pcisph* solver, const fluid_kernel* kernel);
+static void			__init_prototype(fluid_pcisph* solver, const fluid_kernel* kernel);
+static float		__wall_fraction(const fluid_pcisph* solver, float x, float y, float* gx, float* gy);
+static float		__wall_lookup(const fluid_pcisph* solver, float d, float* slope);
+
+void				fluid_pcisph_init(fluid_pcisph* solver, const fluid_kernels* kernels, float rest_density)
+{
+	solver->rest_density = rest_density;
+	solver->sdf = NULL;
+	__init_wall(solver, &kernels->pressure);
+	__init_prototype(solver, &kernels->pressure);
+}
+
+//delta = 1 / (beta * gradient_sum) with beta = 2 (dt m / rho0)^2. A close pair
+//raises the particle's own gradient sum and so lowers its delta; a sparse
+//neighborhood keeps the prototype's
+float				fluid_pcisph_delta(const fluid_pcisph* solver, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									   const float* pos, const fluid_kernels* kernels, float dt)
+{
+	const fluid_kernel* kernel = &kernels->pressure;
+	float hh = kernel->hh;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float sum_x = 0.0f, sum_y = 0.0f, sum_sq = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j == i) { continue; }
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		float dd = dx * dx + dy * dy;
+		if(dd > hh) { continue; }
+		float dw = fluid_kernel_dw(kernel, sqrtf(dd));
+		float c = dd > 1e-10f ? dw / sqrtf(dd) : 0.0f;
+		sum_x += c * dx;
+		sum_y += c * dy;
+		sum_sq += dw * dw;
+	}
+	float gradient_sum = fmaxf(sum_x * sum_x + sum_y * sum_y + sum_sq, solver->gradient_sum);
+	float beta = 2.0f * dt * dt / (solver->rest_density * solver->rest_density);
+	return gradient_sum > 0.0f ? 1.0f / (beta * gradient_sum) : 0.0f;
+}
+
+//The selected density path without its boundary_weight, plus the walls
+float				fluid_pcisph_density(const fluid_pcisph* solver, fluid_simd simd, uint32_t i, const uint32_t* nbrs,
+										 uint32_t nbr_count, const float* pos, const fluid_kernels* kernels)
+{
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float gx, gy;
+	float sum = fluid_simd_density(simd, i, nbrs, nbr_count, pos, kernels) / boundary_weight(x, y, kernels->pressure.h);
+	return sum + solver->rest_density * (1.0f - __wall_fraction(solver, x, y, &gx, &gy));
+}
+
+float				fluid_pcisph_wall(const fluid_pcisph* solver, float x, float y, float* gx, float* gy)
+{
+	float fraction = __wall_fraction(solver, x, y, gx, gy);
+	*gx *= -solver->rest_density;
+	*gy *= -solver->rest_density;
+	return solver->rest_density * (1.0f - fraction);
+}
+
+void				fluid_pcisph_accel(const fluid_pcisph* solver, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									   const float* pos, const float* dens, const float* pressure,
+									   const fluid_kernels* kernels, float* ax, float* ay)
+{
+	const fluid_kernel* kernel = &kernels->pressure;
+	float hh = kernel->hh;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	float p_term = pressure[i] / (dens[i] * dens[i]);
+	float sum_x = 0.0f, sum_y = 0.0f;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		uint32_t j = nbrs[k];
+		if(j == i) { continue; }
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		float dd = dx * dx + dy * dy;
+		if(dd > hh) { continue; }
+		float d = sqrtf(dd);
+		//dW/dr is negative, so a positive pressure pushes i away from j
+		float c = fluid_kernel_dw(kernel, d) * (p_term + pressure[j] / (dens[j] * dens[j]));
+		if(d < 1e-5f)
+		{
+			//Same per-pair direction as fluid_accel
+			uint32_t lo = i < j ? i : j, hi = i < j ? j : i;
+			hrand2d(lo * 0x9E3779B1u ^ hi, &dx, &dy);
+			if(i > j)
+			{
+				dx = -dx;
+				dy = -dy;
+			}
+		}
+		else
+			c /= d;
+		sum_x += c * dx;
+		sum_y += c * dy;
+	}
+	//grad rho_wall = -rest_density * grad(Fx * Fy) points into the wall
+	float gx, gy;
+	__wall_fraction(solver, x, y, &gx, &gy);
+	float c = p_term * solver->rest_density;
+	*ax = sum_x + c * gx;
+	*ay = sum_y + c * gy;
+}
+
+
+
+//F(d) = 1 - int_d^h W(r) 2 acos(d / r) r dr / (2 pi int_0^h W(r) r dr): a ring
+//of radius r > d loses the arc of half angle acos(d / r) beyond the wall
+static void			__init_wall(fluid_pcisph* solver, const fluid_kernel* kernel)
+{
+	float h = kernel->h;
+	double total = 0.0;
+	for(uint32_t s = 0; s < WALL_SAMPLES; s++)
+	{
+		double r = h * (s + 0.5) / WALL_SAMPLES;
+		total += fluid_kernel_w_exact(kernel, (float)r) * r;
+	}
+	total *= 2.0 * PI * h / WALL_SAMPLES;
+	solver->wall_scale = (float)FLUID_PCISPH_WALL_TABLE / h;
+	for(uint32_t k = 0; k <= FLUID_PCISPH_WALL_TABLE; k++)
+	{
+		double d = h * k / FLUID_PCISPH_WALL_TABLE;
+		double outside = 0.0;
+		for(uint32_t s = 0; s < WALL_SAMPLES; s++)
+		{
+			double r = d + (h - d) * (s + 0.5) / WALL_SAMPLES;
+			outside += fluid_kernel_w_exact(kernel, (float)r) * 2.0 * acos(d / r) * r;
+		}
+		outside *= (h - d) / WALL_SAMPLES;
+		solver->wall[k] = total > 0.0 ? (float)(1.0 - outside / total) : 1.0f;
+	}
+}
+
+//Bisects the spacing of a square lattice for the rest density; where even
+//the densest lattice tried falls short the prototype keeps that lattice
+static void			__init_prototype(fluid_pcisph* solver, const fluid_kernel* kernel)
+{
+	float h = kernel->h;
+	float lo = h / 32.0f, hi = h;
+	float spacing = lo;
+	for(uint32_t step = 0; step < LATTICE_STEPS; step++)
+	{
+		spacing = 0.5f * (lo + hi);
+		int n = (int)(h / spacing);
+		float density = 0.0f;
+		for(int a = -n; a <= n; a++)
+			for(int b = -n; b <= n; b++)
+			{
+				float r = spacing * sqrtf((float)(a * a + b * b));
+				if(r <= h)
+					density += fluid_kernel_w(kernel, r);
+			}
+		if(density > solver->rest_density)
+			lo = spacing;
+		else
+			hi = spacing;
+	}
+
+	int n = (int)(h / spacing);
+	float sum_x = 0.0f, sum_y = 0.0f, sum_sq = 0.0f;
+	for(int a = -n; a <= n; a++)
+		for(int b = -n; b <= n; b++)
+		{
+			float dx = spacing * a, dy = spacing * b;
+			float r = sqrtf(dx * dx + dy * dy);
+			if(r <= 0.0f || r > h) { continue; }
+			float c = fluid_kernel_dw(kernel, r) / r;
+			sum_x += c * dx;
+			sum_y += c * dy;
+			sum_sq += c * c * r * r;
+		}
+	solver->gradient_sum = sum_x * sum_x + sum_y * sum_y + sum_sq;
+}
+
+//Fx * Fy for the nearest wall in each axis and its gradient, or F at the boundary distance
+static float		__wall_fraction(const fluid_pcisph* solver, float x, float y, float* gx, float* gy)
+{
+	if(solver->sdf)
+	{
+		float nx, ny, df;
+		float f = __wall_lookup(solver, fluid_sdf_distance(solver->sdf, x, y, &nx, &ny), &df);
+		*gx = df * nx;
+		*gy = df * ny;
+		return f;
+	}
+	float sx = x < 0.5f ? 1.0f : -1.0f;
+	float sy = y < 0.5f ? 1.0f : -1.0f;
+	float dfx, dfy;
+	float fx = __wall_lookup(solver, fminf(x, 1.0f - x), &dfx);
+	float fy = __wall_lookup(solver, fminf(y, 1.0f - y), &dfy);
+	*gx = sx * dfx * fy;
+	*gy = sy * dfy * fx;
+	return fx * fy;
+}
+
+static float		__wall_lookup(const fluid_pcisph* solver, float d, float* slope)
+{
+	float t = fmaxf(d, 0.0f) * solver->wall_scale;
+	if(t >= (float)FLUID_PCISPH_WALL_TABLE)
+	{
+		*slope = 0.0f;
+		return 1.0f;
+	}
+	uint32_t k = (uint32_t)t;
+	float f = t - (float)k;
+	*slope = (solver->wall[k + 1u] - solver->wall[k]) * solver->wall_scale;
+	return solver->wall[k] + f * (solver->wall[k + 1u] - solver->wall[k]);
+}
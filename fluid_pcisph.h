@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "fluid_kernel.h"
+#include "fluid_simd.h"
+#include "fluid_sdf.h"
+
+//Predictive-corrective pressure (PCISPH) with unit particle mass. Positions
+//are predicted with the current pressure accelerations, the density error at
+//the prediction raises each particle's pressure by delta * error, and the
+//symmetric pressure force is evaluated again, until the mean error is within
+//tolerance. Delta and the pressure force gradients are taken at the first
+//prediction, without pressure, so every correction works on the same
+//linearization; delta is bounded by a prototype particle in a square lattice
+//whose spacing gives the rest density.
+//
+//The walls of the unit square count as fluid at rest density: the part of a
+//particle's support beyond a wall adds rest_density * (1 - Fx * Fy), where F
+//is the fraction of the kernel's weight on the fluid side of the nearest
+//wall in each axis. Unlike boundary_weight this is continuous, so pressure
+//can hold a particle at the rest density next to a wall.
+//
+//With a boundary sdf the walls are its zero level set instead, and F is
+//looked up at the signed distance as if the nearest wall were flat; the same
+//table then also corrects the equation of state solver's density.
+#define FLUID_PCISPH_WALL_TABLE 64u
+
+typedef struct fluid_pcisph
+{
+	float rest_density;
+	//|sum grad W|^2 + sum |grad W|^2 of the prototype
+	float gradient_sum;
+	float wall_scale;
+	float wall[FLUID_PCISPH_WALL_TABLE + 1u];
+	//Owned by the caller, NULL for the unit square
+	const fluid_sdf* sdf;
+}fluid_pcisph;
+
+void				fluid_pcisph_init(fluid_pcisph* solver, const fluid_kernels* kernels, float rest_density);
+//Pressure increase per unit density error of particle i for the step dt
+float				fluid_pcisph_delta(const fluid_pcisph* solver, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									   const float* pos, const fluid_kernels* kernels, float dt);
+float				fluid_pcisph_density(const fluid_pcisph* solver, fluid_simd simd, uint32_t i, const uint32_t* nbrs,
+										 uint32_t nbr_count, const float* pos, const fluid_kernels* kernels);
+//rest_density * (1 - Fx * Fy), or (1 - F) at the sdf distance, and its gradient, which points into the wall
+float				fluid_pcisph_wall(const fluid_pcisph* solver, float x, float y, float* gx, float* gy);
+//-sum (p_i / rho_i^2 + p_j / rho_j^2) grad W_ij - p_i / rho_i^2 grad rho_wall
+void				fluid_pcisph_accel(const fluid_pcisph* solver, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									   const float* pos, const float* dens, const float* pressure,
+									   const fluid_kernels* kernels, float* ax, float* ay);
@@ -0,0 +1,171 @@
+#include "fluid_sdf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "utils.h"
+
+//Largest side accepted from a file
+#define MAX_SIDE 8192u
+
+struct fluid_sdf
+{
+	uint32_t cols, rows;
+	float* dist;
+};
+
+static fluid_sdf*	__alloc(uint32_t cols, uint32_t rows);
+static float		__node_x(const fluid_sdf* sdf, uint32_t i);
+static float		__node_y(const fluid_sdf* sdf, uint32_t j);
+
+fluid_sdf*			fluid_sdf_create(uint32_t cols, uint32_t rows)
+{
+	fluid_sdf* sdf = __alloc(cols, rows);
+	if(!sdf) { return NULL; }
+	for(uint32_t j = 0; j < rows; j++)
+		for(uint32_t i = 0; i < cols; i++)
+		{
+			float x = __node_x(sdf, i);
+			float y = __node_y(sdf, j);
+			sdf->dist[j * cols + i] = fminf(fminf(x, 1.0f - x), fminf(y, 1.0f - y));
+		}
+	return sdf;
+}
+
+fluid_sdf*			fluid_sdf_load(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if(!file) { return NULL; }
+	uint32_t header[4];
+	fluid_sdf* sdf = NULL;
+	if(fread(header, sizeof header, 1u, file) == 1u &&
+	   header[0] == FLUID_SDF_MAGIC && header[1] == FLUID_SDF_VERSION &&
+	   header[2] <= MAX_SIDE && header[3] <= MAX_SIDE)
+		sdf = __alloc(header[2], header[3]);
+	if(sdf && fread(sdf->dist, sizeof *sdf->dist, sdf->cols * sdf->rows, file) != sdf->cols * sdf->rows)
+	{
+		fluid_sdf_destroy(sdf);
+		sdf = NULL;
+	}
+	fclose(file);
+	return sdf;
+}
+
+bool				fluid_sdf_save(const fluid_sdf* sdf, const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if(!file) { return false; }
+	uint32_t header[4] = { FLUID_SDF_MAGIC, FLUID_SDF_VERSION, sdf->cols, sdf->rows };
+	bool ok = fwrite(header, sizeof header, 1u, file) == 1u &&
+		fwrite(sdf->dist, sizeof *sdf->dist, sdf->cols * sdf->rows, file) == sdf->cols * sdf->rows;
+	return fclose(file) == 0 && ok;
+}
+
+void				fluid_sdf_destroy(fluid_sdf* sdf)
+{
+	if(!sdf) { return; }
+	free(sdf->dist);
+	free(sdf);
+}
+
+uint32_t			fluid_sdf_cols(const fluid_sdf* sdf)
+{
+	return sdf->cols;
+}
+
+uint32_t			fluid_sdf_rows(const fluid_sdf* sdf)
+{
+	return sdf->rows;
+}
+
+//Solid disc: the field becomes the union of the solids, min(d, |p - c| - r)
+void				fluid_sdf_add_disc(fluid_sdf* sdf, float cx, float cy, float r)
+{
+	for(uint32_t j = 0; j < sdf->rows; j++)
+		for(uint32_t i = 0; i < sdf->cols; i++)
+		{
+			float* d = &sdf->dist[j * sdf->cols + i];
+			float dx = __node_x(sdf, i) - cx;
+			float dy = __node_y(sdf, j) - cy;
+			*d = fminf(*d, sqrtf(dx * dx + dy * dy) - r);
+		}
+}
+
+//Solid axis-aligned box from (x0, y0) to (x1, y1), exact outside and inside
+void				fluid_sdf_add_box(fluid_sdf* sdf, float x0, float y0, float x1, float y1)
+{
+	float mx = 0.5f * (x0 + x1), my = 0.5f * (y0 + y1);
+	float hx = 0.5f * fabsf(x1 - x0), hy = 0.5f * fabsf(y1 - y0);
+	for(uint32_t j = 0; j < sdf->rows; j++)
+		for(uint32_t i = 0; i < sdf->cols; i++)
+		{
+			float* d = &sdf->dist[j * sdf->cols + i];
+			float qx = fabsf(__node_x(sdf, i) - mx) - hx;
+			float qy = fabsf(__node_y(sdf, j) - my) - hy;
+			float ox = fmaxf(qx, 0.0f), oy = fmaxf(qy, 0.0f);
+			*d = fminf(*d, sqrtf(ox * ox + oy * oy) + fminf(fmaxf(qx, qy), 0.0f));
+		}
+}
+
+//Bilinear in the cell around (x, y); the normal is the normalized gradient of the same patch
+float				fluid_sdf_distance(const fluid_sdf* sdf, float x, float y, float* nx, float* ny)
+{
+	uint32_t cols = sdf->cols, rows = sdf->rows;
+	float cx = fclamp(x, 0.0f, 1.0f);
+	float cy = fclamp(y, 0.0f, 1.0f);
+	float u = cx * (float)(cols - 1u);
+	float v = cy * (float)(rows - 1u);
+	uint32_t i = (uint32_t)u < cols - 2u ? (uint32_t)u : cols - 2u;
+	uint32_t j = (uint32_t)v < rows - 2u ? (uint32_t)v : rows - 2u;
+	float fu = u - (float)i;
+	float fv = v - (float)j;
+	const float* row0 = sdf->dist + j * cols + i;
+	const float* row1 = row0 + cols;
+	float d0 = row0[0] + fu * (row0[1] - row0[0]);
+	float d1 = row1[0] + fu * (row1[1] - row1[0]);
+	float d = d0 + fv * (d1 - d0);
+
+	float ox = x - cx, oy = y - cy;
+	float outside = sqrtf(ox * ox + oy * oy);
+	if(outside > 0.0f)
+	{
+		//Beyond the grid the way back is towards the unit square
+		*nx = -ox / outside;
+		*ny = -oy / outside;
+		return d - outside;
+	}
+	float gx = ((row0[1] - row0[0]) * (1.0f - fv) + (row1[1] - row1[0]) * fv) * (float)(cols - 1u);
+	float gy = (d1 - d0) * (float)(rows - 1u);
+	float g = sqrtf(gx * gx + gy * gy);
+	*nx = g > 0.0f ? gx / g : 0.0f;
+	*ny = g > 0.0f ? gy / g : 0.0f;
+	return d;
+}
+
+
+
+//A field needs at least one cell
+static fluid_sdf*	__alloc(uint32_t cols, uint32_t rows)
+{
+	if(cols < 2u || rows < 2u) { return NULL; }
+	fluid_sdf* sdf = calloc(1u, sizeof *sdf);
+	if(!sdf) { return NULL; }
+	sdf->cols = cols;
+	sdf->rows = rows;
+	sdf->dist = malloc((size_t)cols * rows * sizeof *sdf->dist);
+	if(!sdf->dist)
+	{
+		fluid_sdf_destroy(sdf);
+		return NULL;
+	}
+	return sdf;
+}
+
+static float		__node_x(const fluid_sdf* sdf, uint32_t i)
+{
+	return (float)i / (float)(sdf->cols - 1u);
+}
+
+static float		__node_y(const fluid_sdf* sdf, uint32_t j)
+{
+	return (float)j / (float)(sdf->rows - 1u);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+//Boundary geometry as a signed distance field sampled on cols * rows nodes
+//spanning the unit square: positive in the fluid, negative inside walls and
+//obstacles. A query interpolates the four nodes around it, so it costs the
+//same whatever the geometry; beyond the grid the distance keeps falling with
+//the distance to the unit square. A new field holds the walls of the unit
+//square, and obstacles are cut into it or the whole field is loaded.
+//
+//File layout, little endian: magic, version, cols, rows as uint32_t, then
+//cols * rows float distances row by row from y = 0.
+#define FLUID_SDF_MAGIC		0x46445346u
+#define FLUID_SDF_VERSION	1u
+
+typedef struct fluid_sdf fluid_sdf;
+
+fluid_sdf*			fluid_sdf_create(uint32_t cols, uint32_t rows);
+fluid_sdf*			fluid_sdf_load(const char* path);
+bool				fluid_sdf_save(const fluid_sdf* sdf, const char* path);
+void				fluid_sdf_destroy(fluid_sdf* sdf);
+uint32_t			fluid_sdf_cols(const fluid_sdf* sdf);
+uint32_t			fluid_sdf_rows(const fluid_sdf* sdf);
+void				fluid_sdf_add_disc(fluid_sdf* sdf, float cx, float cy, float r);
+void				fluid_sdf_add_box(fluid_sdf* sdf, float x0, float y0, float x1, float y1);
+//Distance at (x, y) and the unit normal pointing into the fluid, 0 where the field is flat
+float				fluid_sdf_distance(const fluid_sdf* sdf, float x, float y, float* nx, float* ny);
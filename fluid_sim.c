@@ -0,0 +1,2160 @@
+#include "fluid_sim.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "simp_quadtree.h"
+#include "simp_lqtree.h"
+#include "simp_hash.h"
+#include "simp_grid.h"
+#include "simp_nlist.h"
+#include "simp_morton.h"
+#include "simp_pool.h"
+#include "simp_prof.h"
+#include "utils.h"
+#include "fluid_pair.h"
+#include "fluid_pcisph.h"
+#include "fluid_pbf.h"
+#include "fluid_compact.h"
+#include "fluid_snapshot.h"
+
+#define PASS_CHUNK 256u
+#define MAX_BLOCK_LEVELS 16u
+#define PCISPH_MIN_ITERATIONS 3u
+
+_Static_assert(sizeof(fluid_vertex) == 16, "fluid_vertex must stay 16 bytes");
+
+typedef struct scratch scratch;
+
+typedef struct fluid_sim
+{
+	fluid_sim_params params;
+	fluid_simd simd;
+	fluid_kernels kernels;
+	uint32_t particle_count;
+	uint64_t step_count;
+	//Time stepping; substep is the position in the block time step cycle
+	float dt;
+	double time;
+	float dt_viscosity;
+	uint32_t substep;
+	//Periodic checkpoint, the path is owned by the caller
+	const char* snapshot_path;
+	uint32_t snapshot_interval;
+	//Destination of __pack_pass
+	fluid_vertex* pack_out;
+	float* particle_cpos;
+	float* particle_ppos;
+	float* particle_velo;
+	//Compact storage keeps pred and dens in the compact arrays instead, and
+	//allocates dens and colo only once they are asked for; compact_velo is
+	//the force loop's half float copy of particle_velo, packed by the
+	//predict pass
+	float* particle_dens;
+	float* particle_pred;
+	float* particle_colo;
+	uint16_t* compact_pred;
+	uint16_t* compact_velo;
+	uint16_t* compact_dens;
+	uint8_t* particle_surface;
+	float* particle_accel;
+	//PCISPH pressure, pressure acceleration and pressure per unit density
+	//error, recomputed every step. The base is the prediction without
+	//pressure, where delta and the pressure gradients are taken; reach is the
+	//radius around a later prediction that covers its neighbors within h, or
+	//0 while the lists still do.
+	float* particle_pres;
+	float* particle_paccel;
+	float* particle_pbase;
+	float* particle_delta;
+	float pcisph_reach;
+	//PBF constraint multipliers and position corrections; the corrections
+	//buffer also takes the XSPH velocities and is swapped with particle_velo
+	float* particle_lambda;
+	float* particle_dpos;
+	//PCISPH prototype and the wall model shared with PBF and boundary sdfs
+	fluid_pcisph pcisph;
+	//External id of the particle stored in each slot, stable across reorders
+	uint32_t* particle_id;
+	uint32_t* particle_level;
+	//Sleeping: consecutive calm steps, asleep from sleep_steps on, the density
+	//of the last step, and per cell of size h whether a fast particle is in it
+	uint32_t* particle_calm;
+	float* particle_pdens;
+	uint8_t* fast_cells;
+	uint32_t fast_side;
+	float mouse_x, mouse_y;
+	int mouse_buttons;
+	//Neighbor search
+	simp_quadtree* qtree;
+	simp_lqtree* lqtree;
+	simp_hash* hash;
+	simp_grid* grid;
+	simp_nlist* nlist;
+	//Worker threads and their private buffers
+	simp_pool* pool;
+	scratch* scratch;
+	//Z-order reordering
+	uint32_t* sort_keys;
+	uint32_t* sort_perm;
+	uint32_t* sort_tmp_keys;
+	uint32_t* sort_tmp_perm;
+	float* sort_scratch;
+	fluid_sim_stats stats;
+}fluid_sim;
+
+struct scratch
+{
+	uint32_t* nbrs;
+	uint32_t nbr_capacity;
+	//Pairwise mode accumulators, FLUID_PAIR_STRIDE floats per particle
+	float* acc;
+	float dt_limit;
+	uint64_t force_evaluations;
+	//PCISPH or PBF density error summed over the thread's particles
+	double density_error;
+	//PCISPH largest squared distance of a prediction from the base
+	float displacement;
+};
+
+static fluid_sim*	__create(const fluid_sim_params* params, uint32_t particle_count);
+static void			__seed_scene(fluid_sim* sim);
+static void			__seed_rect(fluid_sim* sim, uint32_t begin, uint32_t end, float x0, float y0, float width, float height);
+static void			__seed_disc(fluid_sim* sim, uint32_t begin, uint32_t end, float cx, float cy, float r, float vx, float vy);
+static void			__params_to_snapshot(fluid_snapshot_params* out, const fluid_sim_params* p);
+static void			__params_from_snapshot(fluid_sim_params* out, const fluid_snapshot_params* p);
+static void			__predict_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__nlist_count_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__nlist_fill_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__density_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__force_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__integrate_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pair_clear_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pair_density_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pair_density_finish_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pair_force_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pair_force_finish_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pack_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pcisph_setup_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pcisph_predict_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pcisph_density_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pcisph_force_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pcisph_delta_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pcisph_solve(fluid_sim* sim);
+static void			__pcisph_predict(const fluid_sim* sim, uint32_t i, float* x, float* y);
+static const uint32_t*	__pcisph_neighbors(fluid_sim* sim, uint32_t thread, uint32_t i, uint32_t* count);
+static const uint32_t*	__pcisph_base_neighbors(fluid_sim* sim, uint32_t thread, uint32_t i, uint32_t* count);
+static void			__pbf_predict_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pbf_lambda_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pbf_delta_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pbf_apply_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pbf_velocity_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pbf_xsph_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__pbf_solve(fluid_sim* sim);
+static void			__pbf_finish(fluid_sim* sim);
+static void			__build_index(fluid_sim* sim);
+static void			__update_neighbors(fluid_sim* sim);
+static uint32_t		__gather(fluid_sim* sim, uint32_t thread, float x, float y, float r);
+static const uint32_t*	__neighbors(fluid_sim* sim, uint32_t thread, uint32_t i, uint32_t* count);
+static void			__reorder(fluid_sim* sim);
+static uint32_t		__in_radius(const fluid_sim* sim, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count);
+static void			__pred(const fluid_sim* sim, uint32_t i, float* x, float* y);
+static void			__permute(float* data, const uint32_t* perm, uint32_t count, uint32_t stride, float* scratch);
+static void			__permute_index(uint32_t* data, const uint32_t* perm, uint32_t count, uint32_t* scratch);
+static void			__permute_flags(uint8_t* data, const uint32_t* perm, uint32_t count, uint32_t* scratch);
+static void			__permute_compact(uint16_t* data, const uint32_t* perm, uint32_t count, uint32_t stride,
+									  uint32_t* scratch);
+static bool			__expand_colors(fluid_sim* sim);
+static bool			__expand_densities(fluid_sim* sim);
+static bool			__active(const fluid_sim* sim, uint32_t i);
+static float		__dt_limit(const fluid_sim* sim, float vx, float vy, float ax, float ay);
+static uint32_t		__block_level(const fluid_sim* sim, uint32_t i, float limit);
+static void			__advance_time(fluid_sim* sim);
+static void			__mouse_kick(const fluid_sim* sim, float px, float py, float kick, float* vx, float* vy);
+static void			__wake(fluid_sim* sim);
+static bool			__asleep(const fluid_sim* sim, uint32_t i);
+static bool			__calm_step(fluid_sim* sim, uint32_t i, float vx, float vy);
+static bool			__push_out(const fluid_sim* sim, float* x, float* y, float* nx, float* ny);
+static void			__confine(const fluid_sim* sim, float* x, float* y);
+static void			__wall_accel(const fluid_sim* sim, uint32_t i, float* ax, float* ay);
+
+void				fluid_sim_default_params(fluid_sim_params* params)
+{
+	params->grid_size = 30u;
+	params->scene = FLUID_SCENE_BLOCK;
+	params->seed = 0u;
+	params->radius = 0.004f;
+	params->h = 5e-2f;
+	params->dt = 1.0f / 220.0f;
+	params->gravity = -1e1f;
+	params->damp_factor = 0.98f;
+	params->rest_density = 5000.0f;
+	params->stiffness_constant = 5.0f;
+	params->surface_coefficient = 50.0f;
+	params->viscosity_coefficient = 50.0f;
+	params->neighbor_backend = FLUID_NEIGHBOR_GRID;
+	params->neighbor_lists = true;
+	params->skin = 1e-2f;
+	params->reorder_interval = 100u;
+	params->threads = 1u;
+	params->simd = FLUID_SIMD_AUTO;
+	params->kernel = FLUID_KERNEL_SPIKY;
+	params->kernel_table_size = 0u;
+	params->pair_forces = false;
+	params->adaptive_dt = false;
+	params->cfl_factor = 0.4f;
+	params->dt_min = 1e-5f;
+	params->dt_max = 1.0f / 60.0f;
+	params->block_levels = 0u;
+	params->pressure_solver = FLUID_PRESSURE_EOS;
+	params->pressure_tolerance = 0.01f;
+	params->pressure_max_iterations = 20u;
+	params->pbf_iterations = 4u;
+	params->pbf_relaxation = 1.0f;
+	params->xsph_viscosity = 1e-2f;
+	params->sleeping = false;
+	params->sleep_velocity = 0.2f;
+	params->sleep_density = 1e-2f;
+	params->sleep_steps = 30u;
+	params->compact_storage = false;
+}
+
+fluid_sim*			fluid_sim_create(const fluid_sim_params* params)
+{
+	uint32_t particle_count = params->grid_size * params->grid_size;
+	fluid_sim* sim = __create(params, particle_count);
+	if(!sim) { return NULL; }
+
+	__seed_scene(sim);
+	for(int i = 0; i < particle_count; i++)
+	{
+		if(sim->compact_dens)
+			sim->compact_dens[i] = 0u;
+		else
+			sim->particle_dens[i] = 0.0f;
+
+		if(sim->particle_colo)
+		{
+			sim->particle_colo[3 * i + 0] = 1.0f;
+			sim->particle_colo[3 * i + 1] = 1.0f;
+			sim->particle_colo[3 * i + 2] = 1.0f;
+		}
+
+		sim->particle_accel[2 * i + 0] = 0.0f;
+		sim->particle_accel[2 * i + 1] = 0.0f;
+
+		sim->particle_id[i] = i;
+	}
+
+	return sim;
+}
+
+//Restores a snapshot; params replace the stored parameters when given, which
+//forks a new run from the saved state
+fluid_sim*			fluid_sim_load(const char* path, const fluid_sim_params* params)
+{
+	fluid_snapshot* snap = fluid_snapshot_open(path);
+	if(!snap) { return NULL; }
+	const fluid_snapshot_header* header = fluid_snapshot_get_header(snap);
+	uint32_t count = header->particle_count;
+	fluid_sim_params stored;
+	__params_from_snapshot(&stored, &header->params);
+	if(!params)
+		params = &stored;
+
+	const float* cpos = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_POSITION, 2u * sizeof(float), count);
+	const float* ppos = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_PREV_POSITION, 2u * sizeof(float), count);
+	const float* velo = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_VELOCITY, 2u * sizeof(float), count);
+	const float* dens = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_DENSITY, sizeof(float), count);
+	const float* colo = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_COLOR, 3u * sizeof(float), count);
+	const float* accel = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_ACCEL, 2u * sizeof(float), count);
+	const uint32_t* ids = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_ID, sizeof(uint32_t), count);
+	const uint32_t* levels = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_LEVEL, sizeof(uint32_t), count);
+	const uint32_t* calm = fluid_snapshot_get_array(snap, FLUID_SNAPSHOT_CALM, sizeof(uint32_t), count);
+	fluid_sim* sim = NULL;
+	if(cpos && ppos && velo && dens && colo && accel && ids)
+		sim = __create(params, count);
+	if(!sim)
+	{
+		fluid_snapshot_close(snap);
+		return NULL;
+	}
+
+	memcpy(sim->particle_cpos, cpos, count * 2u * sizeof *cpos);
+	memcpy(sim->particle_ppos, ppos, count * 2u * sizeof *ppos);
+	memcpy(sim->particle_velo, velo, count * 2u * sizeof *velo);
+	if(sim->compact_dens)
+		for(uint32_t i = 0; i < count; i++)
+		{
+			sim->compact_dens[i] = fluid_compact_density_pack(dens[i], sim->params.rest_density);
+			sim->particle_surface[i] = colo[3 * i + 1] < 0.5f;
+		}
+	else
+	{
+		memcpy(sim->particle_dens, dens, count * sizeof *dens);
+		memcpy(sim->particle_colo, colo, count * 3u * sizeof *colo);
+	}
+	memcpy(sim->particle_accel, accel, count * 2u * sizeof *accel);
+	memcpy(sim->particle_id, ids, count * sizeof *ids);
+	sim->step_count = header->step_count;
+	sim->time = header->time;
+	if(sim->params.adaptive_dt && header->params.adaptive_dt)
+		sim->dt = fclamp(header->dt, sim->params.dt_min, sim->params.dt_max);
+	//Block levels only carry over into the same block cycle
+	if(sim->particle_level && levels && header->params.block_levels == sim->params.block_levels)
+	{
+		memcpy(sim->particle_level, levels, count * sizeof *levels);
+		sim->substep = header->substep;
+	}
+	//Particles asleep when saved stay asleep; their density is the one they slept with
+	if(sim->particle_calm && calm)
+	{
+		memcpy(sim->particle_calm, calm, count * sizeof *calm);
+		memcpy(sim->particle_pdens, dens, count * sizeof *dens);
+	}
+	fluid_snapshot_close(snap);
+	return sim;
+}
+
+bool				fluid_sim_save(fluid_sim* sim, const char* path)
+{
+	uint32_t count = sim->particle_count;
+	fluid_snapshot_header header;
+	memset(&header, 0, sizeof header);
+	header.step_count = sim->step_count;
+	header.time = sim->time;
+	header.dt = sim->dt;
+	header.substep = sim->substep;
+	header.particle_count = count;
+	__params_to_snapshot(&header.params, &sim->params);
+	if(sim->particle_surface && (!__expand_colors(sim) || !__expand_densities(sim))) { return false; }
+
+	fluid_snapshot_array arrays[] = {
+		{ FLUID_SNAPSHOT_POSITION, 2u * sizeof(float), count, sim->particle_cpos },
+		{ FLUID_SNAPSHOT_PREV_POSITION, 2u * sizeof(float), count, sim->particle_ppos },
+		{ FLUID_SNAPSHOT_VELOCITY, 2u * sizeof(float), count, sim->particle_velo },
+		{ FLUID_SNAPSHOT_DENSITY, sizeof(float), count, sim->particle_dens },
+		{ FLUID_SNAPSHOT_COLOR, 3u * sizeof(float), count, sim->particle_colo },
+		{ FLUID_SNAPSHOT_ACCEL, 2u * sizeof(float), count, sim->particle_accel },
+		{ FLUID_SNAPSHOT_ID, sizeof(uint32_t), count, sim->particle_id },
+		{ 0, sizeof(uint32_t), count, NULL },
+		{ 0, sizeof(uint32_t), count, NULL }
+	};
+	//Optional arrays fill the last entries
+	uint32_t array_count = sizeof arrays / sizeof *arrays - 2u;
+	if(sim->particle_level)
+	{
+		arrays[array_count].id = FLUID_SNAPSHOT_LEVEL;
+		arrays[array_count++].data = sim->particle_level;
+	}
+	if(sim->particle_calm)
+	{
+		arrays[array_count].id = FLUID_SNAPSHOT_CALM;
+		arrays[array_count++].data = sim->particle_calm;
+	}
+	return fluid_snapshot_write(path, &header, arrays, array_count);
+}
+
+void				fluid_sim_destroy(fluid_sim* sim)
+{
+	if(!sim) { return; }
+	free(sim->particle_cpos);
+	free(sim->particle_ppos);
+	free(sim->particle_velo);
+	free(sim->particle_dens);
+	free(sim->particle_pred);
+	free(sim->particle_colo);
+	free(sim->compact_pred);
+	free(sim->compact_velo);
+	free(sim->compact_dens);
+	free(sim->particle_surface);
+	free(sim->particle_accel);
+	free(sim->particle_pres);
+	free(sim->particle_paccel);
+	free(sim->particle_pbase);
+	free(sim->particle_delta);
+	free(sim->particle_lambda);
+	free(sim->particle_dpos);
+	free(sim->particle_id);
+	free(sim->particle_level);
+	free(sim->particle_calm);
+	free(sim->particle_pdens);
+	free(sim->fast_cells);
+	free(sim->sort_keys);
+	free(sim->sort_perm);
+	free(sim->sort_tmp_keys);
+	free(sim->sort_tmp_perm);
+	free(sim->sort_scratch);
+	simp_grid_destroy(sim->grid);
+	simp_quadtree_destroy(sim->qtree);
+	simp_lqtree_destroy(sim->lqtree);
+	simp_hash_destroy(sim->hash);
+	simp_nlist_destroy(sim->nlist);
+	if(sim->scratch)
+	{
+		for(uint32_t t = 0; t < simp_pool_threads(sim->pool); t++)
+		{
+			free(sim->scratch[t].nbrs);
+			free(sim->scratch[t].acc);
+		}
+	}
+	free(sim->scratch);
+	simp_pool_destroy(sim->pool);
+	fluid_kernels_destroy(&sim->kernels);
+	free(sim);
+}
+
+void				fluid_sim_step(fluid_sim* sim)
+{
+	SIMP_PROF_SCOPE("fluid_sim_step");
+	uint32_t particle_count = sim->particle_count;
+	double t0 = wtime();
+	uint64_t nlist_hits = sim->stats.nlist_hits;
+	uint64_t nlist_rebuilds = sim->stats.nlist_rebuilds;
+	if(sim->params.reorder_interval && sim->step_count % sim->params.reorder_interval == 0u)
+		__reorder(sim);
+
+	//Each pass only writes the entries of its own particles; simp_pool_for
+	//returns once a pass is complete, which is the barrier between phases
+	if(sim->params.pressure_solver == FLUID_PRESSURE_PBF)
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pbf_predict_pass, sim);
+	else
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __predict_pass, sim);
+	__update_neighbors(sim);
+	if(sim->particle_calm)
+		__wake(sim);
+	double t1 = wtime();
+	double t2;
+	if(sim->params.pair_forces)
+	{
+		//Scatter into per-thread accumulators, then sum them per particle
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pair_clear_pass, sim);
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pair_density_pass, sim);
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pair_density_finish_pass, sim);
+		t2 = wtime();
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pair_clear_pass, sim);
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pair_force_pass, sim);
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pair_force_finish_pass, sim);
+	}
+	else if(sim->params.pressure_solver == FLUID_PRESSURE_PBF)
+	{
+		__pbf_solve(sim);
+		t2 = wtime();
+		//Only refreshes the surface colors, see __force_pass
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __force_pass, sim);
+	}
+	else
+	{
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __density_pass, sim);
+		t2 = wtime();
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __force_pass, sim);
+		if(sim->params.pressure_solver == FLUID_PRESSURE_PCISPH)
+			__pcisph_solve(sim);
+	}
+	//The iterative solvers check the lists again after moving the
+	//predictions; the step still counts once, as a rebuild if any check failed
+	if(sim->stats.nlist_rebuilds != nlist_rebuilds)
+	{
+		sim->stats.nlist_hits = nlist_hits;
+		sim->stats.nlist_rebuilds = nlist_rebuilds + 1u;
+	}
+	else if(sim->stats.nlist_hits != nlist_hits)
+		sim->stats.nlist_hits = nlist_hits + 1u;
+	double t3 = wtime();
+	if(sim->params.pressure_solver == FLUID_PRESSURE_PBF)
+		__pbf_finish(sim);
+	else
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __integrate_pass, sim);
+
+	__advance_time(sim);
+	double t4 = wtime();
+	sim->stats.index_time += t1 - t0;
+	sim->stats.density_time += t2 - t1;
+	sim->stats.force_time += t3 - t2;
+	sim->stats.integrate_time += t4 - t3;
+	sim->step_count++;
+
+	if(sim->snapshot_path && sim->snapshot_interval && sim->step_count % sim->snapshot_interval == 0u)
+	{
+		if(fluid_sim_save(sim, sim->snapshot_path))
+			sim->stats.snapshots++;
+		else
+			sim->stats.snapshot_failures++;
+	}
+}
+
+void				fluid_sim_set_mouse(fluid_sim* sim, float x, float y, int buttons)
+{
+	sim->mouse_x = x;
+	sim->mouse_y = y;
+	sim->mouse_buttons = buttons;
+}
+
+//Writes a snapshot to path every interval steps, 0 disables it
+void				fluid_sim_set_snapshot(fluid_sim* sim, const char* path, uint32_t interval)
+{
+	sim->snapshot_path = path;
+	sim->snapshot_interval = interval;
+}
+
+//Replaces the walls of the unit square with the zero level set of sdf, owned
+//by the caller, or restores them for NULL. Particles inside the solid move to
+//its surface. Not with pair forces or compact storage, and not saved in
+//snapshots.
+bool				fluid_sim_set_boundary(fluid_sim* sim, const fluid_sdf* sdf)
+{
+	const fluid_sim_params* p = &sim->params;
+	if(sdf && (p->pair_forces || p->compact_storage)) { return false; }
+	//The equation of state solver only needs the wall table
+	if(p->pressure_solver == FLUID_PRESSURE_EOS)
+		fluid_pcisph_init(&sim->pcisph, &sim->kernels, p->rest_density);
+	sim->pcisph.sdf = sdf;
+	if(!sdf) { return true; }
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+	{
+		__confine(sim, &sim->particle_cpos[2 * i + 0], &sim->particle_cpos[2 * i + 1]);
+		__confine(sim, &sim->particle_ppos[2 * i + 0], &sim->particle_ppos[2 * i + 1]);
+		sim->particle_pred[2 * i + 0] = sim->particle_cpos[2 * i + 0];
+		sim->particle_pred[2 * i + 1] = sim->particle_cpos[2 * i + 1];
+	}
+	if(sim->nlist)
+		simp_nlist_invalidate(sim->nlist);
+	return true;
+}
+
+const fluid_sdf*	fluid_sim_get_boundary(fluid_sim* sim)
+{
+	return sim->pcisph.sdf;
+}
+
+const fluid_sim_params*	fluid_sim_get_params(fluid_sim* sim)
+{
+	return &sim->params;
+}
+
+uint32_t			fluid_sim_count(fluid_sim* sim)
+{
+	return sim->particle_count;
+}
+
+uint64_t			fluid_sim_steps(fluid_sim* sim)
+{
+	return sim->step_count;
+}
+
+double				fluid_sim_time(fluid_sim* sim)
+{
+	return sim->time;
+}
+
+float				fluid_sim_dt(fluid_sim* sim)
+{
+	return sim->dt;
+}
+
+void				fluid_sim_get_stats(fluid_sim* sim, fluid_sim_stats* stats)
+{
+	*stats = sim->stats;
+}
+
+fluid_simd			fluid_sim_simd(fluid_sim* sim)
+{
+	return sim->simd;
+}
+
+//Evaluates density and acceleration on the current state with both the
+//selected kernel path and the scalar reference; returns the largest error
+//relative to the largest reference magnitude
+double				fluid_sim_simd_error(fluid_sim* sim)
+{
+	const fluid_sim_params* p = &sim->params;
+	//Compact storage runs the scalar kernels only
+	if(sim->compact_pred) { return 0.0; }
+	if(!sim->nlist)
+		__build_index(sim);
+	double max_dens = 0.0, max_dens_err = 0.0, max_acc = 0.0, max_acc_err = 0.0;
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __neighbors(sim, 0u, i, &nbr_count);
+		float dens_ref = fluid_simd_density(FLUID_SIMD_SCALAR, i, nbrs, nbr_count, sim->particle_pred, &sim->kernels);
+		float dens = fluid_simd_density(sim->simd, i, nbrs, nbr_count, sim->particle_pred, &sim->kernels);
+		float ax_ref, ay_ref, ax, ay;
+		fluid_simd_accel(FLUID_SIMD_SCALAR, i, nbrs, nbr_count, sim->particle_pred, sim->particle_velo,
+				sim->particle_dens, sim->particle_colo, &sim->kernels, p->rest_density, p->stiffness_constant,
+				p->surface_coefficient, p->viscosity_coefficient, &ax_ref, &ay_ref);
+		fluid_simd_accel(sim->simd, i, nbrs, nbr_count, sim->particle_pred, sim->particle_velo,
+				sim->particle_dens, sim->particle_colo, &sim->kernels, p->rest_density, p->stiffness_constant,
+				p->surface_coefficient, p->viscosity_coefficient, &ax, &ay);
+		max_dens = fmax(max_dens, fabs(dens_ref));
+		max_dens_err = fmax(max_dens_err, fabs(dens - dens_ref));
+		max_acc = fmax(max_acc, hypot(ax_ref, ay_ref));
+		max_acc_err = fmax(max_acc_err, hypot(ax - ax_ref, ay - ay_ref));
+	}
+	double dens_err = max_dens > 0.0 ? max_dens_err / max_dens : 0.0;
+	double acc_err = max_acc > 0.0 ? max_acc_err / max_acc : 0.0;
+	return fmax(dens_err, acc_err);
+}
+
+//Same measure for compact storage against the float kernels: both evaluate
+//density and then force from the current positions and velocities, the
+//float side in float arrays allocated here. A particle whose surface flag
+//differs between the two gets or loses the whole surface tension term; those
+//are counted in surface_flips and left out of the force error.
+double				fluid_sim_compact_error(fluid_sim* sim, uint32_t* surface_flips)
+{
+	const fluid_sim_params* p = &sim->params;
+	uint32_t count = sim->particle_count;
+	*surface_flips = 0u;
+	if(!sim->compact_pred) { return 0.0; }
+	float* pos = malloc(count * 2u * sizeof *pos);
+	float* dens = malloc(count * sizeof *dens);
+	float* colo = malloc(count * 3u * sizeof *colo);
+	uint16_t* cpos = malloc(count * 2u * sizeof *cpos);
+	uint16_t* cvel = malloc(count * 2u * sizeof *cvel);
+	uint16_t* cdens = malloc(count * sizeof *cdens);
+	double max_dens = 0.0, max_dens_err = 0.0, max_acc = 0.0, max_acc_err = 0.0;
+	if(pos && dens && colo && cpos && cvel && cdens)
+	{
+		float fixed_step = 1.1666667f * sim->dt;
+		for(uint32_t i = 0; i < count; i++)
+		{
+			pos[2 * i + 0] = sim->particle_cpos[2 * i + 0] + sim->particle_velo[2 * i + 0] * fixed_step;
+			pos[2 * i + 1] = sim->particle_cpos[2 * i + 1] + sim->particle_velo[2 * i + 1] * fixed_step;
+			fluid_compact_pack(i, pos[2 * i + 0], pos[2 * i + 1], cpos);
+			fluid_compact_velocity_pack(i, sim->particle_velo[2 * i + 0], sim->particle_velo[2 * i + 1], cvel);
+		}
+		__build_index(sim);
+		for(uint32_t i = 0; i < count; i++)
+		{
+			uint32_t nbr_count = __gather(sim, 0u, pos[2 * i + 0], pos[2 * i + 1], p->h);
+			const uint32_t* nbrs = sim->scratch[0].nbrs;
+			dens[i] = fluid_simd_density(FLUID_SIMD_SCALAR, i, nbrs, nbr_count, pos, &sim->kernels);
+			float d = fluid_simd_compact_density(sim->simd, i, nbrs, nbr_count, cpos, &sim->kernels);
+			cdens[i] = fluid_compact_density_pack(d, p->rest_density);
+			max_dens = fmax(max_dens, fabs(dens[i]));
+			max_dens_err = fmax(max_dens_err, fabs(d - dens[i]));
+		}
+		for(uint32_t i = 0; i < count; i++)
+		{
+			uint32_t nbr_count = __gather(sim, 0u, pos[2 * i + 0], pos[2 * i + 1], p->h);
+			const uint32_t* nbrs = sim->scratch[0].nbrs;
+			float ax_ref, ay_ref, ax, ay;
+			fluid_simd_accel(FLUID_SIMD_SCALAR, i, nbrs, nbr_count, pos, sim->particle_velo, dens, colo,
+					&sim->kernels, p->rest_density, p->stiffness_constant, p->surface_coefficient,
+					p->viscosity_coefficient, &ax_ref, &ay_ref);
+			bool surface = fluid_simd_compact_accel(sim->simd, i, nbrs, nbr_count, cpos, cvel, cdens,
+					&sim->kernels, p->rest_density, p->stiffness_constant, p->surface_coefficient, p->viscosity_coefficient, &ax, &ay);
+			max_acc = fmax(max_acc, hypot(ax_ref, ay_ref));
+			if(surface != (colo[3 * i + 1] < 0.5f))
+				(*surface_flips)++;
+			else
+				max_acc_err = fmax(max_acc_err, hypot(ax - ax_ref, ay - ay_ref));
+		}
+	}
+	free(pos);
+	free(dens);
+	free(colo);
+	free(cpos);
+	free(cvel);
+	free(cdens);
+	double dens_err = max_dens > 0.0 ? max_dens_err / max_dens : 0.0;
+	double acc_err = max_acc > 0.0 ? max_acc_err / max_acc : 0.0;
+	return fmax(dens_err, acc_err);
+}
+
+const float*		fluid_sim_positions(fluid_sim* sim)
+{
+	return sim->particle_cpos;
+}
+
+const float*		fluid_sim_velocities(fluid_sim* sim)
+{
+	return sim->particle_velo;
+}
+
+//Compact storage expands the densities on every call
+const float*		fluid_sim_densities(fluid_sim* sim)
+{
+	if(sim->compact_dens && !__expand_densities(sim)) { return NULL; }
+	return sim->particle_dens;
+}
+
+//Compact storage expands the surface flags on every call
+const float*		fluid_sim_colors(fluid_sim* sim)
+{
+	if(sim->particle_surface && !__expand_colors(sim)) { return NULL; }
+	return sim->particle_colo;
+}
+
+const uint32_t*		fluid_sim_ids(fluid_sim* sim)
+{
+	return sim->particle_id;
+}
+
+//Writes every particle as a fluid_vertex, in parallel on the solver's threads
+void				fluid_sim_pack_vertices(fluid_sim* sim, fluid_vertex* out)
+{
+	sim->pack_out = out;
+	simp_pool_for(sim->pool, sim->particle_count, PASS_CHUNK, __pack_pass, sim);
+	sim->pack_out = NULL;
+}
+
+void				fluid_sim_export(fluid_sim* sim, fluid_particle* out)
+{
+	const float* dens = fluid_sim_densities(sim);
+	const float* colo = fluid_sim_colors(sim);
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+	{
+		fluid_particle* p = &out[i];
+		p->id = sim->particle_id[i];
+		p->x = sim->particle_cpos[2 * i + 0];
+		p->y = sim->particle_cpos[2 * i + 1];
+		p->px = sim->particle_ppos[2 * i + 0];
+		p->py = sim->particle_ppos[2 * i + 1];
+		p->vx = sim->particle_velo[2 * i + 0];
+		p->vy = sim->particle_velo[2 * i + 1];
+		p->ax = sim->particle_accel[2 * i + 0];
+		p->ay = sim->particle_accel[2 * i + 1];
+		p->dens = dens ? dens[i] : 0.0f;
+		p->r = colo ? colo[3 * i + 0] : 1.0f;
+		p->g = colo ? colo[3 * i + 1] : 1.0f;
+		p->b = colo ? colo[3 * i + 2] : 1.0f;
+	}
+}
+
+//Replaces every particle with state advanced steps fixed steps elsewhere,
+//particle i going to slot i; the neighbor search is rebuilt around it
+void				fluid_sim_import(fluid_sim* sim, const fluid_particle* particles, uint64_t steps)
+{
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+	{
+		const fluid_particle* p = &particles[i];
+		sim->particle_id[i] = p->id;
+		sim->particle_cpos[2 * i + 0] = p->x;
+		sim->particle_cpos[2 * i + 1] = p->y;
+		sim->particle_ppos[2 * i + 0] = p->px;
+		sim->particle_ppos[2 * i + 1] = p->py;
+		sim->particle_velo[2 * i + 0] = p->vx;
+		sim->particle_velo[2 * i + 1] = p->vy;
+		sim->particle_accel[2 * i + 0] = p->ax;
+		sim->particle_accel[2 * i + 1] = p->ay;
+		if(sim->compact_pred)
+		{
+			fluid_compact_pack(i, p->x, p->y, sim->compact_pred);
+			sim->compact_dens[i] = fluid_compact_density_pack(p->dens, sim->params.rest_density);
+			sim->particle_surface[i] = p->g < 0.5f;
+		}
+		else
+		{
+			sim->particle_pred[2 * i + 0] = p->x;
+			sim->particle_pred[2 * i + 1] = p->y;
+			sim->particle_dens[i] = p->dens;
+			sim->particle_colo[3 * i + 0] = p->r;
+			sim->particle_colo[3 * i + 1] = p->g;
+			sim->particle_colo[3 * i + 2] = p->b;
+		}
+	}
+	if(sim->particle_level)
+	{
+		memset(sim->particle_level, 0, sim->particle_count * sizeof *sim->particle_level);
+		sim->substep = 0u;
+	}
+	if(sim->particle_calm)
+		memset(sim->particle_calm, 0, sim->particle_count * sizeof *sim->particle_calm);
+	sim->step_count += steps;
+	sim->time += steps * (double)sim->dt;
+	if(sim->nlist)
+		simp_nlist_invalidate(sim->nlist);
+	__update_neighbors(sim);
+}
+
+
+
+//Allocates a simulation of particle_count particles with uninitialized particle arrays
+static fluid_sim*	__create(const fluid_sim_params* params, uint32_t particle_count)
+{
+	fluid_sim* sim = calloc(1u, sizeof *sim);
+	if(!sim) { return NULL; }
+	sim->params = *params;
+	if(!fluid_kernels_create(&sim->kernels, params->kernel, params->h, params->kernel_table_size))
+	{
+		free(sim);
+		return NULL;
+	}
+	sim->simd = fluid_simd_supports(&sim->kernels) ? fluid_simd_resolve(params->simd) : FLUID_SIMD_SCALAR;
+
+	sim->particle_count = particle_count;
+	sim->particle_cpos = malloc(particle_count * 2u * sizeof *sim->particle_cpos);
+	sim->particle_ppos = malloc(particle_count * 2u * sizeof *sim->particle_ppos);
+	sim->particle_velo = malloc(particle_count * 2u * sizeof *sim->particle_velo);
+	if(sim->params.pressure_solver != FLUID_PRESSURE_EOS || sim->params.pair_forces)
+		sim->params.compact_storage = false;
+	if(sim->params.compact_storage)
+	{
+		sim->compact_pred = malloc(particle_count * 2u * sizeof *sim->compact_pred);
+		sim->compact_velo = malloc(particle_count * 2u * sizeof *sim->compact_velo);
+		sim->compact_dens = malloc(particle_count * sizeof *sim->compact_dens);
+		sim->particle_surface = calloc(particle_count, sizeof *sim->particle_surface);
+	}
+	else
+	{
+		sim->particle_dens = malloc(particle_count * 1u * sizeof *sim->particle_dens);
+		sim->particle_pred = malloc(particle_count * 2u * sizeof *sim->particle_pred);
+		sim->particle_colo = malloc(particle_count * 3u * sizeof *sim->particle_colo);
+	}
+	sim->particle_accel = malloc(particle_count * 2u * sizeof *sim->particle_accel);
+	sim->particle_id = malloc(particle_count * sizeof *sim->particle_id);
+	if(sim->params.pressure_solver == FLUID_PRESSURE_PCISPH)
+	{
+		sim->params.pair_forces = false;
+		sim->params.block_levels = 0u;
+		sim->particle_pres = malloc(particle_count * sizeof *sim->particle_pres);
+		sim->particle_paccel = malloc(particle_count * 2u * sizeof *sim->particle_paccel);
+		sim->particle_pbase = malloc(particle_count * 2u * sizeof *sim->particle_pbase);
+		sim->particle_delta = malloc(particle_count * sizeof *sim->particle_delta);
+		fluid_pcisph_init(&sim->pcisph, &sim->kernels, params->rest_density);
+	}
+	if(sim->params.pressure_solver == FLUID_PRESSURE_PBF)
+	{
+		sim->params.pair_forces = false;
+		sim->params.block_levels = 0u;
+		sim->params.adaptive_dt = false;
+		if(sim->params.pbf_iterations == 0u)
+			sim->params.pbf_iterations = 1u;
+		sim->particle_lambda = malloc(particle_count * sizeof *sim->particle_lambda);
+		sim->particle_dpos = malloc(particle_count * 2u * sizeof *sim->particle_dpos);
+		fluid_pcisph_init(&sim->pcisph, &sim->kernels, params->rest_density);
+	}
+	if(sim->params.block_levels > MAX_BLOCK_LEVELS)
+		sim->params.block_levels = MAX_BLOCK_LEVELS;
+	if(sim->params.block_levels > 1u)
+	{
+		sim->params.adaptive_dt = true;
+		sim->particle_level = calloc(particle_count, sizeof *sim->particle_level);
+	}
+	if(sim->params.pressure_solver != FLUID_PRESSURE_EOS || sim->params.pair_forces)
+		sim->params.sleeping = false;
+	if(sim->params.sleeping)
+	{
+		if(sim->params.sleep_steps == 0u)
+			sim->params.sleep_steps = 1u;
+		sim->fast_side = (uint32_t)(1.0f / params->h) + 1u;
+		sim->particle_calm = calloc(particle_count, sizeof *sim->particle_calm);
+		sim->particle_pdens = calloc(particle_count, sizeof *sim->particle_pdens);
+		sim->fast_cells = malloc(sim->fast_side * sim->fast_side * sizeof *sim->fast_cells);
+	}
+	if(params->threads > 1u)
+		sim->pool = simp_pool_create(params->threads);
+	sim->scratch = calloc(simp_pool_threads(sim->pool), sizeof *sim->scratch);
+	bool acc_failed = false;
+	if(sim->scratch)
+	{
+		for(uint32_t t = 0; t < simp_pool_threads(sim->pool); t++)
+		{
+			sim->scratch[t].dt_limit = INFINITY;
+			if(!sim->params.pair_forces) { continue; }
+			sim->scratch[t].acc = malloc(particle_count * FLUID_PAIR_STRIDE * sizeof *sim->scratch[t].acc);
+			acc_failed = acc_failed || !sim->scratch[t].acc;
+		}
+	}
+	if(params->reorder_interval)
+	{
+		sim->sort_keys = malloc(particle_count * sizeof *sim->sort_keys);
+		sim->sort_perm = malloc(particle_count * sizeof *sim->sort_perm);
+		sim->sort_tmp_keys = malloc(particle_count * sizeof *sim->sort_tmp_keys);
+		sim->sort_tmp_perm = malloc(particle_count * sizeof *sim->sort_tmp_perm);
+		//Colors are the only array with three values per particle
+		sim->sort_scratch = malloc(particle_count * (sim->params.compact_storage ? 2u : 3u) * sizeof *sim->sort_scratch);
+	}
+	if(params->neighbor_backend == FLUID_NEIGHBOR_GRID)
+		sim->grid = simp_grid_create(0.0f, 0.0f, 1.0f, 1.0f, params->h);
+	else if(params->neighbor_backend == FLUID_NEIGHBOR_LINEAR_QUADTREE)
+		sim->lqtree = simp_lqtree_create(0.0f, 0.0f, 1.0f, 1.0f, 8u);
+	else if(params->neighbor_backend == FLUID_NEIGHBOR_HASH)
+		sim->hash = simp_hash_create(params->h);
+	else
+		sim->qtree = simp_quadtree_create(0.0f, 0.0f, 1.0f, 1.0f, 4u);
+	if(params->neighbor_lists)
+		sim->nlist = simp_nlist_create(params->h, params->skin);
+	if(!sim->particle_cpos || !sim->particle_ppos || !sim->particle_velo ||
+	   !sim->particle_accel ||
+	   (sim->params.compact_storage ? !sim->compact_pred || !sim->compact_velo || !sim->compact_dens ||
+	                                  !sim->particle_surface :
+	                                  !sim->particle_dens || !sim->particle_pred || !sim->particle_colo) ||
+	   !sim->particle_id || !sim->scratch || acc_failed || (params->threads > 1u && !sim->pool) ||
+	   (sim->params.block_levels > 1u && !sim->particle_level) ||
+	   (sim->params.sleeping && (!sim->particle_calm || !sim->particle_pdens || !sim->fast_cells)) ||
+	   (sim->params.pressure_solver == FLUID_PRESSURE_PCISPH && (!sim->particle_pres || !sim->particle_paccel ||
+	                                                                 !sim->particle_pbase || !sim->particle_delta)) ||
+	   (sim->params.pressure_solver == FLUID_PRESSURE_PBF && (!sim->particle_lambda || !sim->particle_dpos)) ||
+	   (params->reorder_interval && (!sim->sort_keys || !sim->sort_perm || !sim->sort_tmp_keys ||
+	                                 !sim->sort_tmp_perm || !sim->sort_scratch)) ||
+	   (params->neighbor_backend == FLUID_NEIGHBOR_GRID && !sim->grid) ||
+	   (params->neighbor_backend == FLUID_NEIGHBOR_QUADTREE && !sim->qtree) ||
+	   (params->neighbor_backend == FLUID_NEIGHBOR_LINEAR_QUADTREE && !sim->lqtree) ||
+	   (params->neighbor_backend == FLUID_NEIGHBOR_HASH && !sim->hash) ||
+	   (params->neighbor_lists && !sim->nlist))
+	{
+		fluid_sim_destroy(sim);
+		return NULL;
+	}
+
+	//Explicit viscosity needs dt < h^2 / (8 nu) with nu = mu / rho0
+	sim->dt_viscosity = params->viscosity_coefficient > 0.0f ?
+		0.125f * params->h * params->h * params->rest_density / params->viscosity_coefficient : INFINITY;
+	sim->dt = params->dt;
+	if(sim->params.adaptive_dt)
+		sim->dt = fclamp(fminf(sim->dt, sim->dt_viscosity), params->dt_min, params->dt_max);
+	return sim;
+}
+
+static void			__seed_scene(fluid_sim* sim)
+{
+	const fluid_sim_params* p = &sim->params;
+	uint32_t count = sim->particle_count;
+	if(p->scene == FLUID_SCENE_DAM_BREAK)
+	{
+		//A water column against the left wall
+		__seed_rect(sim, 0u, count, 0.02f, 0.02f, 0.25f, 0.6f);
+	}
+	else if(p->scene == FLUID_SCENE_DROPLETS)
+	{
+		//Two drops on a slightly offset head-on course
+		__seed_disc(sim, 0u, count / 2u, 0.3f, 0.55f, 0.15f, 1.5f, 0.0f);
+		__seed_disc(sim, count / 2u, count, 0.7f, 0.45f, 0.15f, -1.5f, 0.0f);
+	}
+	else
+	{
+		uint32_t grid_size = p->grid_size;
+		for(int i = 0; i < count; i++)
+		{
+			int i1 = i % grid_size;
+			int i2 = (i - i1) / grid_size;
+			sim->particle_cpos[2 * i + 0] = 0.3f + 0.4f * ((float)i1 + 0.5f) / grid_size;
+			sim->particle_cpos[2 * i + 1] = 0.3f + 0.4f * ((float)i2 + 0.5f) / grid_size;
+			sim->particle_velo[2 * i + 0] = 0.0f;
+			sim->particle_velo[2 * i + 1] = 0.0f;
+		}
+	}
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		if(p->seed)
+		{
+			float dx, dy;
+			hrand2d(p->seed * 0x9E3779B1u ^ i, &dx, &dy);
+			sim->particle_cpos[2 * i + 0] += dx * p->radius * 0.1f;
+			sim->particle_cpos[2 * i + 1] += dy * p->radius * 0.1f;
+		}
+		sim->particle_ppos[2 * i + 0] = sim->particle_cpos[2 * i + 0];
+		sim->particle_ppos[2 * i + 1] = sim->particle_cpos[2 * i + 1];
+	}
+}
+
+//Fills the rectangle row by row at the spacing that fits end - begin particles
+static void			__seed_rect(fluid_sim* sim, uint32_t begin, uint32_t end, float x0, float y0, float width, float height)
+{
+	uint32_t count = end - begin;
+	if(!count) { return; }
+	float spacing = sqrtf(width * height / count);
+	uint32_t cols = (uint32_t)(width / spacing + 0.5f);
+	if(cols < 1u) { cols = 1u; }
+	uint32_t rows = (count + cols - 1u) / cols;
+	for(uint32_t k = 0; k < count; k++)
+	{
+		uint32_t i = begin + k;
+		sim->particle_cpos[2 * i + 0] = x0 + width * ((float)(k % cols) + 0.5f) / cols;
+		sim->particle_cpos[2 * i + 1] = y0 + height * ((float)(k / cols) + 0.5f) / rows;
+		sim->particle_velo[2 * i + 0] = 0.0f;
+		sim->particle_velo[2 * i + 1] = 0.0f;
+	}
+}
+
+//Sunflower spiral: any count fills the disc at uniform density
+static void			__seed_disc(fluid_sim* sim, uint32_t begin, uint32_t end, float cx, float cy, float r, float vx, float vy)
+{
+	uint32_t count = end - begin;
+	for(uint32_t k = 0; k < count; k++)
+	{
+		uint32_t i = begin + k;
+		float d = r * sqrtf(((float)k + 0.5f) / count);
+		float t = (float)k * 2.39996323f;
+		sim->particle_cpos[2 * i + 0] = cx + d * cosf(t);
+		sim->particle_cpos[2 * i + 1] = cy + d * sinf(t);
+		sim->particle_velo[2 * i + 0] = vx;
+		sim->particle_velo[2 * i + 1] = vy;
+	}
+}
+
+static void			__params_to_snapshot(fluid_snapshot_params* out, const fluid_sim_params* p)
+{
+	out->radius = p->radius;
+	out->h = p->h;
+	out->dt = p->dt;
+	out->gravity = p->gravity;
+	out->damp_factor = p->damp_factor;
+	out->rest_density = p->rest_density;
+	out->stiffness_constant = p->stiffness_constant;
+	out->surface_coefficient = p->surface_coefficient;
+	out->viscosity_coefficient = p->viscosity_coefficient;
+	out->skin = p->skin;
+	out->cfl_factor = p->cfl_factor;
+	out->dt_min = p->dt_min;
+	out->dt_max = p->dt_max;
+	out->neighbor_backend = p->neighbor_backend;
+	out->neighbor_lists = p->neighbor_lists;
+	out->reorder_interval = p->reorder_interval;
+	out->threads = p->threads;
+	out->simd = p->simd;
+	out->kernel = p->kernel;
+	out->kernel_table_size = p->kernel_table_size;
+	out->pair_forces = p->pair_forces;
+	out->adaptive_dt = p->adaptive_dt;
+	out->block_levels = p->block_levels;
+	out->pressure_solver = p->pressure_solver;
+	out->pressure_max_iterations = p->pressure_max_iterations;
+	out->pressure_tolerance = p->pressure_tolerance;
+	out->pbf_iterations = p->pbf_iterations;
+	out->pbf_relaxation = p->pbf_relaxation;
+	out->xsph_viscosity = p->xsph_viscosity;
+	out->sleeping = p->sleeping;
+	out->sleep_steps = p->sleep_steps;
+	out->sleep_velocity = p->sleep_velocity;
+	out->sleep_density = p->sleep_density;
+	out->compact_storage = p->compact_storage;
+}
+
+//Fields the snapshot does not store keep their defaults
+static void			__params_from_snapshot(fluid_sim_params* out, const fluid_snapshot_params* p)
+{
+	fluid_sim_default_params(out);
+	out->radius = p->radius;
+	out->h = p->h;
+	out->dt = p->dt;
+	out->gravity = p->gravity;
+	out->damp_factor = p->damp_factor;
+	out->rest_density = p->rest_density;
+	out->stiffness_constant = p->stiffness_constant;
+	out->surface_coefficient = p->surface_coefficient;
+	out->viscosity_coefficient = p->viscosity_coefficient;
+	out->skin = p->skin;
+	out->cfl_factor = p->cfl_factor;
+	out->dt_min = p->dt_min;
+	out->dt_max = p->dt_max;
+	out->neighbor_backend = (fluid_neighbor_backend)p->neighbor_backend;
+	out->neighbor_lists = p->neighbor_lists != 0u;
+	out->reorder_interval = p->reorder_interval;
+	out->threads = p->threads;
+	out->simd = (fluid_simd)p->simd;
+	out->kernel = (fluid_kernel_type)p->kernel;
+	out->kernel_table_size = p->kernel_table_size;
+	out->pair_forces = p->pair_forces != 0u;
+	out->adaptive_dt = p->adaptive_dt != 0u;
+	out->block_levels = p->block_levels;
+	//Zero in snapshots from before the PCISPH and PBF solvers, and likewise
+	//below for the sleep and compact storage parameters of versions 1 and 2
+	if(p->pressure_solver == FLUID_PRESSURE_PCISPH)
+	{
+		out->pressure_solver = FLUID_PRESSURE_PCISPH;
+		out->pressure_max_iterations = p->pressure_max_iterations;
+		out->pressure_tolerance = p->pressure_tolerance;
+	}
+	else if(p->pressure_solver == FLUID_PRESSURE_PBF)
+	{
+		out->pressure_solver = FLUID_PRESSURE_PBF;
+		out->pbf_iterations = p->pbf_iterations;
+		out->pbf_relaxation = p->pbf_relaxation;
+		out->xsph_viscosity = p->xsph_viscosity;
+	}
+	if(p->sleeping)
+	{
+		out->sleeping = true;
+		out->sleep_steps = p->sleep_steps;
+		out->sleep_velocity = p->sleep_velocity;
+		out->sleep_density = p->sleep_density;
+	}
+	out->compact_storage = p->compact_storage != 0u;
+}
+
+static void			__predict_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("predict");
+	fluid_sim* sim = ctx;
+	const float* particle_cpos = sim->particle_cpos;
+	const float* particle_velo = sim->particle_velo;
+	float* particle_pred = sim->particle_pred;
+	float fixed_step = 1.1666667f * sim->dt;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float x = particle_cpos[2 * i + 0] + particle_velo[2 * i + 0] * fixed_step;
+		float y = particle_cpos[2 * i + 1] + particle_velo[2 * i + 1] * fixed_step;
+		if(sim->compact_pred)
+		{
+			fluid_compact_pack(i, x, y, sim->compact_pred);
+			fluid_compact_velocity_pack(i, particle_velo[2 * i + 0], particle_velo[2 * i + 1], sim->compact_velo);
+		}
+		else
+		{
+			particle_pred[2 * i + 0] = x;
+			particle_pred[2 * i + 1] = y;
+		}
+	}
+}
+
+static void			__nlist_count_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("nlist_count");
+	fluid_sim* sim = ctx;
+	float cutoff = simp_nlist_cutoff(sim->nlist);
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float x, y;
+		__pred(sim, i, &x, &y);
+		uint32_t count = __gather(sim, thread, x, y, cutoff);
+		simp_nlist_count(sim->nlist, i, sim->scratch[thread].nbrs, count);
+	}
+}
+
+static void			__nlist_fill_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("nlist_fill");
+	fluid_sim* sim = ctx;
+	float cutoff = simp_nlist_cutoff(sim->nlist);
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float x, y;
+		__pred(sim, i, &x, &y);
+		uint32_t count = __gather(sim, thread, x, y, cutoff);
+		simp_nlist_fill(sim->nlist, i, sim->scratch[thread].nbrs, count);
+	}
+}
+
+static void			__density_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("density");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		if(__asleep(sim, i)) { continue; }
+		const uint32_t* nbrs = __neighbors(sim, thread, i, &nbr_count);
+		if(sim->compact_dens)
+			sim->compact_dens[i] = fluid_compact_density_pack(fluid_simd_compact_density(sim->simd, i, nbrs,
+					nbr_count, sim->compact_pred, &sim->kernels), sim->params.rest_density);
+		else if(sim->pcisph.sdf)
+			sim->particle_dens[i] = fluid_pcisph_density(&sim->pcisph, sim->simd, i, nbrs, nbr_count, sim->particle_pred,
+					&sim->kernels);
+		else
+			sim->particle_dens[i] = fluid_simd_density(sim->simd, i, nbrs, nbr_count, sim->particle_pred, &sim->kernels);
+		SIMP_PROF_COUNT(SIMP_PROF_NEIGHBORS, __in_radius(sim, i, nbrs, nbr_count));
+	}
+}
+
+static void			__force_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("force");
+	fluid_sim* sim = ctx;
+	const fluid_sim_params* p = &sim->params;
+	//PCISPH solves for pressure afterwards, this pass only adds the other forces.
+	//PBF keeps it for the surface colors: the explicit surface tension is not
+	//stable at frame-sized steps and XSPH takes over viscosity.
+	bool pbf = p->pressure_solver == FLUID_PRESSURE_PBF;
+	float stiffness_constant = p->pressure_solver == FLUID_PRESSURE_EOS ? p->stiffness_constant : 0.0f;
+	float surface_coefficient = pbf ? 0.0f : p->surface_coefficient;
+	float viscosity_coefficient = pbf ? 0.0f : p->viscosity_coefficient;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		//Particles inside their block keep the acceleration of its first step
+		if(!__active(sim, i) || __asleep(sim, i)) { continue; }
+		sim->scratch[thread].force_evaluations++;
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __neighbors(sim, thread, i, &nbr_count);
+		if(sim->particle_surface)
+			sim->particle_surface[i] = fluid_simd_compact_accel(sim->simd, i, nbrs, nbr_count, sim->compact_pred,
+					sim->compact_velo, sim->compact_dens, &sim->kernels, p->rest_density, stiffness_constant, surface_coefficient,
+					viscosity_coefficient, &sim->particle_accel[2 * i + 0], &sim->particle_accel[2 * i + 1]);
+		else
+			fluid_simd_accel(sim->simd, i, nbrs, nbr_count, sim->particle_pred, sim->particle_velo, sim->particle_dens,
+					sim->particle_colo, &sim->kernels, p->rest_density, stiffness_constant, surface_coefficient,
+					viscosity_coefficient, &sim->particle_accel[2 * i + 0], &sim->particle_accel[2 * i + 1]);
+		if(sim->pcisph.sdf && stiffness_constant != 0.0f)
+			__wall_accel(sim, i, &sim->particle_accel[2 * i + 0], &sim->particle_accel[2 * i + 1]);
+	}
+}
+
+static void			__pair_clear_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pair_clear");
+	fluid_sim* sim = ctx;
+	for(uint32_t t = 0; t < simp_pool_threads(sim->pool); t++)
+		memset(sim->scratch[t].acc + FLUID_PAIR_STRIDE * begin, 0,
+			(end - begin) * FLUID_PAIR_STRIDE * sizeof *sim->scratch[t].acc);
+}
+
+static void			__pair_density_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pair_density");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __neighbors(sim, thread, i, &nbr_count);
+		fluid_pair_density(i, nbrs, nbr_count, sim->particle_pred, &sim->kernels, sim->scratch[thread].acc);
+		SIMP_PROF_COUNT(SIMP_PROF_NEIGHBORS, __in_radius(sim, i, nbrs, nbr_count));
+	}
+}
+
+static void			__pair_density_finish_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pair_density_finish");
+	fluid_sim* sim = ctx;
+	uint32_t threads = simp_pool_threads(sim->pool);
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float sum = 0.0f;
+		for(uint32_t t = 0; t < threads; t++)
+			sum += sim->scratch[t].acc[i];
+		sim->particle_dens[i] = fluid_pair_density_finish(i, sum, sim->particle_pred, &sim->kernels);
+	}
+}
+
+static void			__pair_force_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pair_force");
+	fluid_sim* sim = ctx;
+	const fluid_sim_params* p = &sim->params;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __neighbors(sim, thread, i, &nbr_count);
+		fluid_pair_accel(i, nbrs, nbr_count, sim->particle_pred, sim->particle_velo, sim->particle_dens,
+				&sim->kernels, p->rest_density, p->stiffness_constant, p->viscosity_coefficient, sim->scratch[thread].acc);
+	}
+}
+
+static void			__pair_force_finish_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pair_force_finish");
+	fluid_sim* sim = ctx;
+	uint32_t threads = simp_pool_threads(sim->pool);
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float sum[FLUID_PAIR_STRIDE] = {0.0f};
+		for(uint32_t t = 0; t < threads; t++)
+			for(uint32_t k = 0; k < FLUID_PAIR_STRIDE; k++)
+				sum[k] += sim->scratch[t].acc[FLUID_PAIR_STRIDE * i + k];
+		fluid_pair_accel_finish(i, sum, sim->particle_dens, sim->params.surface_coefficient, sim->particle_colo,
+				&sim->particle_accel[2 * i + 0], &sim->particle_accel[2 * i + 1]);
+		sim->scratch[thread].force_evaluations++;
+	}
+}
+
+static void			__integrate_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("integrate");
+	fluid_sim* sim = ctx;
+	const fluid_sim_params* p = &sim->params;
+	float* particle_cpos = sim->particle_cpos;
+	float* particle_ppos = sim->particle_ppos;
+	float* particle_velo = sim->particle_velo;
+	float* particle_accel = sim->particle_accel;
+	const float* particle_paccel = sim->particle_paccel;
+	float dt = sim->dt;
+	float radius = p->radius;
+	float dt_limit = sim->scratch[thread].dt_limit;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		//Sleeping particles stay where they are
+		if(__asleep(sim, i))
+		{
+			particle_ppos[2 * i + 0] = particle_cpos[2 * i + 0];
+			particle_ppos[2 * i + 1] = particle_cpos[2 * i + 1];
+			continue;
+		}
+
+		//Fetch position data
+		float px = particle_cpos[2 * i + 0];
+		float py = particle_cpos[2 * i + 1];
+		float vx = particle_velo[2 * i + 0];
+		float vy = particle_velo[2 * i + 1];
+		float ax = particle_accel[2 * i + 0];
+		float ay = particle_accel[2 * i + 1];
+		if(particle_paccel)
+		{
+			ax += particle_paccel[2 * i + 0];
+			ay += particle_paccel[2 * i + 1];
+		}
+
+		//Save previous location
+		particle_ppos[2 * i + 0] = px;
+		particle_ppos[2 * i + 1] = py;
+
+		//Inactive particles only drift; an active one is kicked for its whole block
+		if(__active(sim, i))
+		{
+			float kick = dt;
+			if(sim->particle_level)
+			{
+				float limit = __dt_limit(sim, vx, vy, ax, ay + p->gravity);
+				sim->particle_level[i] = __block_level(sim, i, limit);
+				kick = dt * (float)(1u << sim->particle_level[i]);
+			}
+
+			//Gravity
+			vy += p->gravity * kick;
+
+			//Fluid acceleration
+			vx += ax * kick;
+			vy += ay * kick;
+
+			__mouse_kick(sim, px, py, kick, &vx, &vy);
+
+			//Clamp velocity to 0 if too small
+			vx = (fabs(vx) > 1e-6) * vx;
+			vy = (fabs(vy) > 1e-6) * vy;
+		}
+
+		px += vx * dt;
+		py += vy * dt;
+
+		//Boundary collision resolution
+		if(sim->pcisph.sdf)
+		{
+			//Only the velocity into the solid is reflected
+			float nx, ny;
+			if(__push_out(sim, &px, &py, &nx, &ny))
+			{
+				float vn = fminf(vx * nx + vy * ny, 0.0f);
+				vx -= 2.0f * p->damp_factor * vn * nx;
+				vy -= 2.0f * p->damp_factor * vn * ny;
+			}
+		}
+		else
+		{
+			if(px - radius < 0.0f || px + radius > 1.0f)
+			{
+				px = fclamp(px, radius, 1.0f - radius);
+				vx -= 2.0f * p->damp_factor * vx;
+			}
+			if(py - radius < 0.0f || py + radius > 1.0f)
+			{
+				py = fclamp(py, radius, 1.0f - radius);
+				vy -= 2.0f * p->damp_factor * vy;
+			}
+		}
+
+		if(sim->particle_calm && __calm_step(sim, i, vx, vy))
+		{
+			vx = vy = 0.0f;
+			particle_accel[2 * i + 0] = particle_accel[2 * i + 1] = 0.0f;
+		}
+
+		particle_cpos[2 * i + 0] = px;
+		particle_cpos[2 * i + 1] = py;
+		particle_velo[2 * i + 0] = vx;
+		particle_velo[2 * i + 1] = vy;
+
+		if(p->adaptive_dt)
+			dt_limit = fminf(dt_limit, __dt_limit(sim, vx, vy, ax, ay + p->gravity));
+	}
+	sim->scratch[thread].dt_limit = dt_limit;
+}
+
+static void			__pack_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pack");
+	fluid_sim* sim = ctx;
+	fluid_vertex* out = sim->pack_out;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		fluid_vertex v;
+		v.x = sim->particle_cpos[2 * i + 0];
+		v.y = sim->particle_cpos[2 * i + 1];
+		v.vx = f32_to_f16(sim->particle_velo[2 * i + 0]);
+		v.vy = f32_to_f16(sim->particle_velo[2 * i + 1]);
+		if(sim->particle_surface)
+		{
+			v.r = 255u;
+			v.g = v.b = sim->particle_surface[i] ? 0u : 255u;
+		}
+		else
+		{
+			v.r = (uint8_t)(fclamp(sim->particle_colo[3 * i + 0], 0.0f, 1.0f) * 255.0f + 0.5f);
+			v.g = (uint8_t)(fclamp(sim->particle_colo[3 * i + 1], 0.0f, 1.0f) * 255.0f + 0.5f);
+			v.b = (uint8_t)(fclamp(sim->particle_colo[3 * i + 2], 0.0f, 1.0f) * 255.0f + 0.5f);
+		}
+		v.a = 255u;
+		//One store per vertex; out may be write-combined mapped memory
+		out[i] = v;
+	}
+}
+
+//The prediction without pressure becomes both the first prediction and the base
+static void			__pcisph_setup_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pcisph_setup");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		sim->particle_pres[i] = 0.0f;
+		sim->particle_paccel[2 * i + 0] = 0.0f;
+		sim->particle_paccel[2 * i + 1] = 0.0f;
+		float x, y;
+		__pcisph_predict(sim, i, &x, &y);
+		sim->particle_pred[2 * i + 0] = sim->particle_pbase[2 * i + 0] = x;
+		sim->particle_pred[2 * i + 1] = sim->particle_pbase[2 * i + 1] = y;
+	}
+}
+
+static void			__pcisph_delta_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pcisph_delta");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __pcisph_base_neighbors(sim, thread, i, &nbr_count);
+		sim->particle_delta[i] = fluid_pcisph_delta(&sim->pcisph, i, nbrs, nbr_count, sim->particle_pbase, &sim->kernels,
+				sim->dt);
+	}
+}
+
+static void			__pcisph_predict_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pcisph_predict");
+	fluid_sim* sim = ctx;
+	float displacement = 0.0f;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float x, y;
+		__pcisph_predict(sim, i, &x, &y);
+		float dx = x - sim->particle_pbase[2 * i + 0];
+		float dy = y - sim->particle_pbase[2 * i + 1];
+		displacement = fmaxf(displacement, dx * dx + dy * dy);
+		sim->particle_pred[2 * i + 0] = x;
+		sim->particle_pred[2 * i + 1] = y;
+	}
+	sim->scratch[thread].displacement = fmaxf(sim->scratch[thread].displacement, displacement);
+}
+
+//Only compression is corrected; a negative error at the free surface would pull particles together
+static void			__pcisph_density_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pcisph_density");
+	fluid_sim* sim = ctx;
+	float rest_density = sim->params.rest_density;
+	double error = 0.0;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __pcisph_neighbors(sim, thread, i, &nbr_count);
+		float dens = fluid_pcisph_density(&sim->pcisph, sim->simd, i, nbrs, nbr_count, sim->particle_pred, &sim->kernels);
+		float err = fmaxf(dens - rest_density, 0.0f);
+		sim->particle_dens[i] = dens;
+		sim->particle_pres[i] = fmaxf(sim->particle_pres[i] + sim->particle_delta[i] * (dens - rest_density), 0.0f);
+		error += err;
+	}
+	sim->scratch[thread].density_error += error;
+}
+
+static void			__pcisph_force_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pcisph_force");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __pcisph_base_neighbors(sim, thread, i, &nbr_count);
+		fluid_pcisph_accel(&sim->pcisph, i, nbrs, nbr_count, sim->particle_pbase, sim->particle_dens,
+				sim->particle_pres, &sim->kernels, &sim->particle_paccel[2 * i + 0], &sim->particle_paccel[2 * i + 1]);
+	}
+}
+
+//Runs after the other forces are in particle_accel. The pressure force keeps
+//the gradients of the base: taken at each new prediction they changed the
+//response delta was computed for, and close pairs in an overshooting
+//prediction pushed back hardest, so the error grew after a few iterations
+//instead of settling. Far from the base the linearization fails anyway, so
+//the iterations also stop once the error rises.
+//
+//The neighbors are checked once, on the base. A later prediction reads the
+//same lists while they still cover it; otherwise it queries the index within
+//h plus how far a prediction can be from the positions the index was built
+//on: the largest displacement from the base, and up to skin / 2 more while
+//the lists are held.
+static void			__pcisph_solve(fluid_sim* sim)
+{
+	SIMP_PROF_SCOPE("pcisph");
+	const fluid_sim_params* p = &sim->params;
+	uint32_t particle_count = sim->particle_count;
+	uint32_t threads = simp_pool_threads(sim->pool);
+	simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pcisph_setup_pass, sim);
+	__update_neighbors(sim);
+	sim->pcisph_reach = 0.0f;
+	simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pcisph_delta_pass, sim);
+
+	uint32_t iterations = 0u;
+	float error = 0.0f;
+	while(iterations < p->pressure_max_iterations)
+	{
+		for(uint32_t t = 0; t < threads; t++)
+			sim->scratch[t].density_error = 0.0;
+		if(iterations > 0u)
+		{
+			float displacement = 0.0f;
+			for(uint32_t t = 0; t < threads; t++)
+				sim->scratch[t].displacement = 0.0f;
+			simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pcisph_predict_pass, sim);
+			for(uint32_t t = 0; t < threads; t++)
+				displacement = fmaxf(displacement, sim->scratch[t].displacement);
+			if(sim->nlist && simp_nlist_valid(sim->nlist, sim->particle_pred, particle_count))
+				sim->pcisph_reach = 0.0f;
+			else
+				sim->pcisph_reach = p->h + sqrtf(displacement) + (sim->nlist ? 0.5f * p->skin : 0.0f);
+		}
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pcisph_density_pass, sim);
+		iterations++;
+		double sum = 0.0;
+		for(uint32_t t = 0; t < threads; t++)
+			sum += sim->scratch[t].density_error;
+		float previous = error;
+		error = particle_count ? (float)(sum / particle_count / p->rest_density) : 0.0f;
+		//Keeps the force of the previous prediction once the linearization stops holding
+		if(iterations > 1u && error > previous) { break; }
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pcisph_force_pass, sim);
+		if(iterations >= PCISPH_MIN_ITERATIONS && error <= p->pressure_tolerance) { break; }
+	}
+	sim->stats.pressure_iterations += iterations;
+	sim->stats.density_error = error;
+}
+
+//Position at the end of the step under the forces so far, kept inside the walls
+static void			__pcisph_predict(const fluid_sim* sim, uint32_t i, float* x, float* y)
+{
+	float dt = sim->dt;
+	float ax = sim->particle_accel[2 * i + 0] + sim->particle_paccel[2 * i + 0];
+	float ay = sim->particle_accel[2 * i + 1] + sim->particle_paccel[2 * i + 1] + sim->params.gravity;
+	*x = sim->particle_cpos[2 * i + 0] + (sim->particle_velo[2 * i + 0] + ax * dt) * dt;
+	*y = sim->particle_cpos[2 * i + 1] + (sim->particle_velo[2 * i + 1] + ay * dt) * dt;
+	__confine(sim, x, y);
+}
+
+//Neighbors of the current prediction, see __pcisph_solve
+static const uint32_t*	__pcisph_neighbors(fluid_sim* sim, uint32_t thread, uint32_t i, uint32_t* count)
+{
+	if(sim->pcisph_reach == 0.0f)
+		return __neighbors(sim, thread, i, count);
+	*count = __gather(sim, thread, sim->particle_pred[2 * i + 0], sim->particle_pred[2 * i + 1], sim->pcisph_reach);
+	return sim->scratch[thread].nbrs;
+}
+
+static const uint32_t*	__pcisph_base_neighbors(fluid_sim* sim, uint32_t thread, uint32_t i, uint32_t* count)
+{
+	if(sim->nlist)
+		return simp_nlist_get(sim->nlist, i, count);
+	*count = __gather(sim, thread, sim->particle_pbase[2 * i + 0], sim->particle_pbase[2 * i + 1], sim->params.h);
+	return sim->scratch[thread].nbrs;
+}
+
+//Gravity and the mouse give the velocity the constraints start from
+static void			__pbf_predict_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pbf_predict");
+	fluid_sim* sim = ctx;
+	const fluid_sim_params* p = &sim->params;
+	float dt = sim->dt;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float px = sim->particle_cpos[2 * i + 0];
+		float py = sim->particle_cpos[2 * i + 1];
+		float vx = sim->particle_velo[2 * i + 0];
+		float vy = sim->particle_velo[2 * i + 1] + p->gravity * dt;
+		__mouse_kick(sim, px, py, dt, &vx, &vy);
+		sim->particle_velo[2 * i + 0] = vx;
+		sim->particle_velo[2 * i + 1] = vy;
+		px += vx * dt;
+		py += vy * dt;
+		__confine(sim, &px, &py);
+		sim->particle_pred[2 * i + 0] = px;
+		sim->particle_pred[2 * i + 1] = py;
+	}
+}
+
+static void			__pbf_lambda_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pbf_lambda");
+	fluid_sim* sim = ctx;
+	const fluid_sim_params* p = &sim->params;
+	double error = 0.0;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __neighbors(sim, thread, i, &nbr_count);
+		sim->particle_lambda[i] = fluid_pbf_lambda(&sim->pcisph, sim->simd, i, nbrs, nbr_count, sim->particle_pred,
+				&sim->kernels, p->pbf_relaxation, &sim->particle_dens[i]);
+		error += fmaxf(sim->particle_dens[i] - p->rest_density, 0.0f);
+	}
+	sim->scratch[thread].density_error += error;
+}
+
+static void			__pbf_delta_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pbf_delta");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __neighbors(sim, thread, i, &nbr_count);
+		fluid_pbf_delta(&sim->pcisph, i, nbrs, nbr_count, sim->particle_pred, sim->particle_lambda, &sim->kernels,
+				&sim->particle_dpos[2 * i + 0], &sim->particle_dpos[2 * i + 1]);
+	}
+}
+
+//A separate pass keeps the iteration Jacobi: every correction sees the same positions
+static void			__pbf_apply_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pbf_apply");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float px = sim->particle_pred[2 * i + 0] + sim->particle_dpos[2 * i + 0];
+		float py = sim->particle_pred[2 * i + 1] + sim->particle_dpos[2 * i + 1];
+		__confine(sim, &px, &py);
+		sim->particle_pred[2 * i + 0] = px;
+		sim->particle_pred[2 * i + 1] = py;
+	}
+}
+
+//The velocity is whatever moved the particle to its projected position
+static void			__pbf_velocity_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pbf_velocity");
+	fluid_sim* sim = ctx;
+	float inv_dt = 1.0f / sim->dt;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float px = sim->particle_pred[2 * i + 0];
+		float py = sim->particle_pred[2 * i + 1];
+		float vx = (px - sim->particle_cpos[2 * i + 0]) * inv_dt;
+		float vy = (py - sim->particle_cpos[2 * i + 1]) * inv_dt;
+
+		sim->particle_ppos[2 * i + 0] = sim->particle_cpos[2 * i + 0];
+		sim->particle_ppos[2 * i + 1] = sim->particle_cpos[2 * i + 1];
+		sim->particle_cpos[2 * i + 0] = px;
+		sim->particle_cpos[2 * i + 1] = py;
+		//Clamp velocity to 0 if too small
+		sim->particle_velo[2 * i + 0] = (fabs(vx) > 1e-6) * vx;
+		sim->particle_velo[2 * i + 1] = (fabs(vy) > 1e-6) * vy;
+	}
+}
+
+static void			__pbf_xsph_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	SIMP_PROF_SCOPE("pbf_xsph");
+	fluid_sim* sim = ctx;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		uint32_t nbr_count;
+		const uint32_t* nbrs = __neighbors(sim, thread, i, &nbr_count);
+		fluid_pbf_xsph(i, nbrs, nbr_count, sim->particle_pred, sim->particle_velo, sim->particle_dens, &sim->kernels,
+				sim->params.xsph_viscosity, &sim->particle_dpos[2 * i + 0], &sim->particle_dpos[2 * i + 1]);
+	}
+}
+
+//Jacobi iterations over the predicted positions. The corrections move them,
+//so the neighbors are checked again after each one and rebuilt once they no
+//longer cover them.
+static void			__pbf_solve(fluid_sim* sim)
+{
+	SIMP_PROF_SCOPE("pbf");
+	const fluid_sim_params* p = &sim->params;
+	uint32_t particle_count = sim->particle_count;
+	uint32_t threads = simp_pool_threads(sim->pool);
+	double sum = 0.0;
+	for(uint32_t iteration = 0; iteration < p->pbf_iterations; iteration++)
+	{
+		for(uint32_t t = 0; t < threads; t++)
+			sim->scratch[t].density_error = 0.0;
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pbf_lambda_pass, sim);
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pbf_delta_pass, sim);
+		simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pbf_apply_pass, sim);
+		__update_neighbors(sim);
+	}
+	for(uint32_t t = 0; t < threads; t++)
+		sum += sim->scratch[t].density_error;
+	sim->stats.pressure_iterations += p->pbf_iterations;
+	sim->stats.density_error = particle_count ? (float)(sum / particle_count / p->rest_density) : 0.0f;
+}
+
+//XSPH reads the neighbors' new velocities, so it writes into the corrections
+//buffer, which then becomes the velocity array
+static void			__pbf_finish(fluid_sim* sim)
+{
+	uint32_t particle_count = sim->particle_count;
+	simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pbf_velocity_pass, sim);
+	if(sim->params.xsph_viscosity <= 0.0f) { return; }
+	simp_pool_for(sim->pool, particle_count, PASS_CHUNK, __pbf_xsph_pass, sim);
+	float* velo = sim->particle_velo;
+	sim->particle_velo = sim->particle_dpos;
+	sim->particle_dpos = velo;
+}
+
+//PBF and PCISPH step far enough that the index has to hold the predicted positions
+static void			__build_index(fluid_sim* sim)
+{
+	const float* pos = sim->params.pressure_solver == FLUID_PRESSURE_EOS ? sim->particle_cpos : sim->particle_pred;
+	if(sim->params.neighbor_backend == FLUID_NEIGHBOR_GRID)
+	{
+		simp_grid_build(sim->grid, pos, sim->particle_count);
+		return;
+	}
+	if(sim->params.neighbor_backend == FLUID_NEIGHBOR_LINEAR_QUADTREE)
+	{
+		simp_lqtree_build(sim->lqtree, pos, sim->particle_count, sim->pool);
+		return;
+	}
+	if(sim->params.neighbor_backend == FLUID_NEIGHBOR_HASH)
+	{
+		simp_hash_build(sim->hash, pos, sim->particle_count);
+		return;
+	}
+
+	//The tree persists across steps; only particles that left their node move
+	simp_quadtree_update(sim->qtree, pos, sim->particle_count);
+}
+
+//Rebuilds the Verlet lists only once some particle has moved more than skin / 2
+static void			__update_neighbors(fluid_sim* sim)
+{
+	if(!sim->nlist)
+	{
+		__build_index(sim);
+		return;
+	}
+
+	const float* pred = sim->particle_pred;
+	bool valid;
+	{
+		SIMP_PROF_SCOPE("nlist_valid");
+		if(pred)
+			valid = simp_nlist_valid(sim->nlist, pred, sim->particle_count);
+		else
+		{
+			valid = true;
+			for(uint32_t i = 0; valid && i < sim->particle_count; i++)
+			{
+				float x, y;
+				__pred(sim, i, &x, &y);
+				valid = simp_nlist_near(sim->nlist, i, x, y);
+			}
+		}
+	}
+	if(valid)
+	{
+		sim->stats.nlist_hits++;
+		return;
+	}
+
+	sim->stats.nlist_rebuilds++;
+	__build_index(sim);
+	bool ok = simp_nlist_begin(sim->nlist, pred, sim->particle_count);
+	for(uint32_t i = 0; ok && !pred && i < sim->particle_count; i++)
+	{
+		float x, y;
+		__pred(sim, i, &x, &y);
+		simp_nlist_place(sim->nlist, i, x, y);
+	}
+	if(ok)
+	{
+		simp_pool_for(sim->pool, sim->particle_count, PASS_CHUNK, __nlist_count_pass, sim);
+		ok = simp_nlist_commit(sim->nlist);
+	}
+	if(ok)
+		simp_pool_for(sim->pool, sim->particle_count, PASS_CHUNK, __nlist_fill_pass, sim);
+	else
+	{
+		//Out of memory: fall back to querying the index directly
+		simp_nlist_destroy(sim->nlist);
+		sim->nlist = NULL;
+	}
+}
+
+//Collects the neighbor candidates of the point (x, y) within r into the thread's scratch
+static uint32_t		__gather(fluid_sim* sim, uint32_t thread, float x, float y, float r)
+{
+	scratch* sc = &sim->scratch[thread];
+	uint32_t count;
+	if(sim->params.neighbor_backend == FLUID_NEIGHBOR_GRID)
+		count = simp_grid_query(sim->grid, x - r, y - r, x + r, y + r, &sc->nbrs, &sc->nbr_capacity);
+	else if(sim->params.neighbor_backend == FLUID_NEIGHBOR_LINEAR_QUADTREE)
+		count = simp_lqtree_query(sim->lqtree, x - r, y - r, x + r, y + r, &sc->nbrs, &sc->nbr_capacity);
+	else if(sim->params.neighbor_backend == FLUID_NEIGHBOR_HASH)
+		count = simp_hash_query(sim->hash, x - r, y - r, x + r, y + r, &sc->nbrs, &sc->nbr_capacity);
+	else
+		count = simp_quadtree_query_buffer(sim->qtree, x - r, y - r, x + r, y + r, &sc->nbrs, &sc->nbr_capacity);
+	SIMP_PROF_COUNT(SIMP_PROF_QUERIES, 1u);
+	SIMP_PROF_COUNT(SIMP_PROF_CANDIDATES, count);
+	return count;
+}
+
+static const uint32_t*	__neighbors(fluid_sim* sim, uint32_t thread, uint32_t i, uint32_t* count)
+{
+	if(sim->nlist)
+		return simp_nlist_get(sim->nlist, i, count);
+	float x, y;
+	__pred(sim, i, &x, &y);
+	*count = __gather(sim, thread, x, y, sim->params.h);
+	return sim->scratch[thread].nbrs;
+}
+
+//Candidates within h, only evaluated for the instrumentation counters
+static uint32_t		__in_radius(const fluid_sim* sim, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count)
+{
+	float hh = sim->params.h * sim->params.h;
+	float x, y;
+	__pred(sim, i, &x, &y);
+	uint32_t count = 0u;
+	for(uint32_t k = 0; k < nbr_count; k++)
+	{
+		float other_x, other_y;
+		__pred(sim, nbrs[k], &other_x, &other_y);
+		float dx = other_x - x;
+		float dy = other_y - y;
+		count += dx * dx + dy * dy <= hh;
+	}
+	return count;
+}
+
+//Predicted position of particle i, decoded in compact storage
+static void			__pred(const fluid_sim* sim, uint32_t i, float* x, float* y)
+{
+	if(sim->compact_pred)
+	{
+		fluid_compact_position(i, sim->compact_pred, x, y);
+		return;
+	}
+	*x = sim->particle_pred[2 * i + 0];
+	*y = sim->particle_pred[2 * i + 1];
+}
+
+//Sorts all particle arrays by the Morton code of the particle's cell
+static void			__reorder(fluid_sim* sim)
+{
+	SIMP_PROF_SCOPE("reorder");
+	uint32_t count = sim->particle_count;
+	float inv_h = 1.0f / sim->params.h;
+	uint32_t cells = (uint32_t)inv_h + 1u;
+	uint32_t bits = 0u;
+	while((1u << bits) < cells)
+		bits++;
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		uint32_t cx = (uint32_t)fclamp(sim->particle_cpos[2 * i + 0] * inv_h, 0.0f, (float)(cells - 1u));
+		uint32_t cy = (uint32_t)fclamp(sim->particle_cpos[2 * i + 1] * inv_h, 0.0f, (float)(cells - 1u));
+		sim->sort_keys[i] = simp_morton_encode(cx, cy);
+		sim->sort_perm[i] = i;
+	}
+	simp_radix_sort_pool(sim->sort_keys, sim->sort_perm, sim->sort_tmp_keys, sim->sort_tmp_perm, count, 2u * bits, sim->pool);
+
+	__permute(sim->particle_cpos, sim->sort_perm, count, 2u, sim->sort_scratch);
+	__permute(sim->particle_ppos, sim->sort_perm, count, 2u, sim->sort_scratch);
+	__permute(sim->particle_velo, sim->sort_perm, count, 2u, sim->sort_scratch);
+	if(sim->compact_pred)
+	{
+		__permute_compact(sim->compact_dens, sim->sort_perm, count, 1u, sim->sort_tmp_keys);
+		__permute_compact(sim->compact_pred, sim->sort_perm, count, 2u, sim->sort_tmp_keys);
+		__permute_flags(sim->particle_surface, sim->sort_perm, count, sim->sort_tmp_keys);
+	}
+	else
+	{
+		__permute(sim->particle_dens, sim->sort_perm, count, 1u, sim->sort_scratch);
+		__permute(sim->particle_pred, sim->sort_perm, count, 2u, sim->sort_scratch);
+		__permute(sim->particle_colo, sim->sort_perm, count, 3u, sim->sort_scratch);
+	}
+	__permute(sim->particle_accel, sim->sort_perm, count, 2u, sim->sort_scratch);
+	__permute_index(sim->particle_id, sim->sort_perm, count, sim->sort_tmp_keys);
+	if(sim->particle_level)
+		__permute_index(sim->particle_level, sim->sort_perm, count, sim->sort_tmp_keys);
+	if(sim->particle_calm)
+	{
+		__permute_index(sim->particle_calm, sim->sort_perm, count, sim->sort_tmp_keys);
+		__permute(sim->particle_pdens, sim->sort_perm, count, 1u, sim->sort_scratch);
+	}
+
+	//Slot indices changed, so any cached neighbor list is stale
+	if(sim->nlist)
+		simp_nlist_invalidate(sim->nlist);
+	sim->stats.reorders++;
+}
+
+static void			__permute(float* data, const uint32_t* perm, uint32_t count, uint32_t stride, float* scratch)
+{
+	for(uint32_t i = 0; i < count; i++)
+		for(uint32_t c = 0; c < stride; c++)
+			scratch[stride * i + c] = data[stride * perm[i] + c];
+	memcpy(data, scratch, count * stride * sizeof *data);
+}
+
+static void			__permute_index(uint32_t* data, const uint32_t* perm, uint32_t count, uint32_t* scratch)
+{
+	for(uint32_t i = 0; i < count; i++)
+		scratch[i] = data[perm[i]];
+	memcpy(data, scratch, count * sizeof *data);
+}
+
+static void			__permute_flags(uint8_t* data, const uint32_t* perm, uint32_t count, uint32_t* scratch)
+{
+	for(uint32_t i = 0; i < count; i++)
+		scratch[i] = data[perm[i]];
+	for(uint32_t i = 0; i < count; i++)
+		data[i] = (uint8_t)scratch[i];
+}
+
+//Up to two 16-bit values per particle, which fit the 32-bit scratch
+static void			__permute_compact(uint16_t* data, const uint32_t* perm, uint32_t count, uint32_t stride,
+									  uint32_t* scratch)
+{
+	uint16_t* tmp = (uint16_t*)scratch;
+	for(uint32_t i = 0; i < count; i++)
+		for(uint32_t c = 0; c < stride; c++)
+			tmp[stride * i + c] = data[stride * perm[i] + c];
+	memcpy(data, tmp, count * stride * sizeof *data);
+}
+
+//Colors of the surface flags, the ones fluid_accel writes
+static bool			__expand_colors(fluid_sim* sim)
+{
+	if(!sim->particle_colo)
+		sim->particle_colo = malloc(sim->particle_count * 3u * sizeof *sim->particle_colo);
+	if(!sim->particle_colo) { return false; }
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+	{
+		float other = sim->particle_surface[i] ? 0.0f : 1.0f;
+		sim->particle_colo[3 * i + 0] = 1.0f;
+		sim->particle_colo[3 * i + 1] = other;
+		sim->particle_colo[3 * i + 2] = other;
+	}
+	return true;
+}
+
+static bool			__expand_densities(fluid_sim* sim)
+{
+	if(!sim->particle_dens)
+		sim->particle_dens = malloc(sim->particle_count * sizeof *sim->particle_dens);
+	if(!sim->particle_dens) { return false; }
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+		sim->particle_dens[i] = fluid_compact_density_unpack(sim->compact_dens[i], sim->params.rest_density);
+	return true;
+}
+
+//Without block time steps, or while the mouse interacts, every particle is active
+static bool			__active(const fluid_sim* sim, uint32_t i)
+{
+	if(!sim->particle_level || sim->mouse_buttons) { return true; }
+	return (sim->substep & ((1u << sim->particle_level[i]) - 1u)) == 0u;
+}
+
+//Largest stable step for one particle from the CFL and force conditions. The
+//stiffness is low enough that pressure waves are limited through the force
+//condition on the pressure acceleration rather than a sound speed term.
+static float		__dt_limit(const fluid_sim* sim, float vx, float vy, float ax, float ay)
+{
+	const fluid_sim_params* p = &sim->params;
+	float speed = sqrtf(vx * vx + vy * vy);
+	float accel = sqrtf(ax * ax + ay * ay);
+	float dt = INFINITY;
+	if(speed > 0.0f)
+		dt = p->cfl_factor * p->h / speed;
+	if(accel > 0.0f)
+		dt = fminf(dt, 0.25f * sqrtf(p->h / accel));
+	return dt;
+}
+
+//Level of the block starting now: the largest power of two steps within the
+//particle's limit, at most one level above the last block, and aligned so the
+//block ends on a multiple of its own length
+static uint32_t		__block_level(const fluid_sim* sim, uint32_t i, float limit)
+{
+	if(sim->mouse_buttons) { return 0u; }
+	uint32_t max_level = sim->params.block_levels - 1u;
+	uint32_t level = 0u;
+	while(level < max_level && sim->dt * (float)(2u << level) <= limit)
+		level++;
+	if(level > sim->particle_level[i] + 1u)
+		level = sim->particle_level[i] + 1u;
+	while(sim->substep & ((1u << level) - 1u))
+		level--;
+	return level;
+}
+
+//Picks the next step from the per-thread limits; with block time steps the
+//base step only changes at the end of a cycle, when every block has ended
+static void			__advance_time(fluid_sim* sim)
+{
+	const fluid_sim_params* p = &sim->params;
+	uint32_t threads = simp_pool_threads(sim->pool);
+	for(uint32_t t = 0; t < threads; t++)
+	{
+		sim->stats.force_evaluations += sim->scratch[t].force_evaluations;
+		sim->scratch[t].force_evaluations = 0u;
+	}
+	sim->time += sim->dt;
+	if(!p->adaptive_dt) { return; }
+
+	float limit = sim->dt_viscosity;
+	for(uint32_t t = 0; t < threads; t++)
+	{
+		limit = fminf(limit, sim->scratch[t].dt_limit);
+		sim->scratch[t].dt_limit = INFINITY;
+	}
+	if(sim->particle_level)
+	{
+		sim->substep = (sim->substep + 1u) & ((1u << (p->block_levels - 1u)) - 1u);
+		if(sim->substep != 0u) { return; }
+	}
+	sim->dt = fclamp(fminf(limit, 1.25f * sim->dt), p->dt_min, p->dt_max);
+}
+
+//Marks the cells of the awake particles moving faster than twice the sleep
+//velocity, then wakes the sleepers in or next to a marked cell, which covers
+//everything within h, and those the mouse reaches. The gap between the two
+//speeds keeps the jitter of a settled pool from waking it. Serial: it only
+//reads positions and velocities.
+static void			__wake(fluid_sim* sim)
+{
+	SIMP_PROF_SCOPE("wake");
+	const fluid_sim_params* p = &sim->params;
+	uint32_t side = sim->fast_side;
+	float inv_h = 1.0f / p->h;
+	memset(sim->fast_cells, 0, side * side * sizeof *sim->fast_cells);
+	const float* velo = sim->particle_velo;
+	float wake_speed = 2.0f * p->sleep_velocity;
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+	{
+		float vx = velo[2 * i + 0], vy = velo[2 * i + 1];
+		if(__asleep(sim, i) || dot(vx, vy, vx, vy) < wake_speed * wake_speed) { continue; }
+		float x, y;
+		__pred(sim, i, &x, &y);
+		uint32_t cx = (uint32_t)fclamp(x * inv_h, 0.0f, (float)(side - 1u));
+		uint32_t cy = (uint32_t)fclamp(y * inv_h, 0.0f, (float)(side - 1u));
+		sim->fast_cells[cy * side + cx] = 1u;
+	}
+
+	uint32_t active = 0u;
+	for(uint32_t i = 0; i < sim->particle_count; i++)
+	{
+		if(!__asleep(sim, i))
+		{
+			active++;
+			continue;
+		}
+		float x, y;
+		__pred(sim, i, &x, &y);
+		bool wake = false;
+		if(sim->mouse_buttons)
+		{
+			float dx = sim->mouse_x - x, dy = sim->mouse_y - y;
+			wake = dot(dx, dy, dx, dy) < 4e-2;
+		}
+		int cx = iclamp((int)(x * inv_h), 0, (int)side - 1);
+		int cy = iclamp((int)(y * inv_h), 0, (int)side - 1);
+		for(int ny = iclamp(cy - 1, 0, (int)side - 1); !wake && ny <= iclamp(cy + 1, 0, (int)side - 1); ny++)
+			for(int nx = iclamp(cx - 1, 0, (int)side - 1); !wake && nx <= iclamp(cx + 1, 0, (int)side - 1); nx++)
+				wake = sim->fast_cells[ny * side + nx] != 0u;
+		if(!wake) { continue; }
+		sim->particle_calm[i] = 0u;
+		sim->stats.wakeups++;
+		active++;
+	}
+	sim->stats.active_particles = active;
+	sim->stats.active_particle_steps += active;
+}
+
+static bool			__asleep(const fluid_sim* sim, uint32_t i)
+{
+	return sim->particle_calm && sim->particle_calm[i] >= sim->params.sleep_steps;
+}
+
+//Counts the consecutive calm steps of particle i after its integration and
+//returns whether it falls asleep
+static bool			__calm_step(fluid_sim* sim, uint32_t i, float vx, float vy)
+{
+	const fluid_sim_params* p = &sim->params;
+	float dens = sim->compact_dens ? fluid_compact_density_unpack(sim->compact_dens[i], p->rest_density) :
+		sim->particle_dens[i];
+	bool calm = dot(vx, vy, vx, vy) < p->sleep_velocity * p->sleep_velocity &&
+		fabsf(dens - sim->particle_pdens[i]) < p->sleep_density * p->rest_density;
+	sim->particle_pdens[i] = dens;
+	sim->particle_calm[i] = calm ? sim->particle_calm[i] + 1u : 0u;
+	return sim->particle_calm[i] >= p->sleep_steps;
+}
+
+//Left button pulls particles within 0.2 towards the cursor, right button pushes them away
+static void			__mouse_kick(const fluid_sim* sim, float px, float py, float kick, float* vx, float* vy)
+{
+	if(sim->mouse_buttons & FLUID_MOUSE_LEFT)
+	{
+		float dx = sim->mouse_x - px;
+		float dy = sim->mouse_y - py;
+		float dd = dot(dx, dy, dx, dy);
+		if(dd < 4e-2)
+		{
+			*vx += (dx * 5e2 - 1e1 * *vx)* kick;
+			*vy += (dy * 5e2 - 1e1 * *vy)* kick;
+		}
+	}
+
+	if(sim->mouse_buttons & FLUID_MOUSE_RIGHT)
+	{
+		float dx = sim->mouse_x - px;
+		float dy = sim->mouse_y - py;
+		float dd = dot(dx, dy, dx, dy);
+		if(dd < 4e-2)
+		{
+			*vx -= dx * 5e2 * kick;
+			*vy -= dy * 5e2 * kick;
+		}
+	}
+}
+
+//Moves a position closer than radius to the boundary sdf back to radius along
+//its normal; true with the normal when it did
+static bool			__push_out(const fluid_sim* sim, float* x, float* y, float* nx, float* ny)
+{
+	float radius = sim->params.radius;
+	float d = fluid_sdf_distance(sim->pcisph.sdf, *x, *y, nx, ny);
+	if(d >= radius) { return false; }
+	*x += (radius - d) * *nx;
+	*y += (radius - d) * *ny;
+	return true;
+}
+
+//Keeps a predicted position inside the walls
+static void			__confine(const fluid_sim* sim, float* x, float* y)
+{
+	float radius = sim->params.radius;
+	float nx, ny;
+	if(sim->pcisph.sdf)
+		__push_out(sim, x, y, &nx, &ny);
+	else
+	{
+		*x = fclamp(*x, radius, 1.0f - radius);
+		*y = fclamp(*y, radius, 1.0f - radius);
+	}
+}
+
+//Pressure force of the boundary sdf on the equation of state solver, as in
+//fluid_accel for wall fluid with the particle's own pressure and density:
+//sum_wall grad W = -grad rho_wall
+static void			__wall_accel(const fluid_sim* sim, uint32_t i, float* ax, float* ay)
+{
+	const fluid_sim_params* p = &sim->params;
+	float gx, gy;
+	fluid_pcisph_wall(&sim->pcisph, sim->particle_pred[2 * i + 0], sim->particle_pred[2 * i + 1], &gx, &gy);
+	float dens = sim->particle_dens[i];
+	float pres = (dens - p->rest_density) * p->stiffness_constant;
+	float c = pres * (1.0f / (dens * dens) + 1.0f / dens) / dens;
+	*ax -= c * gx;
+	*ay -= c * gy;
+}
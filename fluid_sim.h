@@ -0,0 +1,176 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "fluid_simd.h"
+#include "fluid_sdf.h"
+
+#define FLUID_MOUSE_LEFT	0x1
+#define FLUID_MOUSE_RIGHT	0x2
+
+typedef struct fluid_sim fluid_sim;
+
+typedef enum fluid_neighbor_backend
+{
+	FLUID_NEIGHBOR_QUADTREE,
+	FLUID_NEIGHBOR_GRID,
+	FLUID_NEIGHBOR_LINEAR_QUADTREE,
+	//Spatial hash of grid cells; unlike the others it is not bounded to the unit square
+	FLUID_NEIGHBOR_HASH
+}fluid_neighbor_backend;
+
+//Pressure from the equation of state p = (rho - rho0) * stiffness, or
+//PCISPH iterations that correct the predicted density error until it is
+//within a tolerance or the iteration limit is reached. PBF projects the predicted positions onto the density
+//constraint instead of integrating a pressure force and stays stable at
+//frame-sized steps.
+typedef enum fluid_pressure_solver
+{
+	FLUID_PRESSURE_EOS,
+	FLUID_PRESSURE_PCISPH,
+	FLUID_PRESSURE_PBF
+}fluid_pressure_solver;
+
+//Initial layout of the grid_size * grid_size particles
+typedef enum fluid_scene
+{
+	FLUID_SCENE_BLOCK,
+	FLUID_SCENE_DAM_BREAK,
+	FLUID_SCENE_DROPLETS
+}fluid_scene;
+
+typedef struct fluid_sim_params
+{
+	uint32_t grid_size;
+	fluid_scene scene;
+	//Nonzero seeds displace every particle by radius / 10 in a hashed direction
+	uint32_t seed;
+	float radius;
+	float h;
+	float dt;
+	float gravity;
+	float damp_factor;
+	float rest_density;
+	float stiffness_constant;
+	float surface_coefficient;
+	float viscosity_coefficient;
+	fluid_neighbor_backend neighbor_backend;
+	bool neighbor_lists;
+	float skin;
+	uint32_t reorder_interval;
+	uint32_t threads;
+	fluid_simd simd;
+	fluid_kernel_type kernel;
+	uint32_t kernel_table_size;
+	//Visit each neighbor pair once and scatter to both particles
+	bool pair_forces;
+	//Adaptive time step from CFL, force and viscosity limits, within [dt_min, dt_max]
+	bool adaptive_dt;
+	float cfl_factor;
+	float dt_min, dt_max;
+	//Block time steps: with block_levels > 1 particles advance with dt * 2^level,
+	//level < block_levels, and only get forces on the steps that start their block
+	uint32_t block_levels;
+	//PCISPH iterates until the mean density error is below pressure_tolerance
+	//of the rest density, between 3 and pressure_max_iterations times, and
+	//stops early once an iteration raises the error; it replaces
+	//stiffness_constant and does not combine with pair_forces or block time
+	//steps
+	fluid_pressure_solver pressure_solver;
+	float pressure_tolerance;
+	uint32_t pressure_max_iterations;
+	//PBF runs pbf_iterations Jacobi iterations per step. pbf_relaxation
+	//softens the constraint relative to a particle at rest density, which
+	//also damps the Jacobi overshoot; xsph_viscosity replaces
+	//viscosity_coefficient and there is no explicit surface tension. It has
+	//the same restrictions as PCISPH and a fixed dt.
+	uint32_t pbf_iterations;
+	float pbf_relaxation;
+	float xsph_viscosity;
+	//Sleeping: a particle whose speed stays below sleep_velocity and whose
+	//density changes by less than sleep_density of the rest density per step
+	//for sleep_steps steps stops and skips its density and force work. It
+	//wakes when a particle faster than twice sleep_velocity comes within h
+	//or the mouse reaches it.
+	//Equation of state solver only, without pair_forces.
+	bool sleeping;
+	float sleep_velocity;
+	float sleep_density;
+	uint32_t sleep_steps;
+	//Compact storage: predicted positions and densities are kept in 16 bits
+	//(fluid_compact.h) instead of float, and colors as one surface flag per
+	//particle; densities and colors are expanded on request. The integration
+	//state stays in float and the force loop reads half float copies of the
+	//velocities. Equation of state solver only, without pair_forces.
+	bool compact_storage;
+}fluid_sim_params;
+
+typedef struct fluid_sim_stats
+{
+	uint64_t nlist_hits;
+	uint64_t nlist_rebuilds;
+	uint64_t reorders;
+	uint64_t force_evaluations;
+	uint64_t snapshots;
+	uint64_t snapshot_failures;
+	//PCISPH or PBF iterations over all steps and the mean relative density error left by the last solve
+	uint64_t pressure_iterations;
+	float density_error;
+	//Wall time per phase in seconds; index covers reordering, prediction and neighbor search
+	double index_time;
+	double density_time;
+	double force_time;
+	double integrate_time;
+	//Particles awake in the last step, the same summed over steps, and sleeping particles woken
+	uint32_t active_particles;
+	uint64_t active_particle_steps;
+	uint64_t wakeups;
+}fluid_sim_stats;
+
+//Interleaved render vertex: position, velocity as half floats and color as
+//normalized bytes, 16 bytes against 28 for the separate float arrays
+typedef struct fluid_vertex
+{
+	float x, y;
+	uint16_t vx, vy;
+	uint8_t r, g, b, a;
+}fluid_vertex;
+
+//Integration state of one particle, the unit of fluid_sim_export and fluid_sim_import
+typedef struct fluid_particle
+{
+	uint32_t id;
+	float x, y;
+	float px, py;
+	float vx, vy;
+	float ax, ay;
+	float dens;
+	float r, g, b;
+}fluid_particle;
+
+void				fluid_sim_default_params(fluid_sim_params* params);
+fluid_sim*			fluid_sim_create(const fluid_sim_params* params);
+fluid_sim*			fluid_sim_load(const char* path, const fluid_sim_params* params);
+bool				fluid_sim_save(fluid_sim* sim, const char* path);
+void				fluid_sim_destroy(fluid_sim* sim);
+void				fluid_sim_step(fluid_sim* sim);
+void				fluid_sim_set_mouse(fluid_sim* sim, float x, float y, int buttons);
+void				fluid_sim_set_snapshot(fluid_sim* sim, const char* path, uint32_t interval);
+bool				fluid_sim_set_boundary(fluid_sim* sim, const fluid_sdf* sdf);
+const fluid_sdf*	fluid_sim_get_boundary(fluid_sim* sim);
+const fluid_sim_params*	fluid_sim_get_params(fluid_sim* sim);
+uint32_t			fluid_sim_count(fluid_sim* sim);
+uint64_t			fluid_sim_steps(fluid_sim* sim);
+double				fluid_sim_time(fluid_sim* sim);
+float				fluid_sim_dt(fluid_sim* sim);
+void				fluid_sim_get_stats(fluid_sim* sim, fluid_sim_stats* stats);
+fluid_simd			fluid_sim_simd(fluid_sim* sim);
+double				fluid_sim_simd_error(fluid_sim* sim);
+double				fluid_sim_compact_error(fluid_sim* sim, uint32_t* surface_flips);
+const float*		fluid_sim_positions(fluid_sim* sim);
+const float*		fluid_sim_velocities(fluid_sim* sim);
+const float*		fluid_sim_densities(fluid_sim* sim);
+const float*		fluid_sim_colors(fluid_sim* sim);
+const uint32_t*		fluid_sim_ids(fluid_sim* sim);
+void				fluid_sim_pack_vertices(fluid_sim* sim, fluid_vertex* out);
+void				fluid_sim_export(fluid_sim* sim, fluid_particle* out);
+void				fluid_sim_import(fluid_sim* sim, const fluid_particle* particles, uint64_t steps);
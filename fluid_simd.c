@@ -0,0 +1,578 @@
+#include "fluid_simd.h"
+#include "fluid.h"
+#include "fluid_compact.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FLUID_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define LANES 8u
+
+typedef struct lanes lanes;
+typedef struct accel_sums accel_sums;
+typedef struct source source;
+
+//One batch of neighbor candidates in SoA form; skip is all ones for lanes
+//that hold padding or the particle itself
+struct lanes
+{
+	_Alignas(32) float x[LANES];
+	_Alignas(32) float y[LANES];
+	_Alignas(32) float vx[LANES];
+	_Alignas(32) float vy[LANES];
+	_Alignas(32) float dens[LANES];
+	_Alignas(32) uint32_t skip[LANES];
+	uint32_t j[LANES];
+	//Half float velocities as gathered from compact storage
+	_Alignas(16) uint16_t hvx[LANES];
+	_Alignas(16) uint16_t hvy[LANES];
+};
+
+//Where the lane loops read particles from: the float arrays, or the compact
+//positions, half float velocities and densities (cpos set)
+struct source
+{
+	const float* pos;
+	const float* vel;
+	const float* dens;
+	const uint16_t* cpos;
+	const uint16_t* cvel;
+	const uint16_t* cdens;
+	float dens_scale;
+};
+
+struct accel_sums
+{
+	float ax, ay;
+	float normal_x, normal_y;
+	float curvature;
+};
+
+//Constants of the spiky / viscosity / poly6 kernels in the form the lane loops use
+typedef struct kernel_consts
+{
+	float h, hh;
+	float density_scale;		//spiky: 10 / (pi h^5)
+	float gradient_scale;		//spiky: -30 / (pi h^5)
+	float viscosity_scale;		//40 / (pi h^5) * viscosity coefficient
+	float surface_scale;		//poly6: -24 / (pi h^8)
+}kernel_consts;
+
+static void			__consts(kernel_consts* kc, const fluid_kernels* kernels, float viscosity_coefficient);
+static inline void	__position(const source* src, uint32_t j, float* x, float* y) __attribute__((always_inline));
+static inline void	__velocity(const source* src, uint32_t j, float* vx, float* vy) __attribute__((always_inline));
+static inline float	__density(const source* src, uint32_t j) __attribute__((always_inline));
+static inline void	__gather(lanes* l, uint32_t i, const uint32_t* nbrs, uint32_t k, uint32_t nbr_count,
+							 const source* src, bool accel) __attribute__((always_inline));
+static float		__density_sum(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+								  const source* src, const kernel_consts* kc);
+static bool			__accel_sum(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+								const source* src, const kernel_consts* kc, float rest_density,
+								float stiffness_constant, accel_sums* sums);
+static void			__near_pair(uint32_t i, uint32_t j, const kernel_consts* kc, float p_term, float rest_density,
+								float stiffness_constant, const source* src, accel_sums* sums);
+static bool			__finish_accel(const accel_sums* sums, float dens, float surface_coefficient, float* ax, float* ay);
+#ifdef FLUID_SIMD_X86
+static float		__density_sse(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								  const kernel_consts* kc);
+static void			__accel_sse(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								const kernel_consts* kc, float rest_density, float stiffness_constant,
+								accel_sums* sums);
+static float		__density_avx2(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								   const kernel_consts* kc);
+static void			__accel_avx2(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								 const kernel_consts* kc, float rest_density, float stiffness_constant,
+								 accel_sums* sums);
+#endif
+
+fluid_simd			fluid_simd_resolve(fluid_simd requested)
+{
+#ifdef FLUID_SIMD_X86
+	__builtin_cpu_init();
+	bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	bool has_sse = __builtin_cpu_supports("sse2");
+	if(requested == FLUID_SIMD_AUTO)
+		return has_avx2 ? FLUID_SIMD_AVX2 : has_sse ? FLUID_SIMD_SSE : FLUID_SIMD_SCALAR;
+	if(requested == FLUID_SIMD_AVX2 && !has_avx2)
+		requested = FLUID_SIMD_SSE;
+	if(requested == FLUID_SIMD_SSE && !has_sse)
+		requested = FLUID_SIMD_SCALAR;
+	return requested;
+#else
+	return FLUID_SIMD_SCALAR;
+#endif
+}
+
+const char*			fluid_simd_name(fluid_simd simd)
+{
+	switch(simd)
+	{
+		case FLUID_SIMD_AUTO:	return "auto";
+		case FLUID_SIMD_SCALAR:	return "scalar";
+		case FLUID_SIMD_SSE:	return "sse";
+		case FLUID_SIMD_AVX2:	return "avx2";
+	}
+	return "unknown";
+}
+
+//The vector loops hard-code the spiky pressure kernel and evaluate the
+//analytic forms; other kernels and tabulated kernels use the scalar path
+bool				fluid_simd_supports(const fluid_kernels* kernels)
+{
+	return kernels->pressure.type == FLUID_KERNEL_SPIKY && kernels->pressure.table_size == 0u &&
+		   kernels->viscosity.table_size == 0u && kernels->surface.table_size == 0u;
+}
+
+float				fluid_simd_density(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									   const float* pos, const fluid_kernels* kernels)
+{
+	kernel_consts kc;
+	__consts(&kc, kernels, 0.0f);
+	if(simd != FLUID_SIMD_AVX2 && simd != FLUID_SIMD_SSE)
+		return sample_density(i, nbrs, nbr_count, (float*)pos, kernels);
+	source src = { pos, NULL, NULL, NULL, NULL, NULL, 0.0f };
+	float h = kc.h;
+	float sum = __density_sum(simd, i, nbrs, nbr_count, &src, &kc);
+	return (h * h * h * kc.density_scale + sum) * boundary_weight(pos[2 * i + 0], pos[2 * i + 1], h);
+}
+
+void				fluid_simd_accel(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									 const float* pos, const float* vel, const float* dens, float* col,
+									 const fluid_kernels* kernels, float rest_density, float stiffness_constant,
+									 float surface_coefficient, float viscosity_coefficient, float* ax, float* ay)
+{
+	kernel_consts kc;
+	__consts(&kc, kernels, viscosity_coefficient);
+	accel_sums sums = { 0 };
+	source src = { pos, vel, dens, NULL, NULL, NULL, 0.0f };
+	if(!__accel_sum(simd, i, nbrs, nbr_count, &src, &kc, rest_density, stiffness_constant, &sums))
+	{
+		fluid_accel(i, nbrs, nbr_count, (float*)pos, (float*)vel, (float*)dens, col, kernels, rest_density,
+				stiffness_constant, surface_coefficient, viscosity_coefficient, ax, ay);
+		return;
+	}
+	bool surface = __finish_accel(&sums, dens[i], surface_coefficient, ax, ay);
+	col[3 * i + 0] = 1.0f;
+	col[3 * i + 1] = surface ? 0.0f : 1.0f;
+	col[3 * i + 2] = surface ? 0.0f : 1.0f;
+}
+
+//The lane loops on compact storage decode into the same batches; the
+//scalar path is the fluid_compact kernel
+float				fluid_simd_compact_density(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+											   const uint16_t* pos, const fluid_kernels* kernels)
+{
+	kernel_consts kc;
+	__consts(&kc, kernels, 0.0f);
+	if(simd != FLUID_SIMD_AVX2 && simd != FLUID_SIMD_SSE)
+		return fluid_compact_density(i, nbrs, nbr_count, pos, kernels);
+	source src = { NULL, NULL, NULL, pos, NULL, NULL, 0.0f };
+	float h = kc.h;
+	float x, y;
+	__position(&src, i, &x, &y);
+	float sum = __density_sum(simd, i, nbrs, nbr_count, &src, &kc);
+	return (h * h * h * kc.density_scale + sum) * boundary_weight(x, y, h);
+}
+
+bool				fluid_simd_compact_accel(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+											 const uint16_t* pos, const uint16_t* vel, const uint16_t* dens,
+											 const fluid_kernels* kernels, float rest_density, float stiffness_constant,
+											 float surface_coefficient, float viscosity_coefficient, float* ax, float* ay)
+{
+	kernel_consts kc;
+	__consts(&kc, kernels, viscosity_coefficient);
+	accel_sums sums = { 0 };
+	source src = { NULL, NULL, NULL, pos, vel, dens, FLUID_COMPACT_DENSITY_SPAN / 65535.0f * rest_density };
+	if(!__accel_sum(simd, i, nbrs, nbr_count, &src, &kc, rest_density, stiffness_constant, &sums))
+		return fluid_compact_accel(i, nbrs, nbr_count, pos, vel, dens, kernels, rest_density, stiffness_constant,
+				surface_coefficient, viscosity_coefficient, ax, ay);
+	return __finish_accel(&sums, __density(&src, i), surface_coefficient, ax, ay);
+}
+
+
+
+static void			__consts(kernel_consts* kc, const fluid_kernels* kernels, float viscosity_coefficient)
+{
+	kc->h = kernels->pressure.h;
+	kc->hh = kernels->pressure.hh;
+	kc->density_scale = kernels->pressure.norm;
+	kc->gradient_scale = -3.0f * kc->density_scale;
+	kc->viscosity_scale = viscosity_coefficient * kernels->viscosity.norm;
+	kc->surface_scale = -6.0f * kernels->surface.norm;
+}
+
+static inline void	__position(const source* src, uint32_t j, float* x, float* y)
+{
+	if(src->cpos)
+	{
+		*x = FLUID_COMPACT_MIN + (float)src->cpos[2 * j + 0] * FLUID_COMPACT_STEP;
+		*y = FLUID_COMPACT_MIN + (float)src->cpos[2 * j + 1] * FLUID_COMPACT_STEP;
+		return;
+	}
+	*x = src->pos[2 * j + 0];
+	*y = src->pos[2 * j + 1];
+}
+
+static inline void	__velocity(const source* src, uint32_t j, float* vx, float* vy)
+{
+	if(src->cvel)
+	{
+		*vx = fluid_compact_half(src->cvel[2 * j + 0]);
+		*vy = fluid_compact_half(src->cvel[2 * j + 1]);
+		return;
+	}
+	*vx = src->vel[2 * j + 0];
+	*vy = src->vel[2 * j + 1];
+}
+
+static inline float	__density(const source* src, uint32_t j)
+{
+	return src->cdens ? (float)src->cdens[j] * src->dens_scale : src->dens[j];
+}
+
+//Inlined so the AVX2 loops do not call into SSE-encoded code
+static inline void	__gather(lanes* l, uint32_t i, const uint32_t* nbrs, uint32_t k, uint32_t nbr_count,
+							 const source* src, bool accel)
+{
+	for(uint32_t lane = 0; lane < LANES; lane++)
+	{
+		uint32_t j = k + lane < nbr_count ? nbrs[k + lane] : i;
+		l->j[lane] = j;
+		l->skip[lane] = j == i ? 0xFFFFFFFFu : 0u;
+		__position(src, j, &l->x[lane], &l->y[lane]);
+		if(accel && src->cvel)
+		{
+			l->hvx[lane] = src->cvel[2 * j + 0];
+			l->hvy[lane] = src->cvel[2 * j + 1];
+		}
+		else if(accel)
+		{
+			l->vx[lane] = src->vel[2 * j + 0];
+			l->vy[lane] = src->vel[2 * j + 1];
+		}
+		if(accel)
+			l->dens[lane] = __density(src, j);
+	}
+	//A loop of its own, so the half floats are decoded a whole batch at a time
+	if(accel && src->cvel)
+	{
+		for(uint32_t lane = 0; lane < LANES; lane++)
+		{
+			l->vx[lane] = fluid_compact_half(l->hvx[lane]);
+			l->vy[lane] = fluid_compact_half(l->hvy[lane]);
+		}
+	}
+}
+
+//Sum over the neighbors without the self term; 0 when simd has no lane loop
+static float		__density_sum(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+								  const source* src, const kernel_consts* kc)
+{
+	switch(simd)
+	{
+#ifdef FLUID_SIMD_X86
+		case FLUID_SIMD_AVX2:	return __density_avx2(i, nbrs, nbr_count, src, kc);
+		case FLUID_SIMD_SSE:	return __density_sse(i, nbrs, nbr_count, src, kc);
+#endif
+		default:				return 0.0f;
+	}
+}
+
+//False when simd has no lane loop and the scalar kernel has to run
+static bool			__accel_sum(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+								const source* src, const kernel_consts* kc, float rest_density,
+								float stiffness_constant, accel_sums* sums)
+{
+	switch(simd)
+	{
+#ifdef FLUID_SIMD_X86
+		case FLUID_SIMD_AVX2:
+			__accel_avx2(i, nbrs, nbr_count, src, kc, rest_density, stiffness_constant, sums);
+			return true;
+		case FLUID_SIMD_SSE:
+			__accel_sse(i, nbrs, nbr_count, src, kc, rest_density, stiffness_constant, sums);
+			return true;
+#endif
+		default:
+			return false;
+	}
+}
+
+//Coincident pair (d < 1e-5): same treatment as the scalar path in fluid_accel
+static void			__near_pair(uint32_t i, uint32_t j, const kernel_consts* kc, float p_term, float rest_density,
+								float stiffness_constant, const source* src, accel_sums* sums)
+{
+	float h = kc->h;
+	float dens_j = __density(src, j);
+	float j_dens_inv = 1.0f / dens_j;
+	float p_other = (dens_j - rest_density) * stiffness_constant;
+	float c = kc->gradient_scale * h * h * (p_term + p_other * j_dens_inv);
+	float dx, dy;
+	uint32_t lo = i < j ? i : j, hi = i < j ? j : i;
+	hrand2d(lo * 0x9E3779B1u ^ hi, &dx, &dy);
+	if(i > j)
+	{
+		dx = -dx;
+		dy = -dy;
+	}
+	sums->ax += c * dx;
+	sums->ay += c * dy;
+	c = kc->viscosity_scale * h * j_dens_inv;
+	float vxi, vyi, vxj, vyj;
+	__velocity(src, i, &vxi, &vyi);
+	__velocity(src, j, &vxj, &vyj);
+	sums->ax += c * (vxj - vxi);
+	sums->ay += c * (vyj - vyi);
+}
+
+//Adds surface tension and divides by the density; returns the surface flag
+static bool			__finish_accel(const accel_sums* sums, float dens, float surface_coefficient, float* ax, float* ay)
+{
+	float acc_x = sums->ax;
+	float acc_y = sums->ay;
+	float normal_x = sums->normal_x;
+	float normal_y = sums->normal_y;
+	float normal_d = sqrtf(normal_x * normal_x + normal_y * normal_y);
+	bool surface = normal_d > 2e-1;
+	if(surface)
+	{
+		normal_x /= normal_d;
+		normal_y /= normal_d;
+		float c = surface_coefficient * sums->curvature;
+		acc_x += c * normal_x;
+		acc_y += c * normal_y;
+	}
+	*ax = acc_x / dens;
+	*ay = acc_y / dens;
+	return surface;
+}
+
+#ifdef FLUID_SIMD_X86
+
+static float		__hsum_sse(__m128 v)
+{
+	__m128 t = _mm_add_ps(v, _mm_movehl_ps(v, v));
+	t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 0x55));
+	return _mm_cvtss_f32(t);
+}
+
+static float		__density_sse(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								  const kernel_consts* kc)
+{
+	lanes l;
+	float xi, yi;
+	__position(src, i, &xi, &yi);
+	__m128 x = _mm_set1_ps(xi);
+	__m128 y = _mm_set1_ps(yi);
+	__m128 h = _mm_set1_ps(kc->h);
+	__m128 hh = _mm_set1_ps(kc->hh);
+	__m128 acc = _mm_setzero_ps();
+	for(uint32_t k = 0; k < nbr_count; k += LANES)
+	{
+		__gather(&l, i, nbrs, k, nbr_count, src, false);
+		for(uint32_t half = 0; half < LANES; half += 4u)
+		{
+			__m128 dx = _mm_sub_ps(_mm_load_ps(l.x + half), x);
+			__m128 dy = _mm_sub_ps(_mm_load_ps(l.y + half), y);
+			__m128 dd = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			__m128 in = _mm_andnot_ps(_mm_castsi128_ps(_mm_load_si128((const __m128i*)(l.skip + half))),
+									  _mm_cmple_ps(dd, hh));
+			__m128 t = _mm_sub_ps(h, _mm_sqrt_ps(dd));
+			acc = _mm_add_ps(acc, _mm_and_ps(in, _mm_mul_ps(_mm_mul_ps(t, t), t)));
+		}
+	}
+	return __hsum_sse(acc) * kc->density_scale;
+}
+
+static void			__accel_sse(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								const kernel_consts* kc, float rest_density, float stiffness_constant,
+								accel_sums* sums)
+{
+	lanes l;
+	float dens_i = __density(src, i);
+	float dens_inv = 1.0f / dens_i;
+	float p_term = (dens_i - rest_density) * stiffness_constant * dens_inv * dens_inv;
+	float xi, yi;
+	__position(src, i, &xi, &yi);
+	__m128 x = _mm_set1_ps(xi);
+	__m128 y = _mm_set1_ps(yi);
+	float vxi, vyi;
+	__velocity(src, i, &vxi, &vyi);
+	__m128 vx = _mm_set1_ps(vxi);
+	__m128 vy = _mm_set1_ps(vyi);
+	__m128 h = _mm_set1_ps(kc->h);
+	__m128 hh = _mm_set1_ps(kc->hh);
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 near_limit = _mm_set1_ps(1e-5f);
+	__m128 pv = _mm_set1_ps(p_term);
+	__m128 rest = _mm_set1_ps(rest_density);
+	__m128 stiff = _mm_set1_ps(stiffness_constant);
+	__m128 grad_s = _mm_set1_ps(kc->gradient_scale);
+	__m128 visc_s = _mm_set1_ps(kc->viscosity_scale);
+	__m128 surf_s = _mm_set1_ps(kc->surface_scale);
+	__m128 three = _mm_set1_ps(3.0f), ten = _mm_set1_ps(10.0f), seven = _mm_set1_ps(7.0f);
+	__m128 h4 = _mm_mul_ps(hh, hh);
+	__m128 ax = _mm_setzero_ps(), ay = _mm_setzero_ps();
+	__m128 nx = _mm_setzero_ps(), ny = _mm_setzero_ps(), curv = _mm_setzero_ps();
+	for(uint32_t k = 0; k < nbr_count; k += LANES)
+	{
+		__gather(&l, i, nbrs, k, nbr_count, src, true);
+		for(uint32_t half = 0; half < LANES; half += 4u)
+		{
+			__m128 dx = _mm_sub_ps(_mm_load_ps(l.x + half), x);
+			__m128 dy = _mm_sub_ps(_mm_load_ps(l.y + half), y);
+			__m128 dd = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			__m128 in = _mm_andnot_ps(_mm_castsi128_ps(_mm_load_si128((const __m128i*)(l.skip + half))),
+									  _mm_cmple_ps(dd, hh));
+			__m128 d = _mm_sqrt_ps(dd);
+			__m128 far = _mm_and_ps(in, _mm_cmpge_ps(d, near_limit));
+			int near = _mm_movemask_ps(_mm_andnot_ps(far, in));
+			for(uint32_t lane = 0; near; lane++, near >>= 1)
+				if(near & 1)
+					__near_pair(i, l.j[half + lane], kc, p_term, rest_density, stiffness_constant, src, sums);
+
+			__m128 dj = _mm_load_ps(l.dens + half);
+			__m128 j_inv = _mm_div_ps(one, dj);
+			__m128 d_inv = _mm_div_ps(one, d);
+			__m128 t = _mm_sub_ps(h, d);
+			//Pressure
+			__m128 p_other = _mm_mul_ps(_mm_sub_ps(dj, rest), stiff);
+			__m128 c = _mm_mul_ps(_mm_mul_ps(grad_s, _mm_mul_ps(t, t)),
+								  _mm_add_ps(pv, _mm_mul_ps(p_other, j_inv)));
+			c = _mm_and_ps(far, _mm_mul_ps(c, d_inv));
+			ax = _mm_add_ps(ax, _mm_mul_ps(c, dx));
+			ay = _mm_add_ps(ay, _mm_mul_ps(c, dy));
+			//Surface normal and curvature
+			__m128 q = _mm_sub_ps(hh, dd);
+			__m128 ws = _mm_and_ps(far, _mm_mul_ps(_mm_mul_ps(surf_s, d), _mm_mul_ps(_mm_mul_ps(q, q), j_inv)));
+			nx = _mm_add_ps(nx, _mm_mul_ps(ws, dx));
+			ny = _mm_add_ps(ny, _mm_mul_ps(ws, dy));
+			__m128 lap = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(three, h4), _mm_mul_ps(_mm_mul_ps(ten, hh), dd)),
+									_mm_mul_ps(_mm_mul_ps(seven, dd), dd));
+			curv = _mm_add_ps(curv, _mm_and_ps(far, _mm_mul_ps(_mm_mul_ps(surf_s, lap), j_inv)));
+			//Viscosity
+			__m128 cv = _mm_and_ps(far, _mm_mul_ps(_mm_mul_ps(visc_s, t), j_inv));
+			ax = _mm_add_ps(ax, _mm_mul_ps(cv, _mm_sub_ps(_mm_load_ps(l.vx + half), vx)));
+			ay = _mm_add_ps(ay, _mm_mul_ps(cv, _mm_sub_ps(_mm_load_ps(l.vy + half), vy)));
+		}
+	}
+	sums->ax += __hsum_sse(ax);
+	sums->ay += __hsum_sse(ay);
+	sums->normal_x += __hsum_sse(nx);
+	sums->normal_y += __hsum_sse(ny);
+	sums->curvature += __hsum_sse(curv);
+}
+
+__attribute__((target("avx2,fma")))
+static float		__hsum_avx(__m256 v)
+{
+	__m128 t = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	t = _mm_add_ps(t, _mm_movehl_ps(t, t));
+	t = _mm_add_ss(t, _mm_shuffle_ps(t, t, 0x55));
+	return _mm_cvtss_f32(t);
+}
+
+__attribute__((target("avx2,fma")))
+static float		__density_avx2(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								   const kernel_consts* kc)
+{
+	lanes l;
+	float xi, yi;
+	__position(src, i, &xi, &yi);
+	__m256 x = _mm256_set1_ps(xi);
+	__m256 y = _mm256_set1_ps(yi);
+	__m256 h = _mm256_set1_ps(kc->h);
+	__m256 hh = _mm256_set1_ps(kc->hh);
+	__m256 acc = _mm256_setzero_ps();
+	for(uint32_t k = 0; k < nbr_count; k += LANES)
+	{
+		__gather(&l, i, nbrs, k, nbr_count, src, false);
+		__m256 dx = _mm256_sub_ps(_mm256_load_ps(l.x), x);
+		__m256 dy = _mm256_sub_ps(_mm256_load_ps(l.y), y);
+		__m256 dd = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+		__m256 in = _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_load_si256((const __m256i*)l.skip)),
+									 _mm256_cmp_ps(dd, hh, _CMP_LE_OQ));
+		__m256 t = _mm256_sub_ps(h, _mm256_sqrt_ps(dd));
+		acc = _mm256_add_ps(acc, _mm256_and_ps(in, _mm256_mul_ps(_mm256_mul_ps(t, t), t)));
+	}
+	return __hsum_avx(acc) * kc->density_scale;
+}
+
+__attribute__((target("avx2,fma")))
+static void			__accel_avx2(uint32_t i, const uint32_t* nbrs, uint32_t nbr_count, const source* src,
+								 const kernel_consts* kc, float rest_density, float stiffness_constant,
+								 accel_sums* sums)
+{
+	lanes l;
+	float dens_i = __density(src, i);
+	float dens_inv = 1.0f / dens_i;
+	float p_term = (dens_i - rest_density) * stiffness_constant * dens_inv * dens_inv;
+	float xi, yi;
+	__position(src, i, &xi, &yi);
+	__m256 x = _mm256_set1_ps(xi);
+	__m256 y = _mm256_set1_ps(yi);
+	float vxi, vyi;
+	__velocity(src, i, &vxi, &vyi);
+	__m256 vx = _mm256_set1_ps(vxi);
+	__m256 vy = _mm256_set1_ps(vyi);
+	__m256 h = _mm256_set1_ps(kc->h);
+	__m256 hh = _mm256_set1_ps(kc->hh);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 near_limit = _mm256_set1_ps(1e-5f);
+	__m256 pv = _mm256_set1_ps(p_term);
+	__m256 rest = _mm256_set1_ps(rest_density);
+	__m256 stiff = _mm256_set1_ps(stiffness_constant);
+	__m256 grad_s = _mm256_set1_ps(kc->gradient_scale);
+	__m256 visc_s = _mm256_set1_ps(kc->viscosity_scale);
+	__m256 surf_s = _mm256_set1_ps(kc->surface_scale);
+	__m256 three = _mm256_set1_ps(3.0f), ten = _mm256_set1_ps(10.0f), seven = _mm256_set1_ps(7.0f);
+	__m256 h4 = _mm256_mul_ps(hh, hh);
+	__m256 ax = _mm256_setzero_ps(), ay = _mm256_setzero_ps();
+	__m256 nx = _mm256_setzero_ps(), ny = _mm256_setzero_ps(), curv = _mm256_setzero_ps();
+	for(uint32_t k = 0; k < nbr_count; k += LANES)
+	{
+		__gather(&l, i, nbrs, k, nbr_count, src, true);
+		__m256 dx = _mm256_sub_ps(_mm256_load_ps(l.x), x);
+		__m256 dy = _mm256_sub_ps(_mm256_load_ps(l.y), y);
+		__m256 dd = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+		__m256 in = _mm256_andnot_ps(_mm256_castsi256_ps(_mm256_load_si256((const __m256i*)l.skip)),
+									 _mm256_cmp_ps(dd, hh, _CMP_LE_OQ));
+		__m256 d = _mm256_sqrt_ps(dd);
+		__m256 far = _mm256_and_ps(in, _mm256_cmp_ps(d, near_limit, _CMP_GE_OQ));
+		int near = _mm256_movemask_ps(_mm256_andnot_ps(far, in));
+		for(uint32_t lane = 0; near; lane++, near >>= 1)
+			if(near & 1)
+				__near_pair(i, l.j[lane], kc, p_term, rest_density, stiffness_constant, src, sums);
+
+		__m256 dj = _mm256_load_ps(l.dens);
+		__m256 j_inv = _mm256_div_ps(one, dj);
+		__m256 d_inv = _mm256_div_ps(one, d);
+		__m256 t = _mm256_sub_ps(h, d);
+		//Pressure
+		__m256 p_other = _mm256_mul_ps(_mm256_sub_ps(dj, rest), stiff);
+		__m256 c = _mm256_mul_ps(_mm256_mul_ps(grad_s, _mm256_mul_ps(t, t)), _mm256_fmadd_ps(p_other, j_inv, pv));
+		c = _mm256_and_ps(far, _mm256_mul_ps(c, d_inv));
+		ax = _mm256_fmadd_ps(c, dx, ax);
+		ay = _mm256_fmadd_ps(c, dy, ay);
+		//Surface normal and curvature
+		__m256 q = _mm256_sub_ps(hh, dd);
+		__m256 ws = _mm256_and_ps(far, _mm256_mul_ps(_mm256_mul_ps(surf_s, d), _mm256_mul_ps(_mm256_mul_ps(q, q), j_inv)));
+		nx = _mm256_fmadd_ps(ws, dx, nx);
+		ny = _mm256_fmadd_ps(ws, dy, ny);
+		__m256 lap = _mm256_fmadd_ps(_mm256_mul_ps(seven, dd), dd,
+									 _mm256_fnmadd_ps(_mm256_mul_ps(ten, hh), dd, _mm256_mul_ps(three, h4)));
+		curv = _mm256_add_ps(curv, _mm256_and_ps(far, _mm256_mul_ps(_mm256_mul_ps(surf_s, lap), j_inv)));
+		//Viscosity
+		__m256 cv = _mm256_and_ps(far, _mm256_mul_ps(_mm256_mul_ps(visc_s, t), j_inv));
+		ax = _mm256_fmadd_ps(cv, _mm256_sub_ps(_mm256_load_ps(l.vx), vx), ax);
+		ay = _mm256_fmadd_ps(cv, _mm256_sub_ps(_mm256_load_ps(l.vy), vy), ay);
+	}
+	sums->ax += __hsum_avx(ax);
+	sums->ay += __hsum_avx(ay);
+	sums->normal_x += __hsum_avx(nx);
+	sums->normal_y += __hsum_avx(ny);
+	sums->curvature += __hsum_avx(curv);
+}
+
+#endif
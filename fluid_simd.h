@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "fluid_kernel.h"
+
+typedef enum fluid_simd
+{
+	FLUID_SIMD_AUTO,
+	FLUID_SIMD_SCALAR,
+	FLUID_SIMD_SSE,
+	FLUID_SIMD_AVX2
+}fluid_simd;
+
+fluid_simd			fluid_simd_resolve(fluid_simd requested);
+const char*			fluid_simd_name(fluid_simd simd);
+bool				fluid_simd_supports(const fluid_kernels* kernels);
+float				fluid_simd_density(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									   const float* pos, const fluid_kernels* kernels);
+void				fluid_simd_accel(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+									 const float* pos, const float* vel, const float* dens, float* col,
+									 const fluid_kernels* kernels, float rest_density, float stiffness_constant, float surface_coefficient,
+									 float viscosity_coefficient, float* ax, float* ay);
+float				fluid_simd_compact_density(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+											   const uint16_t* pos, const fluid_kernels* kernels);
+bool				fluid_simd_compact_accel(fluid_simd simd, uint32_t i, const uint32_t* nbrs, uint32_t nbr_count,
+											 const uint16_t* pos, const uint16_t* vel, const uint16_t* dens,
+											 const fluid_kernels* kernels, float rest_density, float stiffness_constant,
+											 float surface_coefficient, float viscosity_coefficient, float* ax, float* ay);
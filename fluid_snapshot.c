@@ -0,0 +1,273 @@
+#include "fluid_snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+_Static_assert(sizeof(fluid_snapshot_params) == 140, "snapshot params layout changed");
+_Static_assert(sizeof(fluid_snapshot_header) == 216, "snapshot header layout changed");
+_Static_assert(sizeof(fluid_snapshot_section) == 24, "snapshot section layout changed");
+
+//Header size of version 1; later versions only append parameters
+#define HEADER_SIZE_V1	192u
+
+typedef struct fluid_snapshot
+{
+	const uint8_t* data;
+	uint64_t size;
+	//The stored header, with the parameters an older version lacks left zero
+	fluid_snapshot_header header;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+}fluid_snapshot;
+
+static bool			__little_endian(void);
+static uint64_t		__align(uint64_t offset);
+static bool			__write_padded(FILE* file, const void* data, uint64_t size, uint64_t* offset);
+static bool			__sync_close(FILE* file);
+static bool			__replace(const char* from, const char* to);
+static bool			__map(fluid_snapshot* snap, const char* path);
+static void			__unmap(fluid_snapshot* snap);
+
+bool				fluid_snapshot_write(const char* path, const fluid_snapshot_header* header,
+										 const fluid_snapshot_array* arrays, uint32_t array_count)
+{
+	//The format is little endian and written as the in-memory bytes
+	if(!__little_endian()) { return false; }
+
+	fluid_snapshot_header h = *header;
+	fluid_snapshot_section* sections = calloc(array_count ? array_count : 1u, sizeof *sections);
+	if(!sections) { return false; }
+	uint64_t offset = __align(sizeof h + array_count * sizeof *sections);
+	for(uint32_t a = 0; a < array_count; a++)
+	{
+		sections[a].id = arrays[a].id;
+		sections[a].elem_size = arrays[a].elem_size;
+		sections[a].offset = offset;
+		sections[a].size = (uint64_t)arrays[a].elem_size * arrays[a].count;
+		offset = __align(offset + sections[a].size);
+	}
+	h.magic = FLUID_SNAPSHOT_MAGIC;
+	h.version = FLUID_SNAPSHOT_VERSION;
+	h.header_size = sizeof h;
+	h.section_count = array_count;
+	h.file_size = offset;
+
+	size_t path_len = strlen(path);
+	char* tmp_path = malloc(path_len + 5u);
+	if(!tmp_path)
+	{
+		free(sections);
+		return false;
+	}
+	memcpy(tmp_path, path, path_len);
+	memcpy(tmp_path + path_len, ".tmp", 5u);
+
+	FILE* file = fopen(tmp_path, "wb");
+	bool ok = file != NULL;
+	uint64_t written = 0u;
+	ok = ok && __write_padded(file, &h, sizeof h, &written);
+	ok = ok && __write_padded(file, sections, array_count * sizeof *sections, &written);
+	for(uint32_t a = 0; ok && a < array_count; a++)
+	{
+		ok = __write_padded(file, NULL, sections[a].offset - written, &written);
+		ok = ok && __write_padded(file, arrays[a].data, sections[a].size, &written);
+	}
+	ok = ok && __write_padded(file, NULL, h.file_size - written, &written);
+	if(file)
+		ok = __sync_close(file) && ok;
+	ok = ok && __replace(tmp_path, path);
+	if(!ok)
+		remove(tmp_path);
+	free(tmp_path);
+	free(sections);
+	return ok;
+}
+
+//Maps the file and checks the header and section table; no data is copied
+fluid_snapshot*		fluid_snapshot_open(const char* path)
+{
+	if(!__little_endian()) { return NULL; }
+	fluid_snapshot* snap = calloc(1u, sizeof *snap);
+	if(!snap) { return NULL; }
+	if(!__map(snap, path))
+	{
+		free(snap);
+		return NULL;
+	}
+
+	//Older versions are read by their stored header size
+	const fluid_snapshot_header* h = &snap->header;
+	bool ok = snap->size >= HEADER_SIZE_V1;
+	if(ok)
+	{
+		memcpy(&snap->header, snap->data, HEADER_SIZE_V1);
+		ok = h->magic == FLUID_SNAPSHOT_MAGIC &&
+			h->version >= 1u && h->version <= FLUID_SNAPSHOT_VERSION &&
+			h->header_size >= HEADER_SIZE_V1 && h->header_size <= sizeof *h && h->header_size % 8u == 0u &&
+			h->file_size == snap->size &&
+			(uint64_t)h->section_count * sizeof(fluid_snapshot_section) <= snap->size - h->header_size;
+	}
+	if(ok)
+		memcpy(&snap->header, snap->data, h->header_size);
+	const fluid_snapshot_section* sections = (const fluid_snapshot_section*)(snap->data + h->header_size);
+	for(uint32_t s = 0; ok && s < h->section_count; s++)
+	{
+		ok = sections[s].offset % FLUID_SNAPSHOT_ALIGN == 0u &&
+			sections[s].offset <= snap->size &&
+			sections[s].size <= snap->size - sections[s].offset;
+	}
+	if(!ok)
+	{
+		fluid_snapshot_close(snap);
+		return NULL;
+	}
+	return snap;
+}
+
+void				fluid_snapshot_close(fluid_snapshot* snap)
+{
+	if(!snap) { return; }
+	__unmap(snap);
+	free(snap);
+}
+
+const fluid_snapshot_header*	fluid_snapshot_get_header(fluid_snapshot* snap)
+{
+	return &snap->header;
+}
+
+//Returns the array only if the section exists with exactly the expected shape
+const void*			fluid_snapshot_get_array(fluid_snapshot* snap, fluid_snapshot_id id, uint32_t elem_size, uint32_t count)
+{
+	const fluid_snapshot_header* h = fluid_snapshot_get_header(snap);
+	const fluid_snapshot_section* sections = (const fluid_snapshot_section*)(snap->data + h->header_size);
+	for(uint32_t s = 0; s < h->section_count; s++)
+	{
+		if(sections[s].id != (uint32_t)id) { continue; }
+		if(sections[s].elem_size != elem_size || sections[s].size != (uint64_t)elem_size * count) { return NULL; }
+		return snap->data + sections[s].offset;
+	}
+	return NULL;
+}
+
+
+
+static bool			__little_endian(void)
+{
+	uint32_t one = 1u;
+	uint8_t first;
+	memcpy(&first, &one, 1u);
+	return first == 1u;
+}
+
+static uint64_t		__align(uint64_t offset)
+{
+	return (offset + FLUID_SNAPSHOT_ALIGN - 1u) & ~(uint64_t)(FLUID_SNAPSHOT_ALIGN - 1u);
+}
+
+//Writes size bytes of data, or zeros when data is NULL
+static bool			__write_padded(FILE* file, const void* data, uint64_t size, uint64_t* offset)
+{
+	static const uint8_t zeros[FLUID_SNAPSHOT_ALIGN] = {0};
+	if(data)
+	{
+		if(size && fwrite(data, 1u, size, file) != size) { return false; }
+	}
+	else
+	{
+		for(uint64_t left = size; left > 0u;)
+		{
+			uint64_t n = left < sizeof zeros ? left : sizeof zeros;
+			if(fwrite(zeros, 1u, n, file) != n) { return false; }
+			left -= n;
+		}
+	}
+	*offset += size;
+	return true;
+}
+
+static bool			__sync_close(FILE* file)
+{
+	bool ok = fflush(file) == 0;
+#ifdef _WIN32
+	ok = ok && _commit(_fileno(file)) == 0;
+#else
+	ok = ok && fsync(fileno(file)) == 0;
+#endif
+	return fclose(file) == 0 && ok;
+}
+
+static bool			__replace(const char* from, const char* to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+static bool			__map(fluid_snapshot* snap, const char* path)
+{
+#ifdef _WIN32
+	snap->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(snap->file == INVALID_HANDLE_VALUE) { return false; }
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(snap->file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(snap->file);
+		return false;
+	}
+	snap->mapping = CreateFileMappingA(snap->file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(!snap->mapping)
+	{
+		CloseHandle(snap->file);
+		return false;
+	}
+	snap->data = MapViewOfFile(snap->mapping, FILE_MAP_READ, 0, 0, 0);
+	if(!snap->data)
+	{
+		CloseHandle(snap->mapping);
+		CloseHandle(snap->file);
+		return false;
+	}
+	snap->size = (uint64_t)size.QuadPart;
+	return true;
+#else
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) { return false; }
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+	void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) { return false; }
+	snap->data = data;
+	snap->size = (uint64_t)st.st_size;
+	return true;
+#endif
+}
+
+static void			__unmap(fluid_snapshot* snap)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(snap->data);
+	CloseHandle(snap->mapping);
+	CloseHandle(snap->file);
+#else
+	munmap((void*)snap->data, (size_t)snap->size);
+#endif
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+//Snapshot file layout, little endian throughout:
+//	fluid_snapshot_header
+//	fluid_snapshot_section[section_count]
+//	section data, every section starting on a FLUID_SNAPSHOT_ALIGN boundary
+//A snapshot is mapped read-only and its arrays are used in place; files are
+//written to a temporary name and renamed over the target, so a reader never
+//sees a partial file. A new version only appends to fluid_snapshot_params,
+//so older files are read by their header_size with the parameters they lack
+//left zero.
+#define FLUID_SNAPSHOT_MAGIC	0x504E5346u
+#define FLUID_SNAPSHOT_VERSION	3u
+#define FLUID_SNAPSHOT_ALIGN	64u
+
+typedef enum fluid_snapshot_id
+{
+	FLUID_SNAPSHOT_POSITION = 1,
+	FLUID_SNAPSHOT_PREV_POSITION,
+	FLUID_SNAPSHOT_VELOCITY,
+	FLUID_SNAPSHOT_DENSITY,
+	FLUID_SNAPSHOT_COLOR,
+	FLUID_SNAPSHOT_ACCEL,
+	FLUID_SNAPSHOT_ID,
+	FLUID_SNAPSHOT_LEVEL,
+	FLUID_SNAPSHOT_CALM
+}fluid_snapshot_id;
+
+//Solver parameters with fixed-width fields, independent of fluid_sim_params
+typedef struct fluid_snapshot_params
+{
+	float radius, h, dt, gravity, damp_factor;
+	float rest_density, stiffness_constant, surface_coefficient, viscosity_coefficient;
+	float skin, cfl_factor, dt_min, dt_max;
+	uint32_t neighbor_backend, neighbor_lists, reorder_interval, threads;
+	uint32_t simd, kernel, kernel_table_size, pair_forces, adaptive_dt, block_levels;
+	uint32_t pressure_solver, pressure_max_iterations;
+	float pressure_tolerance;
+	uint32_t pbf_iterations;
+	float pbf_relaxation, xsph_viscosity;
+	uint32_t sleeping, sleep_steps;
+	float sleep_velocity, sleep_density;
+	uint32_t compact_storage;
+	uint32_t reserved;
+}fluid_snapshot_params;
+
+typedef struct fluid_snapshot_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t section_count;
+	uint64_t file_size;
+	uint64_t step_count;
+	double time;
+	float dt;
+	uint32_t substep;
+	uint32_t particle_count;
+	uint32_t reserved[5];
+	fluid_snapshot_params params;
+}fluid_snapshot_header;
+
+typedef struct fluid_snapshot_section
+{
+	uint32_t id;
+	uint32_t elem_size;
+	uint64_t offset;
+	uint64_t size;
+}fluid_snapshot_section;
+
+//An array to write: count elements of elem_size bytes
+typedef struct fluid_snapshot_array
+{
+	fluid_snapshot_id id;
+	uint32_t elem_size;
+	uint32_t count;
+	const void* data;
+}fluid_snapshot_array;
+
+typedef struct fluid_snapshot fluid_snapshot;
+
+bool				fluid_snapshot_write(const char* path, const fluid_snapshot_header* header,
+										 const fluid_snapshot_array* arrays, uint32_t array_count);
+fluid_snapshot*		fluid_snapshot_open(const char* path);
+void				fluid_snapshot_close(fluid_snapshot* snap);
+const fluid_snapshot_header*	fluid_snapshot_get_header(fluid_snapshot* snap);
+const void*			fluid_snapshot_get_array(fluid_snapshot* snap, fluid_snapshot_id id, uint32_t elem_size, uint32_t count);
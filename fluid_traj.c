@@ -0,0 +1,513 @@
+#include "fluid_traj.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define FILE_MAGIC		0x4A525446u
+#define FRAME_MAGIC		0x4D415246u
+#define VERSION			1u
+#define FRAME_KEY		0x1u
+
+typedef struct file_header file_header;
+typedef struct frame_header frame_header;
+typedef struct slot slot;
+
+typedef struct file_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t particle_count;
+	uint32_t fields;
+	uint32_t flags;
+	uint32_t keyframe_interval;
+	uint32_t reserved[2];
+}file_header;
+
+typedef struct frame_header
+{
+	uint32_t magic;
+	uint32_t flags;
+	uint64_t step;
+	double time;
+	uint32_t size;
+	uint32_t reserved;
+}frame_header;
+
+struct slot
+{
+	uint64_t step;
+	double time;
+	float* pos;
+	float* vel;
+	float* dens;
+};
+
+//The simulation thread copies frames into free slots of the ring; the writer
+//thread encodes and writes them in order. A push into a full ring drops the
+//frame instead of waiting on the disk.
+typedef struct fluid_traj_writer
+{
+	FILE* file;
+	file_header header;
+	slot* ring;
+	uint32_t ring_size;
+	uint32_t head, count;
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool quit;
+	bool thread_started;
+	//Writer thread state
+	uint8_t* encoded;
+	uint16_t* prev_q;
+	uint64_t frames, dropped, bytes;
+	bool failed;
+}fluid_traj_writer;
+
+typedef struct fluid_traj_reader
+{
+	FILE* file;
+	file_header header;
+	uint8_t* payload;
+	uint32_t payload_capacity;
+	uint16_t* prev_q;
+	bool have_key;
+	float* pos;
+	float* vel;
+	float* dens;
+}fluid_traj_reader;
+
+static void*		__writer_main(void* arg);
+static uint32_t		__encode(fluid_traj_writer* writer, const slot* s, bool key);
+static bool			__decode(fluid_traj_reader* reader, const uint8_t* data, uint32_t size, bool key);
+static uint32_t		__max_frame_size(const file_header* header);
+static uint16_t		__quantize(float t);
+static uint8_t*		__put_varint(uint8_t* out, uint32_t v);
+static const uint8_t*	__get_varint(const uint8_t* in, const uint8_t* end, uint32_t* v);
+static void			__free_ring(fluid_traj_writer* writer);
+
+fluid_traj_writer*	fluid_traj_writer_create(const char* path, uint32_t particle_count, uint32_t fields, uint32_t flags,
+											 uint32_t ring_size, uint32_t keyframe_interval)
+{
+	if(ring_size < 2u) { ring_size = 2u; }
+	if(keyframe_interval < 1u) { keyframe_interval = 1u; }
+	//Deltas are taken between quantized values only
+	if(!(flags & FLUID_TRAJ_QUANTIZE)) { flags &= ~FLUID_TRAJ_DELTA; }
+	fluid_traj_writer* writer = calloc(1u, sizeof *writer);
+	if(!writer) { return NULL; }
+	writer->header.magic = FILE_MAGIC;
+	writer->header.version = VERSION;
+	writer->header.particle_count = particle_count;
+	writer->header.fields = fields;
+	writer->header.flags = flags;
+	writer->header.keyframe_interval = keyframe_interval;
+	writer->ring_size = ring_size;
+	pthread_mutex_init(&writer->mutex, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+
+	bool ok = true;
+	writer->ring = calloc(ring_size, sizeof *writer->ring);
+	ok = ok && writer->ring;
+	for(uint32_t r = 0; ok && r < ring_size; r++)
+	{
+		slot* s = &writer->ring[r];
+		if(fields & FLUID_TRAJ_POSITION)
+			ok = ok && (s->pos = malloc(particle_count * 2u * sizeof *s->pos));
+		if(fields & FLUID_TRAJ_VELOCITY)
+			ok = ok && (s->vel = malloc(particle_count * 2u * sizeof *s->vel));
+		if(fields & FLUID_TRAJ_DENSITY)
+			ok = ok && (s->dens = malloc(particle_count * sizeof *s->dens));
+	}
+	writer->encoded = malloc(__max_frame_size(&writer->header));
+	writer->prev_q = calloc(particle_count * 2u, sizeof *writer->prev_q);
+	writer->file = fopen(path, "wb");
+	ok = ok && writer->encoded && writer->prev_q && writer->file;
+	ok = ok && fwrite(&writer->header, sizeof writer->header, 1u, writer->file) == 1u;
+	ok = ok && pthread_create(&writer->thread, NULL, __writer_main, writer) == 0;
+	if(!ok)
+	{
+		fluid_traj_writer_destroy(writer);
+		return NULL;
+	}
+	writer->thread_started = true;
+	writer->bytes = sizeof writer->header;
+	return writer;
+}
+
+//Drains the ring before closing the file
+void				fluid_traj_writer_destroy(fluid_traj_writer* writer)
+{
+	if(!writer) { return; }
+	if(writer->thread_started)
+	{
+		pthread_mutex_lock(&writer->mutex);
+		writer->quit = true;
+		pthread_cond_broadcast(&writer->cond);
+		pthread_mutex_unlock(&writer->mutex);
+		pthread_join(writer->thread, NULL);
+	}
+	if(writer->file)
+		fclose(writer->file);
+	__free_ring(writer);
+	free(writer->encoded);
+	free(writer->prev_q);
+	pthread_mutex_destroy(&writer->mutex);
+	pthread_cond_destroy(&writer->cond);
+	free(writer);
+}
+
+//Copies one frame into the ring, reordered so that entry k belongs to id k;
+//returns false when the frame was dropped
+bool				fluid_traj_writer_push(fluid_traj_writer* writer, uint64_t step, double time, const float* pos,
+										   const float* vel, const float* dens, const uint32_t* ids)
+{
+	pthread_mutex_lock(&writer->mutex);
+	bool full = writer->count == writer->ring_size;
+	uint32_t tail = (writer->head + writer->count) % writer->ring_size;
+	if(full)
+		writer->dropped++;
+	pthread_mutex_unlock(&writer->mutex);
+	if(full) { return false; }
+
+	//Only this thread fills slots, and the writer never reads past count
+	slot* s = &writer->ring[tail];
+	s->step = step;
+	s->time = time;
+	uint32_t n = writer->header.particle_count;
+	for(uint32_t i = 0; i < n; i++)
+	{
+		uint32_t k = ids ? ids[i] : i;
+		if(s->pos)
+		{
+			s->pos[2 * k + 0] = pos[2 * i + 0];
+			s->pos[2 * k + 1] = pos[2 * i + 1];
+		}
+		if(s->vel)
+		{
+			s->vel[2 * k + 0] = vel[2 * i + 0];
+			s->vel[2 * k + 1] = vel[2 * i + 1];
+		}
+		if(s->dens)
+			s->dens[k] = dens[i];
+	}
+
+	pthread_mutex_lock(&writer->mutex);
+	writer->count++;
+	pthread_cond_broadcast(&writer->cond);
+	pthread_mutex_unlock(&writer->mutex);
+	return true;
+}
+
+//Blocks until every queued frame has been written
+void				fluid_traj_writer_flush(fluid_traj_writer* writer)
+{
+	pthread_mutex_lock(&writer->mutex);
+	while(writer->count > 0u)
+		pthread_cond_wait(&writer->cond, &writer->mutex);
+	pthread_mutex_unlock(&writer->mutex);
+}
+
+uint64_t			fluid_traj_writer_frames(fluid_traj_writer* writer)
+{
+	pthread_mutex_lock(&writer->mutex);
+	uint64_t frames = writer->frames;
+	pthread_mutex_unlock(&writer->mutex);
+	return frames;
+}
+
+uint64_t			fluid_traj_writer_dropped(fluid_traj_writer* writer)
+{
+	pthread_mutex_lock(&writer->mutex);
+	uint64_t dropped = writer->dropped;
+	pthread_mutex_unlock(&writer->mutex);
+	return dropped;
+}
+
+uint64_t			fluid_traj_writer_bytes(fluid_traj_writer* writer)
+{
+	pthread_mutex_lock(&writer->mutex);
+	uint64_t bytes = writer->bytes;
+	pthread_mutex_unlock(&writer->mutex);
+	return bytes;
+}
+
+fluid_traj_reader*	fluid_traj_reader_open(const char* path)
+{
+	fluid_traj_reader* reader = calloc(1u, sizeof *reader);
+	if(!reader) { return NULL; }
+	reader->file = fopen(path, "rb");
+	bool ok = reader->file &&
+		fread(&reader->header, sizeof reader->header, 1u, reader->file) == 1u &&
+		reader->header.magic == FILE_MAGIC &&
+		reader->header.version == VERSION;
+	if(ok)
+	{
+		uint32_t n = reader->header.particle_count;
+		reader->pos = malloc(n * 2u * sizeof *reader->pos);
+		reader->vel = malloc(n * 2u * sizeof *reader->vel);
+		reader->dens = malloc(n * sizeof *reader->dens);
+		reader->prev_q = calloc(n * 2u, sizeof *reader->prev_q);
+		ok = reader->pos && reader->vel && reader->dens && reader->prev_q;
+	}
+	if(!ok)
+	{
+		fluid_traj_reader_close(reader);
+		return NULL;
+	}
+	return reader;
+}
+
+void				fluid_traj_reader_close(fluid_traj_reader* reader)
+{
+	if(!reader) { return; }
+	if(reader->file)
+		fclose(reader->file);
+	free(reader->payload);
+	free(reader->prev_q);
+	free(reader->pos);
+	free(reader->vel);
+	free(reader->dens);
+	free(reader);
+}
+
+uint32_t			fluid_traj_reader_count(fluid_traj_reader* reader)
+{
+	return reader->header.particle_count;
+}
+
+uint32_t			fluid_traj_reader_fields(fluid_traj_reader* reader)
+{
+	return reader->header.fields;
+}
+
+uint32_t			fluid_traj_reader_flags(fluid_traj_reader* reader)
+{
+	return reader->header.flags;
+}
+
+//Returns false at the end of the stream or on a corrupt frame
+bool				fluid_traj_reader_next(fluid_traj_reader* reader, fluid_traj_frame* frame)
+{
+	frame_header fh;
+	if(fread(&fh, sizeof fh, 1u, reader->file) != 1u || fh.magic != FRAME_MAGIC) { return false; }
+	if(fh.size > __max_frame_size(&reader->header)) { return false; }
+	if(fh.size > reader->payload_capacity)
+	{
+		uint8_t* payload = realloc(reader->payload, fh.size);
+		if(!payload) { return false; }
+		reader->payload = payload;
+		reader->payload_capacity = fh.size;
+	}
+	if(fh.size && fread(reader->payload, fh.size, 1u, reader->file) != 1u) { return false; }
+
+	bool key = (fh.flags & FRAME_KEY) != 0u;
+	if(!key && !reader->have_key) { return false; }
+	if(!__decode(reader, reader->payload, fh.size, key)) { return false; }
+	reader->have_key = true;
+
+	frame->step = fh.step;
+	frame->time = fh.time;
+	frame->keyframe = key;
+	frame->positions = reader->header.fields & FLUID_TRAJ_POSITION ? reader->pos : NULL;
+	frame->velocities = reader->header.fields & FLUID_TRAJ_VELOCITY ? reader->vel : NULL;
+	frame->densities = reader->header.fields & FLUID_TRAJ_DENSITY ? reader->dens : NULL;
+	return true;
+}
+
+
+
+static void*		__writer_main(void* arg)
+{
+	fluid_traj_writer* writer = arg;
+	uint64_t index = 0u;
+	pthread_mutex_lock(&writer->mutex);
+	for(;;)
+	{
+		while(writer->count == 0u && !writer->quit)
+			pthread_cond_wait(&writer->cond, &writer->mutex);
+		if(writer->count == 0u) { break; }
+		slot* s = &writer->ring[writer->head];
+		pthread_mutex_unlock(&writer->mutex);
+
+		bool key = index % writer->header.keyframe_interval == 0u;
+		uint32_t size = __encode(writer, s, key);
+		frame_header fh = { FRAME_MAGIC, key ? FRAME_KEY : 0u, s->step, s->time, size, 0u };
+		bool ok = !writer->failed &&
+			fwrite(&fh, sizeof fh, 1u, writer->file) == 1u &&
+			(size == 0u || fwrite(writer->encoded, size, 1u, writer->file) == 1u);
+		index++;
+
+		pthread_mutex_lock(&writer->mutex);
+		writer->failed = !ok;
+		if(ok)
+		{
+			writer->frames++;
+			writer->bytes += sizeof fh + size;
+		}
+		writer->head = (writer->head + 1u) % writer->ring_size;
+		writer->count--;
+		pthread_cond_broadcast(&writer->cond);
+	}
+	pthread_mutex_unlock(&writer->mutex);
+	fflush(writer->file);
+	return NULL;
+}
+
+static uint32_t		__encode(fluid_traj_writer* writer, const slot* s, bool key)
+{
+	const file_header* h = &writer->header;
+	uint32_t n = h->particle_count;
+	uint8_t* out = writer->encoded;
+	if(h->fields & FLUID_TRAJ_POSITION)
+	{
+		if(!(h->flags & FLUID_TRAJ_QUANTIZE))
+		{
+			memcpy(out, s->pos, n * 2u * sizeof *s->pos);
+			out += n * 2u * sizeof *s->pos;
+		}
+		else
+		{
+			bool delta = !key && (h->flags & FLUID_TRAJ_DELTA);
+			for(uint32_t k = 0; k < 2u * n; k++)
+			{
+				uint16_t q = __quantize(s->pos[k]);
+				if(delta)
+				{
+					//Wrapping 16-bit difference, zigzag so small moves take one byte
+					uint16_t d = (uint16_t)(q - writer->prev_q[k]);
+					out = __put_varint(out, (uint16_t)((d << 1) ^ (0u - (d >> 15))));
+				}
+				else
+				{
+					memcpy(out, &q, sizeof q);
+					out += sizeof q;
+				}
+				writer->prev_q[k] = q;
+			}
+		}
+	}
+	if(h->fields & FLUID_TRAJ_VELOCITY)
+	{
+		memcpy(out, s->vel, n * 2u * sizeof *s->vel);
+		out += n * 2u * sizeof *s->vel;
+	}
+	if(h->fields & FLUID_TRAJ_DENSITY)
+	{
+		memcpy(out, s->dens, n * sizeof *s->dens);
+		out += n * sizeof *s->dens;
+	}
+	return (uint32_t)(out - writer->encoded);
+}
+
+static bool			__decode(fluid_traj_reader* reader, const uint8_t* data, uint32_t size, bool key)
+{
+	const file_header* h = &reader->header;
+	uint32_t n = h->particle_count;
+	const uint8_t* in = data;
+	const uint8_t* end = data + size;
+	if(h->fields & FLUID_TRAJ_POSITION)
+	{
+		if(!(h->flags & FLUID_TRAJ_QUANTIZE))
+		{
+			if((uint64_t)(end - in) < n * 2u * sizeof *reader->pos) { return false; }
+			memcpy(reader->pos, in, n * 2u * sizeof *reader->pos);
+			in += n * 2u * sizeof *reader->pos;
+		}
+		else
+		{
+			bool delta = !key && (h->flags & FLUID_TRAJ_DELTA);
+			for(uint32_t k = 0; k < 2u * n; k++)
+			{
+				uint16_t q;
+				if(delta)
+				{
+					uint32_t z;
+					in = __get_varint(in, end, &z);
+					if(!in) { return false; }
+					q = (uint16_t)(reader->prev_q[k] + ((z >> 1) ^ (0u - (z & 1u))));
+				}
+				else
+				{
+					if(end - in < (ptrdiff_t)sizeof q) { return false; }
+					memcpy(&q, in, sizeof q);
+					in += sizeof q;
+				}
+				reader->prev_q[k] = q;
+				reader->pos[k] = (float)q / 65535.0f;
+			}
+		}
+	}
+	if(h->fields & FLUID_TRAJ_VELOCITY)
+	{
+		if((uint64_t)(end - in) < n * 2u * sizeof *reader->vel) { return false; }
+		memcpy(reader->vel, in, n * 2u * sizeof *reader->vel);
+		in += n * 2u * sizeof *reader->vel;
+	}
+	if(h->fields & FLUID_TRAJ_DENSITY)
+	{
+		if((uint64_t)(end - in) < n * sizeof *reader->dens) { return false; }
+		memcpy(reader->dens, in, n * sizeof *reader->dens);
+		in += n * sizeof *reader->dens;
+	}
+	return in == end;
+}
+
+//Raw floats bound every encoding: a quantized delta takes at most three varint bytes
+static uint32_t		__max_frame_size(const file_header* header)
+{
+	uint32_t n = header->particle_count;
+	uint32_t size = 0u;
+	if(header->fields & FLUID_TRAJ_POSITION) { size += n * 2u * 4u; }
+	if(header->fields & FLUID_TRAJ_VELOCITY) { size += n * 2u * 4u; }
+	if(header->fields & FLUID_TRAJ_DENSITY) { size += n * 4u; }
+	return size;
+}
+
+static uint16_t		__quantize(float t)
+{
+	if(!(t > 0.0f)) { return 0u; }
+	if(t >= 1.0f) { return 65535u; }
+	return (uint16_t)(t * 65535.0f + 0.5f);
+}
+
+static uint8_t*		__put_varint(uint8_t* out, uint32_t v)
+{
+	while(v >= 0x80u)
+	{
+		*out++ = (uint8_t)(v | 0x80u);
+		v >>= 7;
+	}
+	*out++ = (uint8_t)v;
+	return out;
+}
+
+static const uint8_t*	__get_varint(const uint8_t* in, const uint8_t* end, uint32_t* v)
+{
+	uint32_t result = 0u;
+	for(uint32_t shift = 0u; shift < 21u; shift += 7u)
+	{
+		if(in == end) { return NULL; }
+		uint8_t b = *in++;
+		result |= (uint32_t)(b & 0x7Fu) << shift;
+		if(!(b & 0x80u))
+		{
+			*v = result;
+			return in;
+		}
+	}
+	return NULL;
+}
+
+static void			__free_ring(fluid_traj_writer* writer)
+{
+	if(!writer->ring) { return; }
+	for(uint32_t r = 0; r < writer->ring_size; r++)
+	{
+		free(writer->ring[r].pos);
+		free(writer->ring[r].vel);
+		free(writer->ring[r].dens);
+	}
+	free(writer->ring);
+}
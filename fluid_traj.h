@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+//Trajectory stream: a file header followed by frames, little endian. Frames
+//are stored in particle id order. Positions can be quantized to 16 bits over
+//[0, 1] and, between keyframes, stored as zigzag varint deltas of the
+//quantized values; velocities and densities are raw floats.
+#define FLUID_TRAJ_POSITION		0x1u
+#define FLUID_TRAJ_VELOCITY		0x2u
+#define FLUID_TRAJ_DENSITY		0x4u
+
+#define FLUID_TRAJ_QUANTIZE		0x1u
+#define FLUID_TRAJ_DELTA		0x2u
+
+typedef struct fluid_traj_writer fluid_traj_writer;
+typedef struct fluid_traj_reader fluid_traj_reader;
+
+//A decoded frame; the arrays belong to the reader and stay valid until the next read
+typedef struct fluid_traj_frame
+{
+	uint64_t step;
+	double time;
+	bool keyframe;
+	const float* positions;
+	const float* velocities;
+	const float* densities;
+}fluid_traj_frame;
+
+fluid_traj_writer*	fluid_traj_writer_create(const char* path, uint32_t particle_count, uint32_t fields, uint32_t flags,
+											 uint32_t ring_size, uint32_t keyframe_interval);
+void				fluid_traj_writer_destroy(fluid_traj_writer* writer);
+bool				fluid_traj_writer_push(fluid_traj_writer* writer, uint64_t step, double time, const float* pos,
+										   const float* vel, const float* dens, const uint32_t* ids);
+void				fluid_traj_writer_flush(fluid_traj_writer* writer);
+uint64_t			fluid_traj_writer_frames(fluid_traj_writer* writer);
+uint64_t			fluid_traj_writer_dropped(fluid_traj_writer* writer);
+uint64_t			fluid_traj_writer_bytes(fluid_traj_writer* writer);
+
+fluid_traj_reader*	fluid_traj_reader_open(const char* path);
+void				fluid_traj_reader_close(fluid_traj_reader* reader);
+uint32_t			fluid_traj_reader_count(fluid_traj_reader* reader);
+uint32_t			fluid_traj_reader_fields(fluid_traj_reader* reader);
+uint32_t			fluid_traj_reader_flags(fluid_traj_reader* reader);
+bool				fluid_traj_reader_next(fluid_traj_reader* reader, fluid_traj_frame* frame);
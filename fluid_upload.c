@@ -0,0 +1,291 @@
+#include "fluid_upload.h"
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#define GLEW_STATIC
+#include <GL/glew.h>
+#include "utils.h"
+
+#define REGIONS 3u
+
+typedef struct fluid_upload
+{
+	fluid_upload_mode mode;
+	uint32_t particle_count;
+	GLuint vao;
+	//SEPARATE uses all three, the packed modes only the first
+	GLuint buffers[3];
+	fluid_vertex* staging;
+	//SEPARATE fed from packed vertices: positions, velocities, colors
+	float* unpacked;
+	//PERSISTENT: REGIONS consecutive copies of the vertex array
+	fluid_vertex* mapped;
+	GLsync fences[REGIONS];
+	uint32_t region;
+	uint64_t bytes;
+	double time;
+}fluid_upload;
+
+static bool			__create_separate(fluid_upload* upload);
+static bool			__create_packed(fluid_upload* upload, GLsizeiptr size);
+static void			__packed_layout(void);
+static fluid_vertex*	__region(fluid_upload* upload, uint32_t* first);
+static void			__unpack(const fluid_vertex* vertices, uint32_t count, float* out);
+static void			__wait(GLsync fence);
+
+fluid_upload*		fluid_upload_create(uint32_t particle_count, fluid_upload_mode mode)
+{
+	fluid_upload* upload = calloc(1u, sizeof *upload);
+	if(!upload) { return NULL; }
+	upload->particle_count = particle_count;
+	if(mode == FLUID_UPLOAD_PERSISTENT && !GLEW_VERSION_4_4 && !GLEW_ARB_buffer_storage)
+		mode = FLUID_UPLOAD_INTERLEAVED;
+	upload->mode = mode;
+
+	glGenVertexArrays(1, &upload->vao);
+	glBindVertexArray(upload->vao);
+	bool ok;
+	if(mode == FLUID_UPLOAD_SEPARATE)
+	{
+		upload->unpacked = malloc(particle_count * 7u * sizeof *upload->unpacked);
+		ok = upload->unpacked && __create_separate(upload);
+	}
+	else if(mode == FLUID_UPLOAD_INTERLEAVED)
+	{
+		upload->staging = malloc(particle_count * sizeof *upload->staging);
+		ok = upload->staging && __create_packed(upload, particle_count * sizeof(fluid_vertex));
+	}
+	else
+		ok = __create_packed(upload, REGIONS * particle_count * sizeof(fluid_vertex));
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(!ok || glGetError() != GL_NO_ERROR)
+	{
+		fluid_upload_destroy(upload);
+		return NULL;
+	}
+	return upload;
+}
+
+void				fluid_upload_destroy(fluid_upload* upload)
+{
+	if(!upload) { return; }
+	for(uint32_t r = 0; r < REGIONS; r++)
+		if(upload->fences[r])
+			glDeleteSync(upload->fences[r]);
+	if(upload->mapped)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[0]);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	glDeleteBuffers(3, upload->buffers);
+	glDeleteVertexArrays(1, &upload->vao);
+	free(upload->staging);
+	free(upload->unpacked);
+	free(upload);
+}
+
+fluid_upload_mode	fluid_upload_get_mode(fluid_upload* upload)
+{
+	return upload->mode;
+}
+
+//Uploads the current particle state and binds the vertex array; returns the
+//first vertex to draw from
+uint32_t			fluid_upload_begin(fluid_upload* upload, fluid_sim* sim)
+{
+	double t0 = wtime();
+	uint32_t count = upload->particle_count;
+	uint32_t first = 0u;
+	if(upload->mode == FLUID_UPLOAD_SEPARATE)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[0]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * 2u * sizeof(float), fluid_sim_positions(sim));
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[1]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * 2u * sizeof(float), fluid_sim_velocities(sim));
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[2]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * 3u * sizeof(float), fluid_sim_colors(sim));
+		upload->bytes = count * 7u * sizeof(float);
+	}
+	else if(upload->mode == FLUID_UPLOAD_INTERLEAVED)
+	{
+		fluid_sim_pack_vertices(sim, upload->staging);
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[0]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(fluid_vertex), upload->staging);
+		upload->bytes = count * sizeof(fluid_vertex);
+	}
+	else
+	{
+		fluid_sim_pack_vertices(sim, __region(upload, &first));
+		upload->bytes = count * sizeof(fluid_vertex);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(upload->vao);
+	upload->time = wtime() - t0;
+	return first;
+}
+
+//As fluid_upload_begin, from vertices already packed by fluid_sim_pack_vertices
+uint32_t			fluid_upload_begin_packed(fluid_upload* upload, const fluid_vertex* vertices)
+{
+	double t0 = wtime();
+	uint32_t count = upload->particle_count;
+	uint32_t first = 0u;
+	if(upload->mode == FLUID_UPLOAD_SEPARATE)
+	{
+		__unpack(vertices, count, upload->unpacked);
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[0]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * 2u * sizeof(float), upload->unpacked);
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[1]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * 2u * sizeof(float), upload->unpacked + 2u * count);
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[2]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * 3u * sizeof(float), upload->unpacked + 4u * count);
+		upload->bytes = count * 7u * sizeof(float);
+	}
+	else if(upload->mode == FLUID_UPLOAD_INTERLEAVED)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[0]);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(fluid_vertex), vertices);
+		upload->bytes = count * sizeof(fluid_vertex);
+	}
+	else
+	{
+		memcpy(__region(upload, &first), vertices, count * sizeof(fluid_vertex));
+		upload->bytes = count * sizeof(fluid_vertex);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(upload->vao);
+	upload->time = wtime() - t0;
+	return first;
+}
+
+//Call after the draw calls that read this frame's vertices
+void				fluid_upload_end(fluid_upload* upload)
+{
+	glBindVertexArray(0);
+	if(upload->mode != FLUID_UPLOAD_PERSISTENT) { return; }
+	upload->fences[upload->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	upload->region = (upload->region + 1u) % REGIONS;
+}
+
+//Bytes written for the last frame
+uint64_t			fluid_upload_bytes(fluid_upload* upload)
+{
+	return upload->bytes;
+}
+
+//CPU time of the last fluid_upload_begin in seconds, fence waits included
+double				fluid_upload_time(fluid_upload* upload)
+{
+	return upload->time;
+}
+
+const char*			fluid_upload_mode_name(fluid_upload_mode mode)
+{
+	switch(mode)
+	{
+		case FLUID_UPLOAD_SEPARATE:		return "separate";
+		case FLUID_UPLOAD_INTERLEAVED:	return "interleaved";
+		case FLUID_UPLOAD_PERSISTENT:	return "persistent";
+	}
+	return "unknown";
+}
+
+
+
+static bool			__create_separate(fluid_upload* upload)
+{
+	GLsizeiptr count = upload->particle_count;
+	glGenBuffers(3, upload->buffers);
+
+	glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, count * 2u * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[1]);
+	glBufferData(GL_ARRAY_BUFFER, count * 2u * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[2]);
+	glBufferData(GL_ARRAY_BUFFER, count * 3u * sizeof(float), NULL, GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(2);
+	return true;
+}
+
+static bool			__create_packed(fluid_upload* upload, GLsizeiptr size)
+{
+	glGenBuffers(1, upload->buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, upload->buffers[0]);
+	if(upload->mode == FLUID_UPLOAD_PERSISTENT)
+	{
+		//Coherent: writes become visible without explicit flushes, the fences
+		//only keep the CPU from overwriting a region the GPU still reads
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+		upload->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+		if(!upload->mapped) { return false; }
+	}
+	else
+		glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+	__packed_layout();
+	return true;
+}
+
+//Velocity reaches the shader as vec2 and color as vec3 in [0, 1] either way
+static void			__packed_layout(void)
+{
+	GLsizei stride = sizeof(fluid_vertex);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(fluid_vertex, x));
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void*)offsetof(fluid_vertex, vx));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(2, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (void*)offsetof(fluid_vertex, r));
+	glEnableVertexAttribArray(2);
+}
+
+//The next persistent region, once the GPU is done with it; it was last drawn
+//REGIONS frames ago so its fence is normally signaled already
+static fluid_vertex*	__region(fluid_upload* upload, uint32_t* first)
+{
+	uint32_t r = upload->region;
+	if(upload->fences[r])
+	{
+		__wait(upload->fences[r]);
+		glDeleteSync(upload->fences[r]);
+		upload->fences[r] = 0;
+	}
+	*first = r * upload->particle_count;
+	return upload->mapped + r * upload->particle_count;
+}
+
+static void			__unpack(const fluid_vertex* vertices, uint32_t count, float* out)
+{
+	float* pos = out;
+	float* vel = out + 2u * count;
+	float* col = out + 4u * count;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		pos[2 * i + 0] = vertices[i].x;
+		pos[2 * i + 1] = vertices[i].y;
+		vel[2 * i + 0] = f16_to_f32(vertices[i].vx);
+		vel[2 * i + 1] = f16_to_f32(vertices[i].vy);
+		col[3 * i + 0] = vertices[i].r / 255.0f;
+		col[3 * i + 1] = vertices[i].g / 255.0f;
+		col[3 * i + 2] = vertices[i].b / 255.0f;
+	}
+}
+
+static void			__wait(GLsync fence)
+{
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	for(;;)
+	{
+		GLenum status = glClientWaitSync(fence, flags, 1000000000u);
+		if(status != GL_TIMEOUT_EXPIRED) { return; }
+		flags = 0;
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "fluid_sim.h"
+
+//Particle vertex upload for the renderer. SEPARATE is the original path with
+//one float buffer per attribute; INTERLEAVED packs fluid_vertex into a staging
+//array and uploads one buffer; PERSISTENT packs straight into a persistently
+//mapped, triple-buffered region guarded by fences (GL 4.4 or
+//ARB_buffer_storage, otherwise it falls back to INTERLEAVED). All modes feed
+//the same attribute locations: 0 position, 1 velocity, 2 color.
+typedef enum fluid_upload_mode
+{
+	FLUID_UPLOAD_SEPARATE,
+	FLUID_UPLOAD_INTERLEAVED,
+	FLUID_UPLOAD_PERSISTENT
+}fluid_upload_mode;
+
+typedef struct fluid_upload fluid_upload;
+
+fluid_upload*		fluid_upload_create(uint32_t particle_count, fluid_upload_mode mode);
+void				fluid_upload_destroy(fluid_upload* upload);
+fluid_upload_mode	fluid_upload_get_mode(fluid_upload* upload);
+uint32_t			fluid_upload_begin(fluid_upload* upload, fluid_sim* sim);
+uint32_t			fluid_upload_begin_packed(fluid_upload* upload, const fluid_vertex* vertices);
+void				fluid_upload_end(fluid_upload* upload);
+uint64_t			fluid_upload_bytes(fluid_upload* upload);
+double				fluid_upload_time(fluid_upload* upload);
+const char*			fluid_upload_mode_name(fluid_upload_mode mode);
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "fluid_sim.h"
+#include "fluid_dist.h"
+#include "fluid_traj.h"
+#include "simp_prof.h"
+#include "utils.h"
+
+#define MAX_OBSTACLES 16u
+
+static void usage(void);
+
+int main(int argc, char** argv)
+{
+	fluid_sim_params params;
+	fluid_sim_default_params(&params);
+	uint64_t steps = 1000u;
+	double sim_time = 0.0;
+	const char* load_path = NULL;
+	const char* save_path = NULL;
+	bool fork = false;
+	uint32_t save_interval = 0u;
+	const char* traj_path = NULL;
+	uint32_t traj_interval = 1u;
+	uint32_t traj_flags = FLUID_TRAJ_QUANTIZE | FLUID_TRAJ_DELTA;
+	const char* prof_csv = NULL;
+	const char* prof_trace = NULL;
+	fluid_dist_params dist;
+	fluid_dist_default_params(&dist);
+	dist.ranks = 0u;
+	const char* boundary_path = NULL;
+	const char* boundary_save = NULL;
+	uint32_t boundary_res = 256u;
+	float obstacles[3u * MAX_OBSTACLES];
+	uint32_t obstacle_count = 0u;
+
+	for(int a = 1; a < argc; a++)
+	{
+		const char* opt = argv[a];
+		const char* val = a + 1 < argc ? argv[a + 1] : NULL;
+		if(!val) { usage(); return 1; }
+		a++;
+		if(!strcmp(opt, "-steps"))
+			steps = strtoull(val, NULL, 10);
+		else if(!strcmp(opt, "-time"))
+			sim_time = strtod(val, NULL);
+		else if(!strcmp(opt, "-grid"))
+			params.grid_size = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-scene") && !strcmp(val, "block"))
+			params.scene = FLUID_SCENE_BLOCK;
+		else if(!strcmp(opt, "-scene") && !strcmp(val, "dam"))
+			params.scene = FLUID_SCENE_DAM_BREAK;
+		else if(!strcmp(opt, "-scene") && !strcmp(val, "droplets"))
+			params.scene = FLUID_SCENE_DROPLETS;
+		else if(!strcmp(opt, "-seed"))
+			params.seed = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "grid"))
+			params.neighbor_backend = FLUID_NEIGHBOR_GRID;
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "quadtree"))
+			params.neighbor_backend = FLUID_NEIGHBOR_QUADTREE;
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "linear"))
+			params.neighbor_backend = FLUID_NEIGHBOR_LINEAR_QUADTREE;
+		else if(!strcmp(opt, "-backend") && !strcmp(val, "hash"))
+			params.neighbor_backend = FLUID_NEIGHBOR_HASH;
+		else if(!strcmp(opt, "-lists"))
+			params.neighbor_lists = atoi(val) != 0;
+		else if(!strcmp(opt, "-skin"))
+			params.skin = strtof(val, NULL);
+		else if(!strcmp(opt, "-reorder"))
+			params.reorder_interval = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-threads"))
+			params.threads = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-simd") && !strcmp(val, "auto"))
+			params.simd = FLUID_SIMD_AUTO;
+		else if(!strcmp(opt, "-simd") && !strcmp(val, "scalar"))
+			params.simd = FLUID_SIMD_SCALAR;
+		else if(!strcmp(opt, "-simd") && !strcmp(val, "sse"))
+			params.simd = FLUID_SIMD_SSE;
+		else if(!strcmp(opt, "-simd") && !strcmp(val, "avx2"))
+			params.simd = FLUID_SIMD_AVX2;
+		else if(!strcmp(opt, "-kernel") && !strcmp(val, "spiky"))
+			params.kernel = FLUID_KERNEL_SPIKY;
+		else if(!strcmp(opt, "-kernel") && !strcmp(val, "poly6"))
+			params.kernel = FLUID_KERNEL_POLY6;
+		else if(!strcmp(opt, "-kernel") && !strcmp(val, "cubic"))
+			params.kernel = FLUID_KERNEL_CUBIC_SPLINE;
+		else if(!strcmp(opt, "-kernel") && !strcmp(val, "wendland"))
+			params.kernel = FLUID_KERNEL_WENDLAND_C2;
+		else if(!strcmp(opt, "-load") || !strcmp(opt, "-fork"))
+		{
+			load_path = val;
+			fork = !strcmp(opt, "-fork");
+		}
+		else if(!strcmp(opt, "-save"))
+			save_path = val;
+		else if(!strcmp(opt, "-save-every"))
+			save_interval = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-adaptive"))
+			params.adaptive_dt = atoi(val) != 0;
+		else if(!strcmp(opt, "-cfl"))
+			params.cfl_factor = strtof(val, NULL);
+		else if(!strcmp(opt, "-levels"))
+			params.block_levels = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-pairs"))
+			params.pair_forces = atoi(val) != 0;
+		else if(!strcmp(opt, "-dt"))
+			params.dt = strtof(val, NULL);
+		else if(!strcmp(opt, "-solver") && !strcmp(val, "eos"))
+			params.pressure_solver = FLUID_PRESSURE_EOS;
+		else if(!strcmp(opt, "-solver") && !strcmp(val, "pcisph"))
+			params.pressure_solver = FLUID_PRESSURE_PCISPH;
+		else if(!strcmp(opt, "-solver") && !strcmp(val, "pbf"))
+			params.pressure_solver = FLUID_PRESSURE_PBF;
+		else if(!strcmp(opt, "-pressure-tol"))
+			params.pressure_tolerance = strtof(val, NULL);
+		else if(!strcmp(opt, "-pressure-iters"))
+			params.pressure_max_iterations = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-pbf-iters"))
+			params.pbf_iterations = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-pbf-relax"))
+			params.pbf_relaxation = strtof(val, NULL);
+		else if(!strcmp(opt, "-xsph"))
+			params.xsph_viscosity = strtof(val, NULL);
+		else if(!strcmp(opt, "-compact"))
+			params.compact_storage = atoi(val) != 0;
+		else if(!strcmp(opt, "-sleep"))
+			params.sleeping = atoi(val) != 0;
+		else if(!strcmp(opt, "-sleep-velocity"))
+			params.sleep_velocity = strtof(val, NULL);
+		else if(!strcmp(opt, "-sleep-density"))
+			params.sleep_density = strtof(val, NULL);
+		else if(!strcmp(opt, "-sleep-steps"))
+			params.sleep_steps = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-boundary"))
+			boundary_path = val;
+		else if(!strcmp(opt, "-boundary-res"))
+			boundary_res = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-boundary-save"))
+			boundary_save = val;
+		else if(!strcmp(opt, "-obstacle") && obstacle_count < MAX_OBSTACLES &&
+				sscanf(val, "%f,%f,%f", &obstacles[3u * obstacle_count + 0u], &obstacles[3u * obstacle_count + 1u],
+					   &obstacles[3u * obstacle_count + 2u]) == 3)
+			obstacle_count++;
+		else if(!strcmp(opt, "-ranks"))
+			dist.ranks = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-decomp") && !strcmp(val, "slabs"))
+			dist.decomp = FLUID_DECOMP_SLABS;
+		else if(!strcmp(opt, "-decomp") && !strcmp(val, "tiles"))
+			dist.decomp = FLUID_DECOMP_TILES;
+		else if(!strcmp(opt, "-transport") && !strcmp(val, "socket"))
+			dist.transport = SIMP_TRANSPORT_SOCKET;
+		else if(!strcmp(opt, "-transport") && !strcmp(val, "shm"))
+			dist.transport = SIMP_TRANSPORT_SHM;
+		else if(!strcmp(opt, "-traj"))
+			traj_path = val;
+		else if(!strcmp(opt, "-traj-every"))
+			traj_interval = (uint32_t)strtoul(val, NULL, 10);
+		else if(!strcmp(opt, "-traj-quantize"))
+			traj_flags = atoi(val) ? traj_flags | FLUID_TRAJ_QUANTIZE : traj_flags & ~FLUID_TRAJ_QUANTIZE;
+		else if(!strcmp(opt, "-traj-delta"))
+			traj_flags = atoi(val) ? traj_flags | FLUID_TRAJ_DELTA : traj_flags & ~FLUID_TRAJ_DELTA;
+		else if(!strcmp(opt, "-prof-csv"))
+			prof_csv = val;
+		else if(!strcmp(opt, "-prof-trace"))
+			prof_trace = val;
+		else if(!strcmp(opt, "-table"))
+			params.kernel_table_size = (uint32_t)strtoul(val, NULL, 10);
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	//-load resumes with the stored parameters, -fork with the ones given here
+	double t0 = wtime();
+	fluid_sim* sim = load_path ? fluid_sim_load(load_path, fork ? &params : NULL) : fluid_sim_create(&params);
+	if(!sim)
+	{
+		fprintf(stderr, "Failed to create simulation\n");
+		return 1;
+	}
+	if(load_path)
+		printf("loaded %s at step %llu in %.3f ms\n", load_path,
+			(unsigned long long)fluid_sim_steps(sim), (wtime() - t0) * 1e3);
+	if(save_path)
+		fluid_sim_set_snapshot(sim, save_path, save_interval);
+	//-boundary loads a field, -obstacle cuts discs into the walls of the unit square or into the loaded field
+	fluid_sdf* sdf = NULL;
+	if(boundary_path || obstacle_count)
+	{
+		sdf = boundary_path ? fluid_sdf_load(boundary_path) : fluid_sdf_create(boundary_res, boundary_res);
+		for(uint32_t k = 0; sdf && k < obstacle_count; k++)
+			fluid_sdf_add_disc(sdf, obstacles[3u * k + 0u], obstacles[3u * k + 1u], obstacles[3u * k + 2u]);
+		if(!sdf)
+			fprintf(stderr, "Failed to load boundary %s\n", boundary_path);
+		else if(!fluid_sim_set_boundary(sim, sdf))
+			fprintf(stderr, "Boundaries do not combine with pair forces or compact storage\n");
+		if(!fluid_sim_get_boundary(sim))
+		{
+			fluid_sdf_destroy(sdf);
+			fluid_sim_destroy(sim);
+			return 1;
+		}
+		if(boundary_save && !fluid_sdf_save(sdf, boundary_save))
+			fprintf(stderr, "Failed to save %s\n", boundary_save);
+	}
+	params = *fluid_sim_get_params(sim);
+	uint64_t start_step = fluid_sim_steps(sim);
+	double start_time = fluid_sim_time(sim);
+
+	uint32_t particle_count = fluid_sim_count(sim);
+	fluid_traj_writer* traj = NULL;
+	if(traj_path)
+	{
+		if(traj_interval < 1u) { traj_interval = 1u; }
+		traj = fluid_traj_writer_create(traj_path, particle_count,
+			FLUID_TRAJ_POSITION | FLUID_TRAJ_VELOCITY | FLUID_TRAJ_DENSITY, traj_flags, 8u, 32u);
+		if(!traj)
+			fprintf(stderr, "Failed to open %s\n", traj_path);
+	}
+	if((prof_csv || prof_trace) && !simp_prof_enabled())
+		fprintf(stderr, "Built without SIMP_PROF, no profile is written\n");
+	if(prof_csv && simp_prof_enabled() && !simp_prof_open_csv(prof_csv))
+		fprintf(stderr, "Failed to open %s\n", prof_csv);
+	double t1 = wtime();
+	//-ranks runs the whole span in worker processes and gathers once at the end
+	fluid_dist_stats dist_stats;
+	if(dist.ranks)
+	{
+		if(sim_time > 0.0)
+			steps = (uint64_t)ceil(sim_time / fluid_sim_dt(sim));
+		if(!fluid_dist_run(sim, &dist, steps, &dist_stats))
+		{
+			fprintf(stderr, "Distributed run failed; it needs POSIX, the eos solver, a fixed dt and no boundary\n");
+			fluid_sim_destroy(sim);
+			fluid_sdf_destroy(sdf);
+			return 1;
+		}
+	}
+	for(uint64_t s = 0; !dist.ranks && (sim_time > 0.0 ? fluid_sim_time(sim) < start_time + sim_time : s < steps); s++)
+	{
+		fluid_sim_step(sim);
+		simp_prof_step(fluid_sim_steps(sim));
+		if(traj && fluid_sim_steps(sim) % traj_interval == 0u)
+			fluid_traj_writer_push(traj, fluid_sim_steps(sim), fluid_sim_time(sim), fluid_sim_positions(sim),
+				fluid_sim_velocities(sim), fluid_sim_densities(sim), fluid_sim_ids(sim));
+	}
+	steps = fluid_sim_steps(sim) - start_step;
+	double t2 = wtime();
+
+	double elapsed = t2 - t1;
+	const float* dens = fluid_sim_densities(sim);
+	const float* pos = fluid_sim_positions(sim);
+	const uint32_t* ids = fluid_sim_ids(sim);
+	double dens_sum = 0.0, pos_sum = 0.0, id_sum = 0.0;
+	for(uint32_t i = 0; i < particle_count; i++)
+	{
+		dens_sum += dens[i];
+		pos_sum += pos[2 * i + 0] + pos[2 * i + 1];
+		id_sum += ids[i] * (pos[2 * i + 0] + pos[2 * i + 1]);
+	}
+	printf("particles: %u\n", particle_count);
+	if(dist.ranks)
+		printf("ranks: %u %s over %s\n", dist.ranks, fluid_decomp_name(dist.decomp),
+			simp_transport_name(dist.transport));
+	else
+		printf("threads: %u\n", params.threads);
+	printf("kernels: %s %s%s%s\n", fluid_kernel_name(params.kernel),
+		params.pair_forces ? "pairs" : fluid_simd_name(fluid_sim_simd(sim)),
+		params.kernel_table_size ? " tabulated" : "", params.compact_storage ? " compact" : "");
+	if(sdf)
+		printf("boundary: %ux%u sdf, %u obstacles\n", fluid_sdf_cols(sdf), fluid_sdf_rows(sdf), obstacle_count);
+	printf("steps: %llu\n", (unsigned long long)steps);
+	printf("simulated time: %.4f s, last dt %.3g\n", fluid_sim_time(sim), fluid_sim_dt(sim));
+	printf("elapsed: %.3f s\n", elapsed);
+	printf("steps/s: %.1f\n", steps / elapsed);
+	printf("ns/particle/step: %.1f\n", elapsed * 1e9 / ((double)steps * particle_count));
+	printf("mean density: %.3f\n", dens_sum / particle_count);
+	printf("position checksum: %.6f\n", pos_sum);
+	printf("id checksum: %.3f\n", id_sum);
+	fluid_sim_stats stats;
+	fluid_sim_get_stats(sim, &stats);
+	if(params.neighbor_lists)
+		printf("neighbor lists: %llu hits, %llu rebuilds\n",
+			(unsigned long long)stats.nlist_hits, (unsigned long long)stats.nlist_rebuilds);
+	if(dist.ranks && steps)
+		printf("halo: %.1f ghosts/step, %llu migrations, %.2f MB exchanged, %.3f s exchange, %.3f s compute\n",
+			(double)dist_stats.ghosts / steps, (unsigned long long)dist_stats.migrations,
+			dist_stats.bytes / 1048576.0, dist_stats.exchange_time, dist_stats.compute_time);
+	printf("force evaluations: %llu\n", (unsigned long long)stats.force_evaluations);
+	if(params.pressure_solver != FLUID_PRESSURE_EOS && steps)
+		printf("pressure iterations: %.2f per step, last density error %.3f%%\n",
+			(double)stats.pressure_iterations / steps, stats.density_error * 100.0);
+	if(params.sleeping && steps)
+		printf("active particles: %.1f per step, %u in the last step, %llu wakeups\n",
+			(double)stats.active_particle_steps / steps, stats.active_particles, (unsigned long long)stats.wakeups);
+	if(params.reorder_interval)
+		printf("reorders: %llu\n", (unsigned long long)stats.reorders);
+	if(fluid_sim_simd(sim) != FLUID_SIMD_SCALAR)
+		printf("simd error vs scalar: %.3g\n", fluid_sim_simd_error(sim));
+	if(params.compact_storage)
+	{
+		uint32_t flips;
+		double error = fluid_sim_compact_error(sim, &flips);
+		printf("compact error vs float: %.3g, %u surface flags flipped\n", error, flips);
+	}
+
+	if(save_path && !save_interval && !fluid_sim_save(sim, save_path))
+		fprintf(stderr, "Failed to save %s\n", save_path);
+	if(save_path && save_interval)
+		printf("snapshots: %llu written, %llu failed\n",
+			(unsigned long long)stats.snapshots, (unsigned long long)stats.snapshot_failures);
+	if(traj)
+	{
+		fluid_traj_writer_flush(traj);
+		printf("trajectory: %llu frames, %llu dropped, %.2f MB\n", (unsigned long long)fluid_traj_writer_frames(traj),
+			(unsigned long long)fluid_traj_writer_dropped(traj), fluid_traj_writer_bytes(traj) / 1048576.0);
+		fluid_traj_writer_destroy(traj);
+	}
+	if(prof_trace && simp_prof_enabled() && !simp_prof_write_trace(prof_trace))
+		fprintf(stderr, "Failed to write %s\n", prof_trace);
+	simp_prof_close();
+
+	fluid_sim_destroy(sim);
+	fluid_sdf_destroy(sdf);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"usage: headless [-steps N | -time T] [-grid N] [-scene block|dam|droplets] [-seed N]\n"
+		"                [-backend grid|quadtree|linear|hash] [-lists 0|1] [-skin F]\n"
+		"                [-reorder K] [-threads N] [-simd auto|scalar|sse|avx2]\n"
+		"                [-kernel spiky|poly6|cubic|wendland] [-table N] [-pairs 0|1]\n"
+		"                [-dt F] [-adaptive 0|1] [-cfl F] [-levels N]\n"
+		"                [-solver eos|pcisph|pbf] [-pressure-tol F] [-pressure-iters N]\n"
+		"                [-pbf-iters N] [-pbf-relax F] [-xsph F]\n"
+		"                [-compact 0|1] [-sleep 0|1] [-sleep-velocity F] [-sleep-density F] [-sleep-steps N]\n"
+		"                [-boundary PATH] [-boundary-res N] [-obstacle X,Y,R] [-boundary-save PATH]\n"
+		"                [-ranks N] [-decomp slabs|tiles] [-transport socket|shm]\n"
+		"                [-load PATH | -fork PATH] [-save PATH] [-save-every N]\n"
+		"                [-traj PATH] [-traj-every N] [-traj-quantize 0|1] [-traj-delta 0|1]\n"
+		"                [-prof-csv PATH] [-prof-trace PATH]\n");
+}
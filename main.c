@@ -10,8 +10,10 @@
 #include "simp_GLerror.h"
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
-#include "simp_quadtree.h"
-#include "fluid.h"
+#include "fluid_sim.h"
+#include "fluid_upload.h"
+#include "fluid_async.h"
+#include "simp_prof.h"
 #include "utils.h"
 
 #define WIDTH 900
@@ -21,6 +23,18 @@
 static GLuint build_program(char* vertex_src, char* fragment_src);
 static char* read_file(const char* file);
 static void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
+static void cursor_callback(GLFWwindow* window, double x, double y);
+static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods);
+static void send_mouse(GLFWwindow* window);
+
+//Mouse state built from the GLFW callbacks and forwarded to whoever owns the simulation
+typedef struct input
+{
+	fluid_sim* sim;
+	fluid_async* async;
+	float x, y;
+	int buttons;
+}input;
 
 int main(void)
 {
@@ -53,73 +67,39 @@ int main(void)
 	rad_loc = glGetUniformLocation(program, "rad");
 	render_flag_loc = glGetUniformLocation(program, "render_flag");
 
-	//Particle data initialization
-	uint32_t grid_size = 30u;
-	uint32_t particle_count = grid_size * grid_size;
-	float radius = 0.004f;
-	float damp_factor = 0.98f;
-	float rest_density = 5000.0f;
-	float stiffness_constant = 5.0f;
-	float surface_coefficient = 50.0f;
-	float viscosity_coefficient = 50.0f;
-	float* particle_cpos = malloc(particle_count * 2u * sizeof *particle_cpos);
-	float* particle_ppos = malloc(particle_count * 2u * sizeof *particle_ppos);
-	float* particle_velo = malloc(particle_count * 2u * sizeof *particle_velo);
-	float* particle_dens = malloc(particle_count * 1u * sizeof *particle_dens);
-	float* particle_pred = malloc(particle_count * 2u * sizeof *particle_pred);
-	float* particle_colo = malloc(particle_count * 3u * sizeof *particle_colo);
-	for(int i = 0; i < particle_count; i++)
-	{
-		int i1 = i % grid_size;
-		int i2 = (i - i1) / grid_size;
-		particle_cpos[2 * i + 0] = particle_ppos[2 * i + 0] = 0.3f + 0.4f * ((float)i1 + 0.5f) / grid_size;
-		particle_cpos[2 * i + 1] = particle_ppos[2 * i + 1] = 0.3f + 0.4f * ((float)i2 + 0.5f) / grid_size;
-		//particle_cpos[2 * i + 0] = particle_ppos[2 * i + 0] = frand(0.1, 0.9);
-        //particle_cpos[2 * i + 1] = particle_ppos[2 * i + 1] = frand(0.1, 0.9);
-
-		particle_velo[2 * i + 0] = 0.0f;
-		particle_velo[2 * i + 1] = 0.0f;
-
-		particle_colo[3 * i + 0] = 1.0f;
-		particle_colo[3 * i + 1] = 1.0f;
-		particle_colo[3 * i + 2] = 1.0f;
-	}
-
-	//OpenGL buffer creation
-	GLuint VAO, particle_pos_AB, particle_vel_AB, particle_col_AB;
-	GL(glGenVertexArrays(1, &VAO));
-	GL(glGenBuffers(1, &particle_pos_AB));
-	GL(glGenBuffers(1, &particle_vel_AB));
-	GL(glGenBuffers(1, &particle_col_AB));
-
-	GL(glBindVertexArray(VAO));
-
-	GL(glBindBuffer(GL_ARRAY_BUFFER, particle_pos_AB));
-	GL(glBufferData(GL_ARRAY_BUFFER, particle_count * 2u * sizeof(float), NULL, GL_DYNAMIC_DRAW));
-	GL(glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0));
-	GL(glEnableVertexAttribArray(0));
-
-	GL(glBindBuffer(GL_ARRAY_BUFFER, particle_vel_AB));
-	GL(glBufferData(GL_ARRAY_BUFFER, particle_count * 2u * sizeof(float), NULL, GL_DYNAMIC_DRAW));
-	GL(glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0));
-	GL(glEnableVertexAttribArray(1));
-
-	GL(glBindBuffer(GL_ARRAY_BUFFER, particle_col_AB));
-	GL(glBufferData(GL_ARRAY_BUFFER, particle_count * 3u * sizeof(float), NULL, GL_DYNAMIC_DRAW));
-	GL(glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0));
-	GL(glEnableVertexAttribArray(2));
-
-	GL(glBindVertexArray(0));
+	//Simulation creation
+	fluid_sim_params params;
+	fluid_sim_default_params(&params);
+	fluid_sim* sim = fluid_sim_create(&params);
+	if(!sim){ glfwTerminate(); exit(1); }
+	uint32_t particle_count = fluid_sim_count(sim);
+	float radius = params.radius;
+
+	//Instrumented builds write a per-step summary and a trace on exit
+	if(simp_prof_enabled())
+		simp_prof_open_csv("prof.csv");
+
+	//The simulation runs on its own thread unless P switches back to stepping once per frame
+	input mouse = { sim, fluid_async_create(sim), 0.0f, 0.0f, 0 };
+	glfwSetWindowUserPointer(window, &mouse);
+	glfwSetCursorPosCallback(window, cursor_callback);
+	glfwSetMouseButtonCallback(window, mouse_button_callback);
+	int async_key_flag = 0;
+	uint64_t title_steps = fluid_sim_steps(sim);
+
+	//OpenGL buffer creation, U cycles through the upload modes
+	fluid_upload* upload = fluid_upload_create(particle_count, FLUID_UPLOAD_PERSISTENT);
+	if(!upload){ glfwTerminate(); exit(1); }
+	int upload_key_flag = 0;
 
 	//Time variables
-	double t1, t2, dt = 1e-6, _dt = 1.0f / 220.0f;
+	double t1, t2, dt = 1e-6;
 
-	//Simulation settings
-	float gravity = -1e1;
+	//Render settings
 	int render_flag = 0;
 
 	//Framerate approximation variables
-	char fps_str[32] = { 0 };
+	char fps_str[128] = { 0 };
 	float time_accum = 0.0f;
 	size_t frame_count = 1u;
 
@@ -136,139 +116,101 @@ int main(void)
 		glfwGetFramebufferSize(window, &width, &height);
 		glViewport(0, 0, width, height);
 		float ratio = (float)width / (float)height;
-		double mouse_x, mouse_y;
-		glfwGetCursorPos(window, &mouse_x, &mouse_y);
-		double screen_x = (mouse_x / width);
-		double screen_y = 1.0 - (mouse_y / height);
-
-		dt = _dt;
-		simp_quadtree* qtree = simp_quadtree_create(0.0f, 0.0f, 1.0f, 1.0f, 4u);
-		for(int i = 0; i < particle_count; i++)
+		if(!mouse.async)
+			fluid_sim_step(sim);
+
+		key_state = glfwGetKey(window, GLFW_KEY_TAB);
+		if(key_state == GLFW_PRESS && !key_hold_flag)
 		{
-			float fixed_step = 1.1666667f * dt;
-			particle_pred[2 * i + 0] = particle_cpos[2 * i + 0] + particle_velo[2 * i + 0] * fixed_step;
-			particle_pred[2 * i + 1] = particle_cpos[2 * i + 1] + particle_velo[2 * i + 1] * fixed_step;
-			simp_quadtree_insert(qtree, particle_cpos[2 * i + 0], particle_cpos[2 * i + 1], i);
+			render_flag = 1 - render_flag;
+			key_hold_flag = 1;
 		}
-
-		for(int i = 0; i < particle_count; i++)
-			particle_dens[i] = sample_density(i, qtree, particle_pred, 5e-2);
-
-		for(int i = 0; i < particle_count; i++)
+		if(key_state == GLFW_RELEASE)
 		{
-			//Fetch position data
-			float px = particle_cpos[2 * i + 0];
-			float py = particle_cpos[2 * i + 1];
-			float vx = particle_velo[2 * i + 0];
-			float vy = particle_velo[2 * i + 1];
-
-			//Save previous location
-			particle_ppos[2 * i + 0] = px;
-			particle_ppos[2 * i + 1] = py;
-
-			//Gravity
-			vy += gravity * dt;
-
-			//Fluid acceleration
-			float fluid_ax, fluid_ay;
-			fluid_accel(i, qtree, particle_pred, particle_velo, particle_dens, particle_colo, 5e-2,
-					rest_density, stiffness_constant, surface_coefficient, 
-					viscosity_coefficient, &fluid_ax, &fluid_ay);
-
-			vx += fluid_ax * dt;
-			vy += fluid_ay * dt;
-
-			key_state = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT);
-			if(key_state == GLFW_PRESS)
-			{
-				float dx = screen_x - px;
-				float dy = screen_y - py;
-				float dd = dot(dx, dy, dx, dy);
-				if(dd < 4e-2)
-				{
-					vx += (dx * 5e2 - 1e1 * vx)* dt;
-					vy += (dy * 5e2 - 1e1 * vy)* dt;
-				}
-			}
-
-			key_state = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT);
-			if(key_state == GLFW_PRESS)
-			{
-				float dx = screen_x - px;
-				float dy = screen_y - py;
-				float dd = dot(dx, dy, dx, dy);
-				if(dd < 4e-2)
-				{
-					vx -= dx * 5e2 * dt;
-					vy -= dy * 5e2 * dt;
-				}
-			}
-
-			//Clamp velocity to 0 if too small
-			vx = (fabs(vx) > 1e-6) * vx;
-			vy = (fabs(vy) > 1e-6) * vy;
-
-			px += vx * dt;
-			py += vy * dt;
+			key_hold_flag = 0;
+		}
 
-			//Boundary collision resolution
-			if(px - radius < 0.0f || px + radius > 1.0f)
-			{
-				px = fclamp(px, radius, 1.0f - radius);
-				vx -= 2.0f * damp_factor * vx;
-			}
-			if(py - radius < 0.0f || py + radius > 1.0f)
+		key_state = glfwGetKey(window, GLFW_KEY_U);
+		if(key_state == GLFW_PRESS && !upload_key_flag)
+		{
+			fluid_upload_mode mode = (fluid_upload_get_mode(upload) + 1) % 3;
+			fluid_upload* next = fluid_upload_create(particle_count, mode);
+			if(next)
 			{
-				py = fclamp(py, radius, 1.0f - radius);
-				vy -= 2.0f * damp_factor * vy;
+				fluid_upload_destroy(upload);
+				upload = next;
 			}
-
-			particle_cpos[2 * i + 0] = px;
-			particle_cpos[2 * i + 1] = py;
-			particle_velo[2 * i + 0] = vx;
-			particle_velo[2 * i + 1] = vy;
+			upload_key_flag = 1;
+		}
+		if(key_state == GLFW_RELEASE)
+		{
+			upload_key_flag = 0;
 		}
-		simp_quadtree_destroy(qtree);
 
-		key_state = glfwGetKey(window, GLFW_KEY_TAB);
-		if(key_state == GLFW_PRESS && !key_hold_flag)
+		key_state = glfwGetKey(window, GLFW_KEY_P);
+		if(key_state == GLFW_PRESS && !async_key_flag)
 		{
-			render_flag = 1 - render_flag;
-			key_hold_flag = 1;
+			if(mouse.async)
+			{
+				fluid_async_destroy(mouse.async);
+				mouse.async = NULL;
+			}
+			else
+				mouse.async = fluid_async_create(sim);
+			async_key_flag = 1;
 		}
 		if(key_state == GLFW_RELEASE)
 		{
-			key_hold_flag = 0;
+			async_key_flag = 0;
 		}
 
 
 		//Particle rendering
 		GL(glUseProgram(program));
-		GL(glBindVertexArray(VAO));
-
-		GL(glBindBuffer(GL_ARRAY_BUFFER, particle_pos_AB));
-		GL(glBufferSubData(GL_ARRAY_BUFFER, 0, particle_count * 2u * sizeof(float), (void*)particle_cpos));
 
-		GL(glBindBuffer(GL_ARRAY_BUFFER, particle_vel_AB));
-		GL(glBufferSubData(GL_ARRAY_BUFFER, 0, particle_count * 2u * sizeof(float), (void*)particle_velo));
-
-		GL(glBindBuffer(GL_ARRAY_BUFFER, particle_col_AB));
-		GL(glBufferSubData(GL_ARRAY_BUFFER, 0, particle_count * 3u * sizeof(float), (void*)particle_colo));
+		uint32_t first_vertex;
+		uint64_t steps;
+		{
+			SIMP_PROF_SCOPE("upload");
+			if(mouse.async)
+			{
+				fluid_frame frame;
+				fluid_async_frame(mouse.async, &frame);
+				first_vertex = fluid_upload_begin_packed(upload, frame.vertices);
+				steps = frame.step;
+			}
+			else
+			{
+				first_vertex = fluid_upload_begin(upload, sim);
+				steps = fluid_sim_steps(sim);
+			}
+		}
 
 		GL(glUniform2f(window_info_loc, width, height));
 		GL(glUniform1f(rad_loc, radius));
 		GL(glUniform1i(render_flag_loc, render_flag));
 
-		GL(glDrawArrays(GL_POINTS, 0, particle_count));
+		GL(glDrawArrays(GL_POINTS, first_vertex, particle_count));
+		fluid_upload_end(upload);
 
 		glfwPollEvents();
-		glfwSwapBuffers(window);
+		{
+			SIMP_PROF_SCOPE("swap");
+			glfwSwapBuffers(window);
+		}
+		//The rings may only be summarized while no other thread records into them
+		if(!mouse.async)
+			simp_prof_step(steps);
 
 		t2 = glfwGetTime();
 		dt = t2 - t1;
 		if(time_accum >= 0.1f)
 		{
-			sprintf(fps_str, "Willy Wonka |  %.0f  fps |", (float)frame_count / time_accum);
+			sprintf(fps_str, "Willy Wonka |  %.0f  fps | %.0f steps/s %s | %s upload %.1f KB %.3f ms |",
+				(float)frame_count / time_accum, (steps - title_steps) / time_accum, mouse.async ? "threaded" : "serial",
+				fluid_upload_mode_name(fluid_upload_get_mode(upload)), fluid_upload_bytes(upload) / 1024.0,
+				fluid_upload_time(upload) * 1e3);
+			title_steps = steps;
 			glfwSetWindowTitle(window, fps_str);
 			time_accum = 0.0f;
 			frame_count = 1u;
@@ -278,17 +220,13 @@ int main(void)
 	}
 
 	//Cleanup
-	free(particle_cpos);
-	free(particle_ppos);
-	free(particle_velo);
-	free(particle_dens);
-	free(particle_pred);
-	free(particle_colo);
-
-	GL(glDeleteVertexArrays(1, &VAO));
-	GL(glDeleteBuffers(1, &particle_pos_AB));
-	GL(glDeleteBuffers(1, &particle_vel_AB));
-	GL(glDeleteBuffers(1, &particle_col_AB));
+	fluid_async_destroy(mouse.async);
+	if(simp_prof_enabled())
+		simp_prof_write_trace("trace.json");
+	simp_prof_close();
+	fluid_sim_destroy(sim);
+
+	fluid_upload_destroy(upload);
 
 	glfwTerminate();
 	return 0x45;
@@ -300,6 +238,41 @@ static void key_callback(GLFWwindow* window, int key, int scancode, int action,
 	    glfwSetWindowShouldClose(window, true);
 }
 
+static void cursor_callback(GLFWwindow* window, double x, double y)
+{
+	input* in = glfwGetWindowUserPointer(window);
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	if(width <= 0 || height <= 0) { return; }
+	in->x = x / width;
+	in->y = 1.0 - y / height;
+	send_mouse(window);
+}
+
+static void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
+{
+	input* in = glfwGetWindowUserPointer(window);
+	int bit = button == GLFW_MOUSE_BUTTON_LEFT ? FLUID_MOUSE_LEFT : button == GLFW_MOUSE_BUTTON_RIGHT ? FLUID_MOUSE_RIGHT : 0;
+	if(action == GLFW_PRESS)
+		in->buttons |= bit;
+	else if(action == GLFW_RELEASE)
+		in->buttons &= ~bit;
+	send_mouse(window);
+}
+
+//A full queue drops the update; the next cursor event carries the whole state again
+static void send_mouse(GLFWwindow* window)
+{
+	input* in = glfwGetWindowUserPointer(window);
+	if(in->async)
+	{
+		fluid_command command = { FLUID_COMMAND_MOUSE, in->x, in->y, in->buttons };
+		fluid_async_send(in->async, &command);
+	}
+	else
+		fluid_sim_set_mouse(in->sim, in->x, in->y, in->buttons);
+}
+
 static GLuint build_program(char* vertex_src, char* fragment_src)
 {
 	GLuint program;
@@ -0,0 +1,152 @@
+#include "simp_grid.h"
+#include "simp_prof.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct simp_grid
+{
+	float x0, y0, x1, y1;
+	float cell_size, cell_size_inv;
+	uint32_t width, height;
+	uint32_t count, capacity;
+	//Per cell: offset of the first particle in index and number of particles
+	uint32_t* cell_start;
+	uint32_t* cell_count;
+	//Particle indices sorted by cell, and the cell of every particle
+	uint32_t* index;
+	uint32_t* particle_cell;
+}simp_grid;
+
+static uint32_t		__cell_coord(float t, float t0, float cell_size_inv, uint32_t n);
+static bool			__reserve(uint32_t** buf, uint32_t* capacity, uint32_t size);
+
+simp_grid*			simp_grid_create(float x0, float y0, float x1, float y1, float cell_size)
+{
+	simp_grid* grid = calloc(1u, sizeof *grid);
+	if(!grid) { return NULL; }
+	grid->x0 = x0;
+	grid->y0 = y0;
+	grid->x1 = x1;
+	grid->y1 = y1;
+	grid->cell_size = cell_size;
+	grid->cell_size_inv = 1.0f / cell_size;
+	grid->width = (uint32_t)((x1 - x0) * grid->cell_size_inv) + 1u;
+	grid->height = (uint32_t)((y1 - y0) * grid->cell_size_inv) + 1u;
+
+	uint32_t cells = grid->width * grid->height;
+	grid->cell_start = malloc(cells * sizeof *grid->cell_start);
+	grid->cell_count = malloc(cells * sizeof *grid->cell_count);
+	if(!grid->cell_start || !grid->cell_count)
+	{
+		simp_grid_destroy(grid);
+		return NULL;
+	}
+	memset(grid->cell_start, 0, cells * sizeof *grid->cell_start);
+	memset(grid->cell_count, 0, cells * sizeof *grid->cell_count);
+	return grid;
+}
+
+void				simp_grid_destroy(simp_grid* grid)
+{
+	if(!grid) { return; }
+	free(grid->cell_start);
+	free(grid->cell_count);
+	free(grid->index);
+	free(grid->particle_cell);
+	free(grid);
+}
+
+bool				simp_grid_build(simp_grid* grid, const float* pos, uint32_t count)
+{
+	SIMP_PROF_SCOPE("simp_grid_build");
+	if(count > grid->capacity)
+	{
+		uint32_t* index = realloc(grid->index, count * sizeof *index);
+		if(!index) { return false; }
+		grid->index = index;
+		uint32_t* particle_cell = realloc(grid->particle_cell, count * sizeof *particle_cell);
+		if(!particle_cell) { return false; }
+		grid->particle_cell = particle_cell;
+		grid->capacity = count;
+	}
+	grid->count = count;
+
+	uint32_t cells = grid->width * grid->height;
+	memset(grid->cell_count, 0, cells * sizeof *grid->cell_count);
+
+	//Counting sort: histogram, exclusive prefix sum, scatter
+	for(uint32_t i = 0; i < count; i++)
+	{
+		uint32_t cx = __cell_coord(pos[2 * i + 0], grid->x0, grid->cell_size_inv, grid->width);
+		uint32_t cy = __cell_coord(pos[2 * i + 1], grid->y0, grid->cell_size_inv, grid->height);
+		uint32_t c = cy * grid->width + cx;
+		grid->particle_cell[i] = c;
+		grid->cell_count[c]++;
+	}
+
+	uint32_t offset = 0u;
+	for(uint32_t c = 0; c < cells; c++)
+	{
+		grid->cell_start[c] = offset;
+		offset += grid->cell_count[c];
+	}
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		uint32_t c = grid->particle_cell[i];
+		grid->index[grid->cell_start[c]++] = i;
+	}
+
+	//The scatter advanced every start to the end of its cell
+	for(uint32_t c = 0; c < cells; c++)
+		grid->cell_start[c] -= grid->cell_count[c];
+	return true;
+}
+
+uint32_t			simp_grid_query(simp_grid* grid, float x0, float y0, float x1, float y1,
+									uint32_t** buf, uint32_t* capacity)
+{
+	uint32_t cx0 = __cell_coord(x0, grid->x0, grid->cell_size_inv, grid->width);
+	uint32_t cy0 = __cell_coord(y0, grid->y0, grid->cell_size_inv, grid->height);
+	uint32_t cx1 = __cell_coord(x1, grid->x0, grid->cell_size_inv, grid->width);
+	uint32_t cy1 = __cell_coord(y1, grid->y0, grid->cell_size_inv, grid->height);
+
+	uint32_t size = 0u;
+	for(uint32_t cy = cy0; cy <= cy1; cy++)
+	{
+		//Cells of one row are adjacent in the sorted index, so each row is one range
+		uint32_t first = cy * grid->width + cx0;
+		uint32_t last = cy * grid->width + cx1;
+		uint32_t start = grid->cell_start[first];
+		uint32_t n = grid->cell_start[last] + grid->cell_count[last] - start;
+		if(n == 0u) { continue; }
+		if(!__reserve(buf, capacity, size + n)) { return size; }
+		memcpy(*buf + size, grid->index + start, n * sizeof **buf);
+		size += n;
+	}
+	return size;
+}
+
+
+
+static uint32_t		__cell_coord(float t, float t0, float cell_size_inv, uint32_t n)
+{
+	float c = (t - t0) * cell_size_inv;
+	if(c < 0.0f) { return 0u; }
+	if(c >= (float)n) { return n - 1u; }
+	return (uint32_t)c;
+}
+
+static bool			__reserve(uint32_t** buf, uint32_t* capacity, uint32_t size)
+{
+	if(size <= *capacity) { return true; }
+	uint32_t new_capacity = *capacity ? *capacity : 64u;
+	while(new_capacity < size)
+		new_capacity *= 2u;
+	uint32_t* p = realloc(*buf, new_capacity * sizeof *p);
+	if(!p) { return false; }
+	SIMP_PROF_COUNT(SIMP_PROF_ALLOCATIONS, 1u);
+	*buf = p;
+	*capacity = new_capacity;
+	return true;
+}
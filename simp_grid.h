@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct simp_grid simp_grid;
+
+simp_grid*			simp_grid_create(float x0, float y0, float x1, float y1, float cell_size);
+void				simp_grid_destroy(simp_grid* grid);
+bool				simp_grid_build(simp_grid* grid, const float* pos, uint32_t count);
+uint32_t			simp_grid_query(simp_grid* grid, float x0, float y0, float x1, float y1,
+									uint32_t** buf, uint32_t* capacity);
@@ -0,0 +1,234 @@
+#include "simp_hash.h"
+#include "simp_prof.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//Cell coordinates are clamped to +-2^30 so that far away or invalid
+//positions still land in some cell
+#define CELL_LIMIT	1073741824.0f
+#define MIN_SLOTS	64u
+
+typedef struct slot slot;
+
+//An occupied cell: its packed coordinates and its range in index; count 0 marks a free slot
+struct slot
+{
+	uint64_t key;
+	uint32_t start;
+	uint32_t count;
+};
+
+struct simp_hash
+{
+	float cell_size_inv;
+	uint32_t count, capacity;
+	uint32_t cells;
+	uint32_t slot_count;
+	slot* slots;
+	//Particle indices sorted by cell, and the slot of every particle
+	uint32_t* index;
+	uint32_t* particle_slot;
+};
+
+static int32_t		__cell_coord(float t, float cell_size_inv);
+static uint64_t		__key(int32_t cx, int32_t cy);
+static uint32_t		__find(const slot* slots, uint32_t slot_count, uint64_t key);
+static bool			__resize(simp_hash* hash, uint32_t slot_count);
+static bool			__append(uint32_t** buf, uint32_t* capacity, uint32_t size, const uint32_t* data, uint32_t n);
+
+simp_hash*			simp_hash_create(float cell_size)
+{
+	simp_hash* hash = calloc(1u, sizeof *hash);
+	if(!hash) { return NULL; }
+	hash->cell_size_inv = 1.0f / cell_size;
+	hash->slot_count = MIN_SLOTS;
+	hash->slots = calloc(MIN_SLOTS, sizeof *hash->slots);
+	if(!hash->slots)
+	{
+		simp_hash_destroy(hash);
+		return NULL;
+	}
+	return hash;
+}
+
+void				simp_hash_destroy(simp_hash* hash)
+{
+	if(!hash) { return; }
+	free(hash->slots);
+	free(hash->index);
+	free(hash->particle_slot);
+	free(hash);
+}
+
+bool				simp_hash_build(simp_hash* hash, const float* pos, uint32_t count)
+{
+	SIMP_PROF_SCOPE("simp_hash_build");
+	if(count > hash->capacity)
+	{
+		uint32_t* index = realloc(hash->index, count * sizeof *index);
+		if(!index) { return false; }
+		hash->index = index;
+		uint32_t* particle_slot = realloc(hash->particle_slot, count * sizeof *particle_slot);
+		if(!particle_slot) { return false; }
+		hash->particle_slot = particle_slot;
+		hash->capacity = count;
+	}
+	hash->count = count;
+	hash->cells = 0u;
+	memset(hash->slots, 0, hash->slot_count * sizeof *hash->slots);
+
+	//Histogram into the table, doubling it past half full; growing moves the
+	//slots, so the particles look theirs up again afterwards
+	bool moved = false;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		uint64_t key = __key(__cell_coord(pos[2 * i + 0], hash->cell_size_inv),
+							 __cell_coord(pos[2 * i + 1], hash->cell_size_inv));
+		uint32_t s = __find(hash->slots, hash->slot_count, key);
+		if(!hash->slots[s].count)
+		{
+			if(2u * (hash->cells + 1u) > hash->slot_count)
+			{
+				if(!__resize(hash, 2u * hash->slot_count)) { return false; }
+				moved = true;
+				s = __find(hash->slots, hash->slot_count, key);
+			}
+			hash->slots[s].key = key;
+			hash->cells++;
+		}
+		hash->slots[s].count++;
+		hash->particle_slot[i] = s;
+	}
+	if(moved)
+		for(uint32_t i = 0; i < count; i++)
+		{
+			uint64_t key = __key(__cell_coord(pos[2 * i + 0], hash->cell_size_inv),
+								 __cell_coord(pos[2 * i + 1], hash->cell_size_inv));
+			hash->particle_slot[i] = __find(hash->slots, hash->slot_count, key);
+		}
+
+	//Exclusive prefix sum in slot order, scatter, then rewind the starts
+	uint32_t offset = 0u;
+	for(uint32_t s = 0; s < hash->slot_count; s++)
+	{
+		hash->slots[s].start = offset;
+		offset += hash->slots[s].count;
+	}
+	for(uint32_t i = 0; i < count; i++)
+		hash->index[hash->slots[hash->particle_slot[i]].start++] = i;
+	for(uint32_t s = 0; s < hash->slot_count; s++)
+		hash->slots[s].start -= hash->slots[s].count;
+
+	//Give memory back once the fluid has gathered again; the ranges move with their slots
+	if(hash->slot_count > MIN_SLOTS && 8u * hash->cells < hash->slot_count)
+	{
+		uint32_t slot_count = MIN_SLOTS;
+		while(slot_count < 4u * hash->cells)
+			slot_count *= 2u;
+		__resize(hash, slot_count);
+	}
+	return true;
+}
+
+uint32_t			simp_hash_query(simp_hash* hash, float x0, float y0, float x1, float y1,
+									uint32_t** buf, uint32_t* capacity)
+{
+	int32_t cx0 = __cell_coord(x0, hash->cell_size_inv);
+	int32_t cy0 = __cell_coord(y0, hash->cell_size_inv);
+	int32_t cx1 = __cell_coord(x1, hash->cell_size_inv);
+	int32_t cy1 = __cell_coord(y1, hash->cell_size_inv);
+	if(cx1 < cx0 || cy1 < cy0) { return 0u; }
+
+	uint32_t size = 0u;
+	uint64_t area = (uint64_t)(cx1 - cx0 + 1) * (uint64_t)(cy1 - cy0 + 1);
+	if(area > hash->cells)
+	{
+		//A box over more cells than are occupied is cheaper to answer from the table
+		for(uint32_t s = 0; s < hash->slot_count; s++)
+		{
+			const slot* sl = &hash->slots[s];
+			if(!sl->count) { continue; }
+			int32_t cx = (int32_t)(uint32_t)(sl->key >> 32);
+			int32_t cy = (int32_t)(uint32_t)sl->key;
+			if(cx < cx0 || cx > cx1 || cy < cy0 || cy > cy1) { continue; }
+			if(!__append(buf, capacity, size, hash->index + sl->start, sl->count)) { return size; }
+			size += sl->count;
+		}
+		return size;
+	}
+
+	for(int32_t cy = cy0; cy <= cy1; cy++)
+		for(int32_t cx = cx0; cx <= cx1; cx++)
+		{
+			const slot* sl = &hash->slots[__find(hash->slots, hash->slot_count, __key(cx, cy))];
+			if(!sl->count) { continue; }
+			if(!__append(buf, capacity, size, hash->index + sl->start, sl->count)) { return size; }
+			size += sl->count;
+		}
+	return size;
+}
+
+//Occupied cells after the last build
+uint32_t			simp_hash_cells(simp_hash* hash)
+{
+	return hash->cells;
+}
+
+
+
+static int32_t		__cell_coord(float t, float cell_size_inv)
+{
+	float c = floorf(t * cell_size_inv);
+	//Written so that NaN takes the lower bound
+	if(!(c > -CELL_LIMIT)) { return -(int32_t)CELL_LIMIT; }
+	if(c > CELL_LIMIT) { return (int32_t)CELL_LIMIT; }
+	return (int32_t)c;
+}
+
+static uint64_t		__key(int32_t cx, int32_t cy)
+{
+	return (uint64_t)(uint32_t)cx << 32 | (uint32_t)cy;
+}
+
+//Linear probing from a Fibonacci hash of the key; returns the slot holding
+//key or the free slot where it belongs
+static uint32_t		__find(const slot* slots, uint32_t slot_count, uint64_t key)
+{
+	uint32_t mask = slot_count - 1u;
+	uint32_t s = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+	while(slots[s].count && slots[s].key != key)
+		s = (s + 1u) & mask;
+	return s;
+}
+
+static bool			__resize(simp_hash* hash, uint32_t slot_count)
+{
+	slot* slots = calloc(slot_count, sizeof *slots);
+	if(!slots) { return false; }
+	SIMP_PROF_COUNT(SIMP_PROF_ALLOCATIONS, 1u);
+	for(uint32_t s = 0; s < hash->slot_count; s++)
+		if(hash->slots[s].count)
+			slots[__find(slots, slot_count, hash->slots[s].key)] = hash->slots[s];
+	free(hash->slots);
+	hash->slots = slots;
+	hash->slot_count = slot_count;
+	return true;
+}
+
+static bool			__append(uint32_t** buf, uint32_t* capacity, uint32_t size, const uint32_t* data, uint32_t n)
+{
+	if(size + n > *capacity)
+	{
+		uint32_t new_capacity = *capacity ? *capacity : 64u;
+		while(new_capacity < size + n)
+			new_capacity *= 2u;
+		uint32_t* p = realloc(*buf, new_capacity * sizeof *p);
+		if(!p) { return false; }
+		SIMP_PROF_COUNT(SIMP_PROF_ALLOCATIONS, 1u);
+		*buf = p;
+		*capacity = new_capacity;
+	}
+	memcpy(*buf + size, data, n * sizeof **buf);
+	return true;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+//Uniform grid over the whole plane: occupied cells are found by their integer
+//coordinates in an open addressing table, and the particles of each cell are
+//one flat range of a sorted index, as in simp_grid. Memory follows the
+//number of occupied cells instead of the area, and no particle is dropped
+//wherever it goes.
+typedef struct simp_hash simp_hash;
+
+simp_hash*			simp_hash_create(float cell_size);
+void				simp_hash_destroy(simp_hash* hash);
+bool				simp_hash_build(simp_hash* hash, const float* pos, uint32_t count);
+uint32_t			simp_hash_query(simp_hash* hash, float x0, float y0, float x1, float y1,
+									uint32_t** buf, uint32_t* capacity);
+uint32_t			simp_hash_cells(simp_hash* hash);
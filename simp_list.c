@@ -1,4 +1,5 @@
 #include "simp_list.h"
+#include "simp_prof.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -26,8 +27,9 @@ static node*								__create_node(void* entry, size_t bentry_size);
 
 simp_list*									simp_list_create(size_t bentry_size)
 {
+	if(bentry_size == 0u) { return NULL; }
 	simp_list* list = malloc(sizeof *list);
-	if(!list || bentry_size == 0u) { return NULL; }
+	if(!list) { return NULL; }
 	list->head = list->tail = NULL;
 	list->size = 0u;
 	list->bentry_size = bentry_size;
@@ -36,7 +38,7 @@ simp_list*									simp_list_create(size_t bentry_size)
 
 void										simp_list_destroy(simp_list* list)
 {
-	if(list->size == 0u) { return; }
+	if(!list) { return; }
 	node* curr_node = list->head, *next_node;
 	while(curr_node)
 	{
@@ -95,7 +97,7 @@ bool										simp_list_tail(simp_list* list, void* entry)
 
 void										simp_list_pop_head(simp_list* list)
 {
-	if(list->size == 0u) { return; }
+	if(!list || list->size == 0u) { return; }
 	node* curr_node = list->head;
 	list->head = list->head->next;
 	list->head->prev = NULL;
@@ -105,7 +107,7 @@ void										simp_list_pop_head(simp_list* list)
 
 void										simp_list_pop_tail(simp_list* list)
 {
-	if(list->size == 0u) { return; }
+	if(!list || list->size == 0u) { return; }
 	node* curr_node = list->tail;
 	list->tail = list->tail->prev;
 	list->tail->next = NULL;
@@ -227,6 +229,7 @@ static node*								__create_node(void* entry, size_t bentry_size)
 {
 	node* p = malloc(sizeof *p + bentry_size);
 	if(!p) { return NULL; }
+	SIMP_PROF_COUNT(SIMP_PROF_ALLOCATIONS, 1u);
 	p->next = p->prev = NULL;
 	memcpy((unsigned char*)(p) + sizeof *p, entry, bentry_size);
 	return p;
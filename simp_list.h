@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct simp_list simp_list;
 typedef struct simp_list_iter simp_list_iter;
@@ -0,0 +1,346 @@
+#include "simp_lqtree.h"
+#include "simp_prof.h"
+#include "simp_morton.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_LEVEL 16u
+#define STACK_SIZE 64u
+#define KEY_CHUNK 1024u
+
+typedef struct lnode lnode;
+
+//Linear quadtree: points are sorted by the Morton key of their position
+//quantized to 16 bits per axis, so every node is a contiguous range of the
+//sorted arrays. Nodes are stored breadth first and the non-empty children
+//of a node are consecutive; bounds are the tight bounds of the node's points.
+typedef struct simp_lqtree
+{
+	float x0, y0, x1, y1;
+	float sx, sy;
+	uint32_t resolution;
+	uint32_t count, capacity;
+	uint32_t* keys;
+	uint32_t* index;
+	uint32_t* tmp_keys;
+	uint32_t* tmp_index;
+	float* xs;
+	float* ys;
+	const float* pos;
+	lnode* nodes;
+	uint32_t node_count, node_capacity;
+}simp_lqtree;
+
+struct lnode
+{
+	float x0, y0, x1, y1;
+	uint32_t begin, end;
+	uint32_t child, child_count;
+	uint32_t level;
+};
+
+static void			__key_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__gather_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static bool			__build_nodes(simp_lqtree* lqtree);
+static void			__build_bounds(simp_lqtree* lqtree);
+static uint32_t		__lower_bound(const uint32_t* keys, uint32_t begin, uint32_t end, uint32_t shift, uint32_t digit);
+static bool			__reserve_nodes(simp_lqtree* lqtree, uint32_t count);
+static bool			__reserve(uint32_t** buf, uint32_t* capacity, uint32_t size);
+
+simp_lqtree*		simp_lqtree_create(float x0, float y0, float x1, float y1, uint32_t resolution)
+{
+	if(resolution < 1u) { resolution = 1u; }
+	simp_lqtree* lqtree = calloc(1u, sizeof *lqtree);
+	if(!lqtree) { return NULL; }
+	lqtree->x0 = x0;
+	lqtree->y0 = y0;
+	lqtree->x1 = x1;
+	lqtree->y1 = y1;
+	lqtree->sx = 65535.0f / (x1 - x0);
+	lqtree->sy = 65535.0f / (y1 - y0);
+	lqtree->resolution = resolution;
+	return lqtree;
+}
+
+void				simp_lqtree_destroy(simp_lqtree* lqtree)
+{
+	if(!lqtree) { return; }
+	free(lqtree->keys);
+	free(lqtree->index);
+	free(lqtree->tmp_keys);
+	free(lqtree->tmp_index);
+	free(lqtree->xs);
+	free(lqtree->ys);
+	free(lqtree->nodes);
+	free(lqtree);
+}
+
+//Keys, sort and gather run on the pool; deriving the nodes from the sorted
+//keys is a single linear sweep. Points outside the bounds are clamped onto
+//the border cells but keep their coordinates.
+bool				simp_lqtree_build(simp_lqtree* lqtree, const float* pos, uint32_t count, simp_pool* pool)
+{
+	SIMP_PROF_SCOPE("simp_lqtree_build");
+	if(count > lqtree->capacity)
+	{
+		free(lqtree->keys);
+		free(lqtree->index);
+		free(lqtree->tmp_keys);
+		free(lqtree->tmp_index);
+		free(lqtree->xs);
+		free(lqtree->ys);
+		lqtree->keys = malloc(count * sizeof *lqtree->keys);
+		lqtree->index = malloc(count * sizeof *lqtree->index);
+		lqtree->tmp_keys = malloc(count * sizeof *lqtree->tmp_keys);
+		lqtree->tmp_index = malloc(count * sizeof *lqtree->tmp_index);
+		lqtree->xs = malloc(count * sizeof *lqtree->xs);
+		lqtree->ys = malloc(count * sizeof *lqtree->ys);
+		lqtree->capacity = count;
+		if(!lqtree->keys || !lqtree->index || !lqtree->tmp_keys ||
+		   !lqtree->tmp_index || !lqtree->xs || !lqtree->ys)
+		{
+			lqtree->capacity = 0u;
+			lqtree->count = 0u;
+			lqtree->node_count = 0u;
+			return false;
+		}
+	}
+	lqtree->count = count;
+	lqtree->pos = pos;
+
+	simp_pool_for(pool, count, KEY_CHUNK, __key_pass, lqtree);
+	simp_radix_sort_pool(lqtree->keys, lqtree->index, lqtree->tmp_keys, lqtree->tmp_index, count, 32u, pool);
+	simp_pool_for(pool, count, KEY_CHUNK, __gather_pass, lqtree);
+	lqtree->pos = NULL;
+
+	if(!__build_nodes(lqtree))
+	{
+		lqtree->node_count = 0u;
+		return false;
+	}
+	__build_bounds(lqtree);
+	return true;
+}
+
+//Writes the indices inside the rectangle to *buf, growing it as needed, and
+//returns their count. Nodes entirely inside the rectangle are copied whole.
+uint32_t			simp_lqtree_query(simp_lqtree* lqtree, float x0, float y0, float x1, float y1,
+									  uint32_t** buf, uint32_t* capacity)
+{
+	if(lqtree->node_count == 0u) { return 0u; }
+	uint32_t stack[STACK_SIZE];
+	uint32_t top = 0u, size = 0u;
+	stack[top++] = 0u;
+	while(top)
+	{
+		const lnode* nd = &lqtree->nodes[stack[--top]];
+		if(nd->x1 < x0 || nd->x0 > x1 || nd->y1 < y0 || nd->y0 > y1) { continue; }
+
+		uint32_t n = nd->end - nd->begin;
+		if(nd->x0 >= x0 && nd->x1 <= x1 && nd->y0 >= y0 && nd->y1 <= y1)
+		{
+			if(!__reserve(buf, capacity, size + n)) { return size; }
+			memcpy(*buf + size, lqtree->index + nd->begin, n * sizeof **buf);
+			size += n;
+		}
+		else if(nd->child_count == 0u)
+		{
+			if(!__reserve(buf, capacity, size + n)) { return size; }
+			uint32_t* out = *buf;
+			for(uint32_t k = nd->begin; k < nd->end; k++)
+			{
+				float x = lqtree->xs[k];
+				float y = lqtree->ys[k];
+				if(x >= x0 && x <= x1 && y >= y0 && y <= y1)
+					out[size++] = lqtree->index[k];
+			}
+		}
+		else
+		{
+			for(uint32_t c = nd->child_count; c-- > 0u;)
+				stack[top++] = nd->child + c;
+		}
+	}
+	return size;
+}
+
+//Calls visitor for every point inside the rectangle and returns their count
+uint32_t			simp_lqtree_visit(simp_lqtree* lqtree, float x0, float y0, float x1, float y1,
+									  simp_lqtree_visitor visitor, void* ctx)
+{
+	if(lqtree->node_count == 0u) { return 0u; }
+	uint32_t stack[STACK_SIZE];
+	uint32_t top = 0u, count = 0u;
+	stack[top++] = 0u;
+	while(top)
+	{
+		const lnode* nd = &lqtree->nodes[stack[--top]];
+		if(nd->x1 < x0 || nd->x0 > x1 || nd->y1 < y0 || nd->y0 > y1) { continue; }
+
+		if(nd->child_count == 0u)
+		{
+			for(uint32_t k = nd->begin; k < nd->end; k++)
+			{
+				float x = lqtree->xs[k];
+				float y = lqtree->ys[k];
+				if(x >= x0 && x <= x1 && y >= y0 && y <= y1)
+				{
+					visitor(ctx, lqtree->index[k], x, y);
+					count++;
+				}
+			}
+		}
+		else
+		{
+			for(uint32_t c = nd->child_count; c-- > 0u;)
+				stack[top++] = nd->child + c;
+		}
+	}
+	return count;
+}
+
+uint32_t			simp_lqtree_nodes(simp_lqtree* lqtree)
+{
+	return lqtree->node_count;
+}
+
+
+
+static void			__key_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	simp_lqtree* lqtree = ctx;
+	const float* pos = lqtree->pos;
+	for(uint32_t i = begin; i < end; i++)
+	{
+		float qx = fminf(fmaxf((pos[2 * i + 0] - lqtree->x0) * lqtree->sx, 0.0f), 65535.0f);
+		float qy = fminf(fmaxf((pos[2 * i + 1] - lqtree->y0) * lqtree->sy, 0.0f), 65535.0f);
+		lqtree->keys[i] = simp_morton_encode((uint32_t)qx, (uint32_t)qy);
+		lqtree->index[i] = i;
+	}
+}
+
+static void			__gather_pass(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	simp_lqtree* lqtree = ctx;
+	const float* pos = lqtree->pos;
+	for(uint32_t k = begin; k < end; k++)
+	{
+		uint32_t i = lqtree->index[k];
+		lqtree->xs[k] = pos[2 * i + 0];
+		lqtree->ys[k] = pos[2 * i + 1];
+	}
+}
+
+//Breadth first: a node is split while it holds more than resolution points;
+//its children are the runs of equal 2-bit digits below its level
+static bool			__build_nodes(simp_lqtree* lqtree)
+{
+	if(!__reserve_nodes(lqtree, 1u)) { return false; }
+	lnode* root = &lqtree->nodes[0];
+	root->begin = 0u;
+	root->end = lqtree->count;
+	root->level = 0u;
+	lqtree->node_count = 1u;
+
+	for(uint32_t i = 0; i < lqtree->node_count; i++)
+	{
+		if(!__reserve_nodes(lqtree, lqtree->node_count + 4u)) { return false; }
+		lnode* nd = &lqtree->nodes[i];
+		nd->child = lqtree->node_count;
+		nd->child_count = 0u;
+		if(nd->end - nd->begin <= lqtree->resolution || nd->level == MAX_LEVEL) { continue; }
+
+		uint32_t shift = 2u * (MAX_LEVEL - 1u - nd->level);
+		uint32_t begin = nd->begin;
+		for(uint32_t d = 0; d < 4u; d++)
+		{
+			uint32_t end = d == 3u ? nd->end : __lower_bound(lqtree->keys, begin, nd->end, shift, d + 1u);
+			if(end == begin) { continue; }
+			lnode* child = &lqtree->nodes[lqtree->node_count++];
+			child->begin = begin;
+			child->end = end;
+			child->level = nd->level + 1u;
+			nd->child_count++;
+			begin = end;
+		}
+	}
+	return true;
+}
+
+//Children come after their parent, so one backward sweep sees them first
+static void			__build_bounds(simp_lqtree* lqtree)
+{
+	for(uint32_t i = lqtree->node_count; i-- > 0u;)
+	{
+		lnode* nd = &lqtree->nodes[i];
+		float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+		if(nd->child_count == 0u)
+		{
+			for(uint32_t k = nd->begin; k < nd->end; k++)
+			{
+				x0 = fminf(x0, lqtree->xs[k]);
+				y0 = fminf(y0, lqtree->ys[k]);
+				x1 = fmaxf(x1, lqtree->xs[k]);
+				y1 = fmaxf(y1, lqtree->ys[k]);
+			}
+		}
+		else
+		{
+			for(uint32_t c = 0; c < nd->child_count; c++)
+			{
+				const lnode* child = &lqtree->nodes[nd->child + c];
+				x0 = fminf(x0, child->x0);
+				y0 = fminf(y0, child->y0);
+				x1 = fmaxf(x1, child->x1);
+				y1 = fmaxf(y1, child->y1);
+			}
+		}
+		nd->x0 = x0;
+		nd->y0 = y0;
+		nd->x1 = x1;
+		nd->y1 = y1;
+	}
+}
+
+//First k in [begin, end) whose 2-bit digit at shift is at least digit; the
+//keys of a node share every bit above shift + 2, so the digits are sorted
+static uint32_t		__lower_bound(const uint32_t* keys, uint32_t begin, uint32_t end, uint32_t shift, uint32_t digit)
+{
+	while(begin < end)
+	{
+		uint32_t mid = begin + (end - begin) / 2u;
+		if(((keys[mid] >> shift) & 3u) < digit)
+			begin = mid + 1u;
+		else
+			end = mid;
+	}
+	return begin;
+}
+
+static bool			__reserve_nodes(simp_lqtree* lqtree, uint32_t count)
+{
+	if(count <= lqtree->node_capacity) { return true; }
+	uint32_t capacity = lqtree->node_capacity ? lqtree->node_capacity : 256u;
+	while(capacity < count)
+		capacity *= 2u;
+	lnode* nodes = realloc(lqtree->nodes, capacity * sizeof *nodes);
+	if(!nodes) { return false; }
+	lqtree->nodes = nodes;
+	lqtree->node_capacity = capacity;
+	return true;
+}
+
+static bool			__reserve(uint32_t** buf, uint32_t* capacity, uint32_t size)
+{
+	if(size <= *capacity) { return true; }
+	uint32_t new_capacity = *capacity ? *capacity : 64u;
+	while(new_capacity < size)
+		new_capacity *= 2u;
+	uint32_t* p = realloc(*buf, new_capacity * sizeof *p);
+	if(!p) { return false; }
+	SIMP_PROF_COUNT(SIMP_PROF_ALLOCATIONS, 1u);
+	*buf = p;
+	*capacity = new_capacity;
+	return true;
+}
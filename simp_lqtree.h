@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "simp_pool.h"
+
+typedef struct simp_lqtree simp_lqtree;
+typedef void		(*simp_lqtree_visitor)(void* ctx, uint32_t index, float x, float y);
+
+simp_lqtree*		simp_lqtree_create(float x0, float y0, float x1, float y1, uint32_t resolution);
+void				simp_lqtree_destroy(simp_lqtree* lqtree);
+bool				simp_lqtree_build(simp_lqtree* lqtree, const float* pos, uint32_t count, simp_pool* pool);
+uint32_t			simp_lqtree_query(simp_lqtree* lqtree, float x0, float y0, float x1, float y1,
+									  uint32_t** buf, uint32_t* capacity);
+uint32_t			simp_lqtree_visit(simp_lqtree* lqtree, float x0, float y0, float x1, float y1,
+									  simp_lqtree_visitor visitor, void* ctx);
+uint32_t			simp_lqtree_nodes(simp_lqtree* lqtree);
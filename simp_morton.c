@@ -0,0 +1,184 @@
+#include "simp_morton.h"
+#include <string.h>
+
+#define SORT_MAX_BLOCKS 32u
+
+typedef struct sort_pass sort_pass;
+
+//One pass of the parallel sort; block b owns the input range
+//[b * count / blocks, (b + 1) * count / blocks)
+struct sort_pass
+{
+	const uint32_t* src_keys;
+	const uint32_t* src_vals;
+	uint32_t* dst_keys;
+	uint32_t* dst_vals;
+	uint32_t count, blocks, shift;
+	uint32_t histogram[SORT_MAX_BLOCKS][256];
+};
+
+static uint32_t		__spread16(uint32_t t);
+static uint64_t		__spread32(uint64_t t);
+static void			__histogram_block(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+static void			__scatter_block(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+
+//Interleaves the low 16 bits of x and y, x in the even bits
+uint32_t			simp_morton_encode(uint32_t x, uint32_t y)
+{
+	return __spread16(x) | (__spread16(y) << 1);
+}
+
+uint64_t			simp_morton_encode64(uint32_t x, uint32_t y)
+{
+	return __spread32(x) | (__spread32(y) << 1);
+}
+
+//Stable LSD radix sort of (key, val) pairs on the low key_bits bits, 8 bits per pass
+void				simp_radix_sort(uint32_t* keys, uint32_t* vals, uint32_t* tmp_keys, uint32_t* tmp_vals,
+									uint32_t count, uint32_t key_bits)
+{
+	uint32_t* src_keys = keys, *src_vals = vals;
+	uint32_t* dst_keys = tmp_keys, *dst_vals = tmp_vals;
+	uint32_t histogram[256];
+	for(uint32_t shift = 0u; shift < key_bits; shift += 8u)
+	{
+		memset(histogram, 0, sizeof histogram);
+		for(uint32_t i = 0; i < count; i++)
+			histogram[(src_keys[i] >> shift) & 0xFFu]++;
+
+		uint32_t offset = 0u;
+		for(uint32_t d = 0; d < 256u; d++)
+		{
+			uint32_t n = histogram[d];
+			histogram[d] = offset;
+			offset += n;
+		}
+
+		for(uint32_t i = 0; i < count; i++)
+		{
+			uint32_t dst = histogram[(src_keys[i] >> shift) & 0xFFu]++;
+			dst_keys[dst] = src_keys[i];
+			dst_vals[dst] = src_vals[i];
+		}
+
+		uint32_t* t;
+		t = src_keys; src_keys = dst_keys; dst_keys = t;
+		t = src_vals; src_vals = dst_vals; dst_vals = t;
+	}
+
+	if(src_keys != keys)
+	{
+		memcpy(keys, src_keys, count * sizeof *keys);
+		memcpy(vals, src_vals, count * sizeof *vals);
+	}
+}
+
+//simp_radix_sort with the histogram and scatter of every pass split across
+//the pool; still stable, since blocks scatter to offsets ordered by block
+void				simp_radix_sort_pool(uint32_t* keys, uint32_t* vals, uint32_t* tmp_keys, uint32_t* tmp_vals,
+										 uint32_t count, uint32_t key_bits, simp_pool* pool)
+{
+	uint32_t blocks = simp_pool_threads(pool);
+	if(blocks > SORT_MAX_BLOCKS) { blocks = SORT_MAX_BLOCKS; }
+	if(blocks < 2u || count < 4096u)
+	{
+		simp_radix_sort(keys, vals, tmp_keys, tmp_vals, count, key_bits);
+		return;
+	}
+
+	sort_pass pass;
+	pass.src_keys = keys;
+	pass.src_vals = vals;
+	pass.dst_keys = tmp_keys;
+	pass.dst_vals = tmp_vals;
+	pass.count = count;
+	pass.blocks = blocks;
+	for(uint32_t shift = 0u; shift < key_bits; shift += 8u)
+	{
+		pass.shift = shift;
+		simp_pool_for(pool, blocks, 1u, __histogram_block, &pass);
+
+		//Every key shares this digit, the pass would be a plain copy
+		uint32_t digit = (pass.src_keys[0] >> shift) & 0xFFu;
+		uint32_t same = 0u;
+		for(uint32_t b = 0; b < blocks; b++)
+			same += pass.histogram[b][digit];
+		if(same == count) { continue; }
+
+		uint32_t offset = 0u;
+		for(uint32_t d = 0; d < 256u; d++)
+		{
+			for(uint32_t b = 0; b < blocks; b++)
+			{
+				uint32_t n = pass.histogram[b][d];
+				pass.histogram[b][d] = offset;
+				offset += n;
+			}
+		}
+		simp_pool_for(pool, blocks, 1u, __scatter_block, &pass);
+
+		const uint32_t* t;
+		t = pass.src_keys; pass.src_keys = pass.dst_keys; pass.dst_keys = (uint32_t*)t;
+		t = pass.src_vals; pass.src_vals = pass.dst_vals; pass.dst_vals = (uint32_t*)t;
+	}
+
+	if(pass.src_keys != keys)
+	{
+		memcpy(keys, pass.src_keys, count * sizeof *keys);
+		memcpy(vals, pass.src_vals, count * sizeof *vals);
+	}
+}
+
+
+
+static void			__histogram_block(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	sort_pass* pass = ctx;
+	for(uint32_t b = begin; b < end; b++)
+	{
+		uint32_t* histogram = pass->histogram[b];
+		memset(histogram, 0, sizeof pass->histogram[b]);
+		uint32_t i0 = (uint32_t)((uint64_t)pass->count * b / pass->blocks);
+		uint32_t i1 = (uint32_t)((uint64_t)pass->count * (b + 1u) / pass->blocks);
+		for(uint32_t i = i0; i < i1; i++)
+			histogram[(pass->src_keys[i] >> pass->shift) & 0xFFu]++;
+	}
+}
+
+static void			__scatter_block(void* ctx, uint32_t begin, uint32_t end, uint32_t thread)
+{
+	sort_pass* pass = ctx;
+	for(uint32_t b = begin; b < end; b++)
+	{
+		uint32_t* histogram = pass->histogram[b];
+		uint32_t i0 = (uint32_t)((uint64_t)pass->count * b / pass->blocks);
+		uint32_t i1 = (uint32_t)((uint64_t)pass->count * (b + 1u) / pass->blocks);
+		for(uint32_t i = i0; i < i1; i++)
+		{
+			uint32_t dst = histogram[(pass->src_keys[i] >> pass->shift) & 0xFFu]++;
+			pass->dst_keys[dst] = pass->src_keys[i];
+			pass->dst_vals[dst] = pass->src_vals[i];
+		}
+	}
+}
+
+static uint32_t		__spread16(uint32_t t)
+{
+	t &= 0x0000FFFFu;
+	t = (t | (t << 8)) & 0x00FF00FFu;
+	t = (t | (t << 4)) & 0x0F0F0F0Fu;
+	t = (t | (t << 2)) & 0x33333333u;
+	t = (t | (t << 1)) & 0x55555555u;
+	return t;
+}
+
+static uint64_t		__spread32(uint64_t t)
+{
+	t &= 0x00000000FFFFFFFFull;
+	t = (t | (t << 16)) & 0x0000FFFF0000FFFFull;
+	t = (t | (t << 8)) & 0x00FF00FF00FF00FFull;
+	t = (t | (t << 4)) & 0x0F0F0F0F0F0F0F0Full;
+	t = (t | (t << 2)) & 0x3333333333333333ull;
+	t = (t | (t << 1)) & 0x5555555555555555ull;
+	return t;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "simp_pool.h"
+
+uint32_t			simp_morton_encode(uint32_t x, uint32_t y);
+uint64_t			simp_morton_encode64(uint32_t x, uint32_t y);
+void				simp_radix_sort(uint32_t* keys, uint32_t* vals, uint32_t* tmp_keys, uint32_t* tmp_vals,
+									uint32_t count, uint32_t key_bits);
+void				simp_radix_sort_pool(uint32_t* keys, uint32_t* vals, uint32_t* tmp_keys, uint32_t* tmp_vals,
+										 uint32_t count, uint32_t key_bits, simp_pool* pool);
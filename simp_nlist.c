@@ -0,0 +1,163 @@
+#include "simp_nlist.h"
+#include "simp_prof.h"
+#include <stdlib.h>
+#include <string.h>
+
+//Verlet neighbor list in CSR form: the neighbors of particle i are
+//index[offset[i]] .. index[offset[i + 1] - 1]
+typedef struct simp_nlist
+{
+	float radius, skin;
+	uint32_t count, capacity;
+	uint32_t size, index_capacity;
+	uint32_t* offset;
+	uint32_t* index;
+	//Positions at the time of the last build
+	float* ref_pos;
+	bool built;
+}simp_nlist;
+
+simp_nlist*			simp_nlist_create(float radius, float skin)
+{
+	simp_nlist* nlist = calloc(1u, sizeof *nlist);
+	if(!nlist) { return NULL; }
+	nlist->radius = radius;
+	nlist->skin = skin;
+	return nlist;
+}
+
+void				simp_nlist_destroy(simp_nlist* nlist)
+{
+	if(!nlist) { return; }
+	free(nlist->offset);
+	free(nlist->index);
+	free(nlist->ref_pos);
+	free(nlist);
+}
+
+bool				simp_nlist_valid(simp_nlist* nlist, const float* pos, uint32_t count)
+{
+	if(!nlist->built || nlist->count != count) { return false; }
+	float limit = 0.25f * nlist->skin * nlist->skin;
+	for(uint32_t i = 0; i < count; i++)
+	{
+		float dx = pos[2 * i + 0] - nlist->ref_pos[2 * i + 0];
+		float dy = pos[2 * i + 1] - nlist->ref_pos[2 * i + 1];
+		if(dx * dx + dy * dy > limit) { return false; }
+	}
+	return true;
+}
+
+bool				simp_nlist_begin(simp_nlist* nlist, const float* pos, uint32_t count)
+{
+	nlist->built = false;
+	if(count > nlist->capacity)
+	{
+		uint32_t* offset = realloc(nlist->offset, (count + 1u) * sizeof *offset);
+		if(!offset) { return false; }
+		nlist->offset = offset;
+		float* ref_pos = realloc(nlist->ref_pos, count * 2u * sizeof *ref_pos);
+		if(!ref_pos) { return false; }
+		nlist->ref_pos = ref_pos;
+		nlist->capacity = count;
+	}
+	nlist->count = count;
+	nlist->size = 0u;
+	nlist->offset[0] = 0u;
+	if(pos)
+		memcpy(nlist->ref_pos, pos, count * 2u * sizeof *pos);
+	return true;
+}
+
+bool				simp_nlist_near(const simp_nlist* nlist, uint32_t i, float x, float y)
+{
+	if(!nlist->built || i >= nlist->count) { return false; }
+	float dx = x - nlist->ref_pos[2 * i + 0];
+	float dy = y - nlist->ref_pos[2 * i + 1];
+	return dx * dx + dy * dy <= 0.25f * nlist->skin * nlist->skin;
+}
+
+void				simp_nlist_place(simp_nlist* nlist, uint32_t i, float x, float y)
+{
+	nlist->ref_pos[2 * i + 0] = x;
+	nlist->ref_pos[2 * i + 1] = y;
+}
+
+//A build is two passes so rows can be processed in any order and from
+//several threads: count every row, commit, then fill every row with the
+//same candidates. Candidates are filtered by radius + skin.
+void				simp_nlist_count(simp_nlist* nlist, uint32_t i, const uint32_t* cand, uint32_t cand_count)
+{
+	const float* pos = nlist->ref_pos;
+	float cutoff = nlist->radius + nlist->skin;
+	float cutoff2 = cutoff * cutoff;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	uint32_t n = 0u;
+	for(uint32_t k = 0; k < cand_count; k++)
+	{
+		uint32_t j = cand[k];
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		n += (j != i && dx * dx + dy * dy <= cutoff2);
+	}
+	nlist->offset[i + 1u] = n;
+}
+
+bool				simp_nlist_commit(simp_nlist* nlist)
+{
+	uint32_t size = 0u;
+	for(uint32_t i = 0; i < nlist->count; i++)
+	{
+		size += nlist->offset[i + 1u];
+		nlist->offset[i + 1u] = size;
+	}
+	if(size > nlist->index_capacity)
+	{
+		uint32_t new_capacity = nlist->index_capacity ? nlist->index_capacity : 1024u;
+		while(new_capacity < size)
+			new_capacity *= 2u;
+		uint32_t* index = realloc(nlist->index, new_capacity * sizeof *index);
+		if(!index) { return false; }
+		SIMP_PROF_COUNT(SIMP_PROF_ALLOCATIONS, 1u);
+		nlist->index = index;
+		nlist->index_capacity = new_capacity;
+	}
+	nlist->size = size;
+	nlist->built = true;
+	return true;
+}
+
+void				simp_nlist_fill(simp_nlist* nlist, uint32_t i, const uint32_t* cand, uint32_t cand_count)
+{
+	const float* pos = nlist->ref_pos;
+	float cutoff = nlist->radius + nlist->skin;
+	float cutoff2 = cutoff * cutoff;
+	float x = pos[2 * i + 0];
+	float y = pos[2 * i + 1];
+	uint32_t* out = nlist->index + nlist->offset[i];
+	for(uint32_t k = 0; k < cand_count; k++)
+	{
+		uint32_t j = cand[k];
+		float dx = pos[2 * j + 0] - x;
+		float dy = pos[2 * j + 1] - y;
+		if(j != i && dx * dx + dy * dy <= cutoff2)
+			*out++ = j;
+	}
+}
+
+void				simp_nlist_invalidate(simp_nlist* nlist)
+{
+	nlist->built = false;
+}
+
+const uint32_t*		simp_nlist_get(simp_nlist* nlist, uint32_t i, uint32_t* count)
+{
+	*count = nlist->offset[i + 1u] - nlist->offset[i];
+	return nlist->index + nlist->offset[i];
+}
+
+float				simp_nlist_cutoff(simp_nlist* nlist)
+{
+	return nlist->radius + nlist->skin;
+}
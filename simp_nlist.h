@@ -0,0 +1,21 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct simp_nlist simp_nlist;
+
+simp_nlist*			simp_nlist_create(float radius, float skin);
+void				simp_nlist_destroy(simp_nlist* nlist);
+bool				simp_nlist_valid(simp_nlist* nlist, const float* pos, uint32_t count);
+bool				simp_nlist_begin(simp_nlist* nlist, const float* pos, uint32_t count);
+//Per-particle forms for callers without a float position array: the lists
+//hold while every particle is near its reference, and a build begun with
+//pos NULL takes the references from simp_nlist_place before counting
+bool				simp_nlist_near(const simp_nlist* nlist, uint32_t i, float x, float y);
+void				simp_nlist_place(simp_nlist* nlist, uint32_t i, float x, float y);
+void				simp_nlist_count(simp_nlist* nlist, uint32_t i, const uint32_t* cand, uint32_t cand_count);
+bool				simp_nlist_commit(simp_nlist* nlist);
+void				simp_nlist_fill(simp_nlist* nlist, uint32_t i, const uint32_t* cand, uint32_t cand_count);
+void				simp_nlist_invalidate(simp_nlist* nlist);
+const uint32_t*		simp_nlist_get(simp_nlist* nlist, uint32_t i, uint32_t* count);
+float				simp_nlist_cutoff(simp_nlist* nlist);
@@ -0,0 +1,160 @@
+#include "simp_pool.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef struct worker worker;
+
+//Persistent workers sleep on wake_cond between jobs; a job is a range split
+//into chunks that all threads, including the caller, claim from an atomic counter
+typedef struct simp_pool
+{
+	uint32_t threads;
+	worker* workers;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake_cond;
+	pthread_cond_t done_cond;
+	uint64_t generation;
+	uint32_t running;
+	bool quit;
+	//Current job
+	simp_pool_fn fn;
+	void* ctx;
+	uint32_t count, chunk;
+	atomic_uint next;
+}simp_pool;
+
+struct worker
+{
+	simp_pool* pool;
+	pthread_t thread;
+	uint32_t index;
+};
+
+static void*		__worker_main(void* arg);
+static void			__run_chunks(simp_pool* pool, uint32_t thread);
+
+simp_pool*			simp_pool_create(uint32_t threads)
+{
+	if(threads < 1u) { threads = 1u; }
+	simp_pool* pool = calloc(1u, sizeof *pool);
+	if(!pool) { return NULL; }
+	pool->threads = threads;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->wake_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	atomic_init(&pool->next, 0u);
+
+	//Thread 0 is the caller of simp_pool_for
+	pool->workers = calloc(threads, sizeof *pool->workers);
+	if(!pool->workers)
+	{
+		simp_pool_destroy(pool);
+		return NULL;
+	}
+	for(uint32_t t = 1; t < threads; t++)
+	{
+		pool->workers[t].pool = pool;
+		pool->workers[t].index = t;
+		if(pthread_create(&pool->workers[t].thread, NULL, __worker_main, &pool->workers[t]) != 0)
+		{
+			pool->threads = t;
+			simp_pool_destroy(pool);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+void				simp_pool_destroy(simp_pool* pool)
+{
+	if(!pool) { return; }
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = true;
+	pthread_cond_broadcast(&pool->wake_cond);
+	pthread_mutex_unlock(&pool->mutex);
+	if(pool->workers)
+		for(uint32_t t = 1; t < pool->threads; t++)
+			pthread_join(pool->workers[t].thread, NULL);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->wake_cond);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool->workers);
+	free(pool);
+}
+
+uint32_t			simp_pool_threads(simp_pool* pool)
+{
+	return pool ? pool->threads : 1u;
+}
+
+//Runs fn over [0, count) in chunks and returns once every chunk is done
+void				simp_pool_for(simp_pool* pool, uint32_t count, uint32_t chunk, simp_pool_fn fn, void* ctx)
+{
+	if(count == 0u) { return; }
+	if(chunk < 1u) { chunk = 1u; }
+	if(!pool || pool->threads == 1u || count <= chunk)
+	{
+		fn(ctx, 0u, count, 0u);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->fn = fn;
+	pool->ctx = ctx;
+	pool->count = count;
+	pool->chunk = chunk;
+	atomic_store(&pool->next, 0u);
+	pool->running = pool->threads - 1u;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake_cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	__run_chunks(pool, 0u);
+
+	pthread_mutex_lock(&pool->mutex);
+	while(pool->running > 0u)
+		pthread_cond_wait(&pool->done_cond, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
+
+
+
+static void*		__worker_main(void* arg)
+{
+	worker* w = arg;
+	simp_pool* pool = w->pool;
+	uint64_t seen = 0u;
+	for(;;)
+	{
+		pthread_mutex_lock(&pool->mutex);
+		while(!pool->quit && pool->generation == seen)
+			pthread_cond_wait(&pool->wake_cond, &pool->mutex);
+		if(pool->quit)
+		{
+			pthread_mutex_unlock(&pool->mutex);
+			return NULL;
+		}
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		__run_chunks(pool, w->index);
+
+		pthread_mutex_lock(&pool->mutex);
+		if(--pool->running == 0u)
+			pthread_cond_signal(&pool->done_cond);
+		pthread_mutex_unlock(&pool->mutex);
+	}
+}
+
+static void			__run_chunks(simp_pool* pool, uint32_t thread)
+{
+	uint32_t count = pool->count, chunk = pool->chunk;
+	for(;;)
+	{
+		uint32_t begin = atomic_fetch_add(&pool->next, chunk);
+		if(begin >= count) { return; }
+		uint32_t end = begin + chunk < count ? begin + chunk : count;
+		pool->fn(pool->ctx, begin, end, thread);
+	}
+}
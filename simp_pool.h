@@ -0,0 +1,11 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct simp_pool simp_pool;
+typedef void (*simp_pool_fn)(void* ctx, uint32_t begin, uint32_t end, uint32_t thread);
+
+simp_pool*			simp_pool_create(uint32_t threads);
+void				simp_pool_destroy(simp_pool* pool);
+uint32_t			simp_pool_threads(simp_pool* pool);
+void				simp_pool_for(simp_pool* pool, uint32_t count, uint32_t chunk, simp_pool_fn fn, void* ctx);
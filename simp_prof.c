@@ -0,0 +1,281 @@
+#include "simp_prof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include "utils.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define MAX_ZONES 64u
+
+typedef struct event event;
+typedef struct zone zone;
+typedef struct step_mark step_mark;
+
+struct event
+{
+	const char* name;
+	uint64_t begin;
+	uint64_t end;
+};
+
+//Only its own thread writes a ring; simp_prof_step and the exporters read it
+//while the thread is idle
+struct simp_prof_thread
+{
+	event* events;
+	uint64_t written;
+	uint64_t summarized;
+	uint64_t counters[SIMP_PROF_COUNTERS];
+	uint64_t summarized_counters[SIMP_PROF_COUNTERS];
+};
+
+struct zone
+{
+	const char* name;
+	uint64_t calls;
+	uint64_t ticks;
+};
+
+struct step_mark
+{
+	uint64_t step;
+	uint64_t tick;
+	uint64_t counters[SIMP_PROF_COUNTERS];
+};
+
+static const char* const counter_names[SIMP_PROF_COUNTERS] = { "queries", "candidates", "neighbors", "allocations" };
+
+_Thread_local simp_prof_thread* simp_prof_self;
+
+//Threads are never unregistered so their events stay exportable; once all
+//slots are taken further threads share one slot that is never reported
+static simp_prof_thread threads[SIMP_PROF_MAX_THREADS];
+static simp_prof_thread overflow;
+static atomic_uint thread_count;
+static uint64_t origin_tick;
+static double origin_time;
+static FILE* csv;
+static step_mark* marks;
+static uint32_t mark_count, mark_capacity;
+
+static double		__ns_per_tick(void);
+static const char*	__json_name(const char* name, char* buf, size_t size);
+
+bool				simp_prof_enabled(void)
+{
+#ifdef SIMP_PROF
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool				simp_prof_open_csv(const char* path)
+{
+	if(!simp_prof_enabled()) { return false; }
+	if(csv)
+		fclose(csv);
+	csv = fopen(path, "w");
+	if(!csv) { return false; }
+	fprintf(csv, "step,kind,name,calls,value\n");
+	return true;
+}
+
+//Sums the events and counters since the previous call into one CSV block,
+//zones in microseconds summed over threads
+void				simp_prof_step(uint64_t step)
+{
+	if(!simp_prof_enabled()) { return; }
+	zone zones[MAX_ZONES];
+	uint32_t zone_count = 0u;
+	uint64_t counters[SIMP_PROF_COUNTERS] = {0};
+	uint32_t count = atomic_load(&thread_count);
+	if(count > SIMP_PROF_MAX_THREADS) { count = SIMP_PROF_MAX_THREADS; }
+	for(uint32_t t = 0; t < count; t++)
+	{
+		simp_prof_thread* thread = &threads[t];
+		if(!thread->events) { continue; }
+		uint64_t first = thread->summarized;
+		if(thread->written - first > SIMP_PROF_RING_SIZE)
+			first = thread->written - SIMP_PROF_RING_SIZE;
+		for(uint64_t e = first; e < thread->written; e++)
+		{
+			const event* ev = &thread->events[e % SIMP_PROF_RING_SIZE];
+			uint32_t z = 0u;
+			while(z < zone_count && zones[z].name != ev->name && strcmp(zones[z].name, ev->name))
+				z++;
+			if(z == zone_count)
+			{
+				if(zone_count == MAX_ZONES) { continue; }
+				zones[zone_count++] = (zone){ ev->name, 0u, 0u };
+			}
+			zones[z].calls++;
+			zones[z].ticks += ev->end - ev->begin;
+		}
+		thread->summarized = thread->written;
+		for(uint32_t c = 0; c < SIMP_PROF_COUNTERS; c++)
+		{
+			counters[c] += thread->counters[c] - thread->summarized_counters[c];
+			thread->summarized_counters[c] = thread->counters[c];
+		}
+	}
+
+	if(mark_count == mark_capacity)
+	{
+		uint32_t capacity = mark_capacity ? 2u * mark_capacity : 1024u;
+		step_mark* p = realloc(marks, capacity * sizeof *p);
+		if(p)
+		{
+			marks = p;
+			mark_capacity = capacity;
+		}
+	}
+	if(mark_count < mark_capacity)
+	{
+		step_mark* mark = &marks[mark_count++];
+		mark->step = step;
+		mark->tick = simp_prof_ticks();
+		memcpy(mark->counters, counters, sizeof counters);
+	}
+
+	if(!csv) { return; }
+	double us_per_tick = __ns_per_tick() * 1e-3;
+	for(uint32_t z = 0; z < zone_count; z++)
+		fprintf(csv, "%llu,zone,%s,%llu,%.3f\n", (unsigned long long)step, zones[z].name,
+			(unsigned long long)zones[z].calls, zones[z].ticks * us_per_tick);
+	for(uint32_t c = 0; c < SIMP_PROF_COUNTERS; c++)
+		fprintf(csv, "%llu,counter,%s,,%llu\n", (unsigned long long)step, counter_names[c], (unsigned long long)counters[c]);
+}
+
+//Chrome trace event format: one complete event per recorded scope still in
+//the rings and a counter sample per step
+bool				simp_prof_write_trace(const char* path)
+{
+	if(!simp_prof_enabled()) { return false; }
+	FILE* file = fopen(path, "w");
+	if(!file) { return false; }
+	double us_per_tick = __ns_per_tick() * 1e-3;
+	bool first = true;
+	char name[128];
+	fprintf(file, "{\"traceEvents\":[\n");
+	uint32_t count = atomic_load(&thread_count);
+	if(count > SIMP_PROF_MAX_THREADS) { count = SIMP_PROF_MAX_THREADS; }
+	for(uint32_t t = 0; t < count; t++)
+	{
+		simp_prof_thread* thread = &threads[t];
+		if(!thread->events) { continue; }
+		uint64_t e = thread->written > SIMP_PROF_RING_SIZE ? thread->written - SIMP_PROF_RING_SIZE : 0u;
+		for(; e < thread->written; e++)
+		{
+			const event* ev = &thread->events[e % SIMP_PROF_RING_SIZE];
+			fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+				first ? "" : ",\n", __json_name(ev->name, name, sizeof name), t,
+				(int64_t)(ev->begin - origin_tick) * us_per_tick, (ev->end - ev->begin) * us_per_tick);
+			first = false;
+		}
+	}
+	for(uint32_t m = 0; m < mark_count; m++)
+	{
+		fprintf(file, "%s{\"name\":\"step\",\"ph\":\"C\",\"pid\":1,\"ts\":%.3f,\"args\":{\"step\":%llu",
+			first ? "" : ",\n", (int64_t)(marks[m].tick - origin_tick) * us_per_tick, (unsigned long long)marks[m].step);
+		for(uint32_t c = 0; c < SIMP_PROF_COUNTERS; c++)
+			fprintf(file, ",\"%s\":%llu", counter_names[c], (unsigned long long)marks[m].counters[c]);
+		fprintf(file, "}}");
+		first = false;
+	}
+	fprintf(file, "\n]}\n");
+	return fclose(file) == 0;
+}
+
+void				simp_prof_close(void)
+{
+	if(csv)
+		fclose(csv);
+	csv = NULL;
+	free(marks);
+	marks = NULL;
+	mark_count = mark_capacity = 0u;
+}
+
+simp_prof_thread*	simp_prof_attach(void)
+{
+	uint32_t slot = atomic_fetch_add(&thread_count, 1u);
+	if(slot == 0u)
+	{
+		origin_time = wtime();
+		origin_tick = simp_prof_ticks();
+	}
+	simp_prof_thread* thread = &overflow;
+	if(slot < SIMP_PROF_MAX_THREADS)
+	{
+		event* events = malloc(SIMP_PROF_RING_SIZE * sizeof *events);
+		if(events)
+		{
+			threads[slot].events = events;
+			thread = &threads[slot];
+		}
+	}
+	simp_prof_self = thread;
+	return thread;
+}
+
+uint64_t*			simp_prof_counters(simp_prof_thread* thread)
+{
+	return thread->counters;
+}
+
+uint64_t			simp_prof_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return (uint64_t)(wtime() * 1e9);
+#endif
+}
+
+//Attaches before the first tick is taken, so that no scope begins before the origin
+uint64_t			simp_prof_scope_begin(void)
+{
+	if(!simp_prof_self)
+		simp_prof_attach();
+	return simp_prof_ticks();
+}
+
+void				simp_prof_scope_end(simp_prof_scope* scope)
+{
+	uint64_t end = simp_prof_ticks();
+	simp_prof_thread* thread = simp_prof_self ? simp_prof_self : simp_prof_attach();
+	if(!thread->events) { return; }
+	thread->events[thread->written % SIMP_PROF_RING_SIZE] = (event){ scope->name, scope->begin, end };
+	thread->written++;
+}
+
+
+
+//The tick rate is measured against wall time since the first thread attached
+static double		__ns_per_tick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if(!atomic_load(&thread_count)) { return 1.0; }
+	double start = wtime();
+	while(wtime() - origin_time < 1e-2 && wtime() - start < 1e-2)
+		;
+	uint64_t ticks = simp_prof_ticks() - origin_tick;
+	return ticks ? (wtime() - origin_time) * 1e9 / ticks : 1.0;
+#else
+	return 1.0;
+#endif
+}
+
+//Zone names are literals from the source; anything JSON would need escaped is replaced
+static const char*	__json_name(const char* name, char* buf, size_t size)
+{
+	size_t n = 0u;
+	for(; name[n] && n + 1u < size; n++)
+		buf[n] = name[n] == '"' || name[n] == '\\' || (unsigned char)name[n] < 0x20u ? '_' : name[n];
+	buf[n] = '\0';
+	return buf;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+//Hot-path instrumentation, compiled in with -DSIMP_PROF. Scoped timers record
+//into a ring buffer per thread and counters are kept per thread; the driver
+//calls simp_prof_step between steps, while no pass is running, to append a
+//summary to the CSV. Without SIMP_PROF the macros expand to nothing and their
+//arguments are never evaluated.
+#define SIMP_PROF_RING_SIZE		65536u
+#define SIMP_PROF_MAX_THREADS	64u
+
+typedef enum simp_prof_counter
+{
+	SIMP_PROF_QUERIES,
+	SIMP_PROF_CANDIDATES,
+	SIMP_PROF_NEIGHBORS,
+	SIMP_PROF_ALLOCATIONS,
+	SIMP_PROF_COUNTERS
+}simp_prof_counter;
+
+typedef struct simp_prof_thread simp_prof_thread;
+
+typedef struct simp_prof_scope
+{
+	const char* name;
+	uint64_t begin;
+}simp_prof_scope;
+
+bool				simp_prof_enabled(void);
+bool				simp_prof_open_csv(const char* path);
+void				simp_prof_step(uint64_t step);
+bool				simp_prof_write_trace(const char* path);
+void				simp_prof_close(void);
+
+//Used by the macros
+extern _Thread_local simp_prof_thread* simp_prof_self;
+simp_prof_thread*	simp_prof_attach(void);
+uint64_t*			simp_prof_counters(simp_prof_thread* thread);
+uint64_t			simp_prof_ticks(void);
+uint64_t			simp_prof_scope_begin(void);
+void				simp_prof_scope_end(simp_prof_scope* scope);
+
+#ifdef SIMP_PROF
+#define SIMP_PROF_JOIN_(a, b)		a##b
+#define SIMP_PROF_JOIN(a, b)		SIMP_PROF_JOIN_(a, b)
+#define SIMP_PROF_SCOPE(name)		simp_prof_scope SIMP_PROF_JOIN(prof_scope_, __LINE__) \
+										__attribute__((cleanup(simp_prof_scope_end))) = { name, simp_prof_scope_begin() }
+#define SIMP_PROF_COUNT(counter, n)	(simp_prof_counters(simp_prof_self ? simp_prof_self : simp_prof_attach())[counter] += (n))
+#else
+#define SIMP_PROF_SCOPE(name)		((void)0)
+#define SIMP_PROF_COUNT(counter, n)	((void)0)
+#endif
@@ -1,132 +1,260 @@
 #include "simp_quadtree.h"
+#include "simp_prof.h"
 #include <stdlib.h>
 
+#define NONE 0xFFFFFFFFu
+#define MAX_DEPTH 24u
+
 typedef struct node node;
 
+//All nodes live in one pool owned by the tree. The root is node 0 and the
+//children of a split node are four consecutive nodes; free blocks of four
+//are chained through their first node's parent field. Every node stores up
+//to resolution points in its slots of bucket/points.
 typedef struct simp_quadtree
 {
-	float x0, y0, x1, y1;
-	uint32_t resolution, count;
+	uint32_t resolution;
+	node* nodes;
+	uint32_t node_count, node_capacity;
+	uint32_t free_block;
 	uint32_t* bucket;
 	float* points;
-	simp_quadtree* children[4];
-	bool split_flag;
+	//Node and slot of every tracked index, NONE when not in the tree
+	uint32_t* point_node;
+	uint32_t* point_slot;
+	uint32_t index_capacity;
+	uint32_t size;
 }simp_quadtree;
 
 struct node
 {
-	uint32_t val;
-	node* next;
+	float x0, y0, x1, y1;
+	uint32_t parent;
+	uint32_t children;
+	uint32_t count;
+	uint32_t total;
+	uint32_t depth;
 };
 
-static void			__query(simp_quadtree* qtree, float x0, float y0, float x1,	float y1, simp_list* list);
+static void			__push_list(void* ctx, uint32_t index, float x, float y);
+static uint32_t		__query_buffer(simp_quadtree* qtree, uint32_t n, float x0, float y0, float x1, float y1,
+								   uint32_t** buf, uint32_t* capacity, uint32_t size);
+static uint32_t		__visit(simp_quadtree* qtree, uint32_t n, float x0, float y0, float x1, float y1,
+							simp_quadtree_visitor visitor, void* ctx);
 static bool			__contains(float x1, float y1, float x2, float y2, float px, float py);
 static bool			__intersects(float x11, float y11, float x12, float y12,
 								 float x21, float y21, float x22, float y22);
-static void			__split(simp_quadtree* qtree);
+static bool			__insert(simp_quadtree* qtree, uint32_t n, float x, float y, uint32_t index);
+static bool			__split(simp_quadtree* qtree, uint32_t n);
+static void			__collapse(simp_quadtree* qtree, uint32_t n);
+static void			__gather_points(simp_quadtree* qtree, uint32_t from, uint32_t to);
+static uint32_t		__alloc_block(simp_quadtree* qtree);
+static bool			__reserve_indices(simp_quadtree* qtree, uint32_t count);
+static bool			__reserve(uint32_t** buf, uint32_t* capacity, uint32_t size);
 
 simp_quadtree*		simp_quadtree_create(float x0, float y0, float x1, float y1, uint32_t resolution)
 {
 	if(resolution < 1u) { resolution = 1u; }
-	simp_quadtree* qtree = malloc(sizeof *qtree);
-	if(!qtree) { goto QTREE_FAIL; }
-	uint32_t* bucket = malloc(resolution * sizeof *bucket);
-	if(!bucket) { goto BUCKET_FAIL; }
-	float* points = malloc(resolution * 2u * sizeof *points);
-	if(!points) { goto POINTS_FAIL; }
-
-	qtree->x0 = x0;
-	qtree->y0 = y0;
-	qtree->x1 = x1;
-	qtree->y1 = y1;
+	simp_quadtree* qtree = calloc(1u, sizeof *qtree);
+	if(!qtree) { return NULL; }
+	uint32_t capacity = 65u;
+	qtree->nodes = malloc(capacity * sizeof *qtree->nodes);
+	qtree->bucket = malloc(capacity * resolution * sizeof *qtree->bucket);
+	qtree->points = malloc(capacity * resolution * 2u * sizeof *qtree->points);
+	if(!qtree->nodes || !qtree->bucket || !qtree->points)
+	{
+		simp_quadtree_destroy(qtree);
+		return NULL;
+	}
+
 	qtree->resolution = resolution;
-	qtree->count = 0u;
-	qtree->bucket = bucket;
-	qtree->points = points;
-	qtree->split_flag = false;
-	qtree->children[0] = qtree->children[1] = qtree->children[2] = qtree->children[3] = NULL;
+	qtree->node_capacity = capacity;
+	qtree->node_count = 1u;
+	qtree->free_block = NONE;
+	node* root = &qtree->nodes[0];
+	root->x0 = x0;
+	root->y0 = y0;
+	root->x1 = x1;
+	root->y1 = y1;
+	root->parent = NONE;
+	root->children = NONE;
+	root->count = root->total = root->depth = 0u;
 	return qtree;
-
-POINTS_FAIL:
-	free(points);
-BUCKET_FAIL:
-	free(bucket);
-QTREE_FAIL:
-	free(qtree);
-	return NULL;
 }
 
 void				simp_quadtree_destroy(simp_quadtree* qtree)
 {
 	if(!qtree) { return; }
-	if(qtree->split_flag)
-	{
-		simp_quadtree_destroy(qtree->children[0]);
-		simp_quadtree_destroy(qtree->children[1]);
-		simp_quadtree_destroy(qtree->children[2]);
-		simp_quadtree_destroy(qtree->children[3]);
-	}
+	free(qtree->nodes);
 	free(qtree->bucket);
 	free(qtree->points);
+	free(qtree->point_node);
+	free(qtree->point_slot);
 	free(qtree);
 }
 
 bool				simp_quadtree_insert(simp_quadtree* qtree, float x, float y, uint32_t index)
 {
-	if (!__contains(qtree->x0, qtree->y0, qtree->x1, qtree->y1, x, y)) { return false; }
+	if(!__reserve_indices(qtree, index + 1u)) { return false; }
+	if(qtree->point_node[index] != NONE) { return simp_quadtree_move(qtree, index, x, y); }
+	if(!__insert(qtree, 0u, x, y, index)) { return false; }
+	qtree->size++;
+	return true;
+}
 
-	if (qtree->count < qtree->resolution)
+bool				simp_quadtree_remove(simp_quadtree* qtree, uint32_t index)
+{
+	if(index >= qtree->index_capacity || qtree->point_node[index] == NONE) { return false; }
+	uint32_t res = qtree->resolution;
+	uint32_t n = qtree->point_node[index];
+	uint32_t slot = qtree->point_slot[index];
+
+	//Swap the last point of the bucket into the freed slot
+	node* nd = &qtree->nodes[n];
+	uint32_t last = --nd->count;
+	if(slot != last)
 	{
-		qtree->bucket[qtree->count] = index;
-		qtree->points[2 * qtree->count + 0] = x;
-		qtree->points[2 * qtree->count + 1] = y;
-		qtree->count++;
-		return true;
+		uint32_t moved = qtree->bucket[n * res + last];
+		qtree->bucket[n * res + slot] = moved;
+		qtree->points[2u * (n * res + slot) + 0u] = qtree->points[2u * (n * res + last) + 0u];
+		qtree->points[2u * (n * res + slot) + 1u] = qtree->points[2u * (n * res + last) + 1u];
+		qtree->point_slot[moved] = slot;
 	}
-	else
-	{
-		if(!qtree->split_flag)
-		{
-			__split(qtree);
-		}
+	qtree->point_node[index] = NONE;
+	qtree->size--;
 
-		if( simp_quadtree_insert(qtree->children[0], x, y, index) ||
-			simp_quadtree_insert(qtree->children[1], x, y, index) ||
-			simp_quadtree_insert(qtree->children[2], x, y, index) ||
-			simp_quadtree_insert(qtree->children[3], x, y, index)  )
-		{
-			return true;
-		}
-	}
+	for(uint32_t m = n; m != NONE; m = qtree->nodes[m].parent)
+		qtree->nodes[m].total--;
+
+	//Merge the highest ancestor whose subtree fell to half the resolution
+	uint32_t merge = NONE;
+	for(uint32_t m = n; m != NONE; m = qtree->nodes[m].parent)
+		if(qtree->nodes[m].children != NONE && qtree->nodes[m].total <= res / 2u)
+			merge = m;
+	if(merge != NONE)
+		__collapse(qtree, merge);
 	return true;
 }
 
+//Points that stay inside their node only get new coordinates
+bool				simp_quadtree_move(simp_quadtree* qtree, uint32_t index, float x, float y)
+{
+	if(index >= qtree->index_capacity || qtree->point_node[index] == NONE)
+		return simp_quadtree_insert(qtree, x, y, index);
+
+	uint32_t n = qtree->point_node[index];
+	node* nd = &qtree->nodes[n];
+	if(__contains(nd->x0, nd->y0, nd->x1, nd->y1, x, y))
+	{
+		uint32_t slot = n * qtree->resolution + qtree->point_slot[index];
+		qtree->points[2u * slot + 0u] = x;
+		qtree->points[2u * slot + 1u] = y;
+		return true;
+	}
+	simp_quadtree_remove(qtree, index);
+	return simp_quadtree_insert(qtree, x, y, index);
+}
+
+//Brings the tree in line with pos[0 .. count); indices at or past count are removed
+void				simp_quadtree_update(simp_quadtree* qtree, const float* pos, uint32_t count)
+{
+	SIMP_PROF_SCOPE("simp_quadtree_update");
+	for(uint32_t i = count; i < qtree->index_capacity; i++)
+		if(qtree->point_node[i] != NONE)
+			simp_quadtree_remove(qtree, i);
+	if(!__reserve_indices(qtree, count)) { return; }
+	for(uint32_t i = 0; i < count; i++)
+		simp_quadtree_move(qtree, i, pos[2 * i + 0], pos[2 * i + 1]);
+}
+
+void				simp_quadtree_clear(simp_quadtree* qtree)
+{
+	for(uint32_t i = 0; i < qtree->index_capacity; i++)
+		qtree->point_node[i] = NONE;
+	qtree->node_count = 1u;
+	qtree->free_block = NONE;
+	qtree->nodes[0].children = NONE;
+	qtree->nodes[0].count = qtree->nodes[0].total = 0u;
+	qtree->size = 0u;
+}
+
+uint32_t			simp_quadtree_size(simp_quadtree* qtree)
+{
+	return qtree->size;
+}
+
 simp_list*			simp_quadtree_query(simp_quadtree* qtree, float x0, float y0, float x1, float y1)
 {
 	simp_list* list = simp_list_create(sizeof(uint32_t));
-	__query(qtree, x0, y0, x1, y1, list);
+	if(!list) { return NULL; }
+	__visit(qtree, 0u, x0, y0, x1, y1, __push_list, list);
 	return list;
 }
 
+//Writes the indices inside the rectangle to *buf, growing it as needed, and
+//returns their count; the buffer is meant to be reused between queries
+uint32_t			simp_quadtree_query_buffer(simp_quadtree* qtree, float x0, float y0, float x1, float y1,
+											   uint32_t** buf, uint32_t* capacity)
+{
+	return __query_buffer(qtree, 0u, x0, y0, x1, y1, buf, capacity, 0u);
+}
+
+//Calls visitor for every point inside the rectangle and returns their count
+uint32_t			simp_quadtree_visit(simp_quadtree* qtree, float x0, float y0, float x1, float y1,
+										simp_quadtree_visitor visitor, void* ctx)
+{
+	return __visit(qtree, 0u, x0, y0, x1, y1, visitor, ctx);
+}
+
 
 
-static void			__query(simp_quadtree* qtree, float x0, float y0, float x1,	float y1, simp_list* list)
+static void			__push_list(void* ctx, uint32_t index, float x, float y)
 {
-	if(__intersects(qtree->x0, qtree->y0, qtree->x1, qtree->y1,
-	x0, y0, x1, y1))
-	{
-		for(int i = 0; i < qtree->count; i++)
-			if(__contains(x0, y0, x1, y1, qtree->points[2 * i + 0], qtree->points[2 * i + 1]))
-				simp_list_push_tail(list, &qtree->bucket[i]);
+	simp_list_push_tail(ctx, &index);
+}
+
+static uint32_t		__query_buffer(simp_quadtree* qtree, uint32_t n, float x0, float y0, float x1, float y1,
+								   uint32_t** buf, uint32_t* capacity, uint32_t size)
+{
+	node* nd = &qtree->nodes[n];
+	if(!__intersects(nd->x0, nd->y0, nd->x1, nd->y1, x0, y0, x1, y1)) { return size; }
+	if(!__reserve(buf, capacity, size + nd->count)) { return size; }
 
-		if(qtree->split_flag)
+	uint32_t* bucket = qtree->bucket + n * qtree->resolution;
+	float* points = qtree->points + 2u * n * qtree->resolution;
+	uint32_t* out = *buf;
+	for(uint32_t i = 0; i < nd->count; i++)
+		if(__contains(x0, y0, x1, y1, points[2 * i + 0], points[2 * i + 1]))
+			out[size++] = bucket[i];
+
+	if(nd->children != NONE)
+		for(uint32_t c = 0; c < 4u; c++)
+			size = __query_buffer(qtree, nd->children + c, x0, y0, x1, y1, buf, capacity, size);
+	return size;
+}
+
+static uint32_t		__visit(simp_quadtree* qtree, uint32_t n, float x0, float y0, float x1, float y1,
+							simp_quadtree_visitor visitor, void* ctx)
+{
+	node* nd = &qtree->nodes[n];
+	if(!__intersects(nd->x0, nd->y0, nd->x1, nd->y1, x0, y0, x1, y1)) { return 0u; }
+
+	uint32_t* bucket = qtree->bucket + n * qtree->resolution;
+	float* points = qtree->points + 2u * n * qtree->resolution;
+	uint32_t count = 0u;
+	for(uint32_t i = 0; i < nd->count; i++)
+	{
+		if(__contains(x0, y0, x1, y1, points[2 * i + 0], points[2 * i + 1]))
 		{
-			__query(qtree->children[0], x0, y0, x1, y1, list);
-			__query(qtree->children[1], x0, y0, x1, y1, list);
-			__query(qtree->children[2], x0, y0, x1, y1, list);
-			__query(qtree->children[3], x0, y0, x1, y1, list);
+			visitor(ctx, bucket[i], points[2 * i + 0], points[2 * i + 1]);
+			count++;
 		}
 	}
+
+	if(nd->children != NONE)
+		for(uint32_t c = 0; c < 4u; c++)
+			count += __visit(qtree, nd->children + c, x0, y0, x1, y1, visitor, ctx);
+	return count;
 }
 
 static bool			__contains(float x1, float y1, float x2, float y2, float px, float py)
@@ -139,26 +267,170 @@ static bool			__contains(float x1, float y1, float x2, float y2, float px, float
 		);
 }
 
-static bool			__intersects(float x11, float y11, float x12, float y12, 
+static bool			__intersects(float x11, float y11, float x12, float y12,
 								 float x21, float y21, float x22, float y22)
 {
 	return !(
-		(x12 <= x21) || 
-		(x11 > x22) || 
-		(y12 <= y21) || 
+		(x12 <= x21) ||
+		(x11 > x22) ||
+		(y12 <= y21) ||
 		(y11 > y22)
 		);
 }
 
-static void			__split(simp_quadtree* qtree)
+static bool			__insert(simp_quadtree* qtree, uint32_t n, float x, float y, uint32_t index)
 {
-	float w = (qtree->x1 - qtree->x0) * 0.5f;
-	float h = (qtree->y1 - qtree->y0) * 0.5f;
-	float xc = qtree->x0 + w;
-	float yc = qtree->y0 + h;
-	qtree->children[0] = simp_quadtree_create(xc, yc - h, xc + w, yc, qtree->resolution);
-	qtree->children[1] = simp_quadtree_create(xc - w, yc - h, xc, yc, qtree->resolution);
-	qtree->children[2] = simp_quadtree_create(xc - w, yc, xc, yc + h, qtree->resolution);
-	qtree->children[3] = simp_quadtree_create(xc, yc, xc + w, yc + h, qtree->resolution);
-	qtree->split_flag = 1;
+	node* nd = &qtree->nodes[n];
+	if(!__contains(nd->x0, nd->y0, nd->x1, nd->y1, x, y)) { return false; }
+
+	if(nd->count < qtree->resolution)
+	{
+		uint32_t slot = n * qtree->resolution + nd->count;
+		qtree->bucket[slot] = index;
+		qtree->points[2u * slot + 0u] = x;
+		qtree->points[2u * slot + 1u] = y;
+		qtree->point_node[index] = n;
+		qtree->point_slot[index] = nd->count;
+		nd->count++;
+		nd->total++;
+		return true;
+	}
+
+	if(nd->children == NONE && !__split(qtree, n)) { return false; }
+	uint32_t children = qtree->nodes[n].children;
+	for(uint32_t c = 0; c < 4u; c++)
+	{
+		if(__insert(qtree, children + c, x, y, index))
+		{
+			qtree->nodes[n].total++;
+			return true;
+		}
+	}
+	return false;
+}
+
+//Children share the parent's edges exactly, so they cover it without gaps
+static bool			__split(simp_quadtree* qtree, uint32_t n)
+{
+	if(qtree->nodes[n].depth >= MAX_DEPTH) { return false; }
+	uint32_t children = __alloc_block(qtree);
+	if(children == NONE) { return false; }
+	node* nd = &qtree->nodes[n];
+	float xc = nd->x0 + (nd->x1 - nd->x0) * 0.5f;
+	float yc = nd->y0 + (nd->y1 - nd->y0) * 0.5f;
+	float bounds[4][4] = {
+		{ xc, nd->y0, nd->x1, yc },
+		{ nd->x0, nd->y0, xc, yc },
+		{ nd->x0, yc, xc, nd->y1 },
+		{ xc, yc, nd->x1, nd->y1 }
+	};
+	for(uint32_t c = 0; c < 4u; c++)
+	{
+		node* child = &qtree->nodes[children + c];
+		child->x0 = bounds[c][0];
+		child->y0 = bounds[c][1];
+		child->x1 = bounds[c][2];
+		child->y1 = bounds[c][3];
+		child->parent = n;
+		child->children = NONE;
+		child->count = child->total = 0u;
+		child->depth = nd->depth + 1u;
+	}
+	nd->children = children;
+	return true;
+}
+
+//Pulls every point of the subtree into n and returns the child blocks to the pool
+static void			__collapse(simp_quadtree* qtree, uint32_t n)
+{
+	uint32_t children = qtree->nodes[n].children;
+	if(children == NONE) { return; }
+	for(uint32_t c = 0; c < 4u; c++)
+	{
+		__collapse(qtree, children + c);
+		__gather_points(qtree, children + c, n);
+	}
+	qtree->nodes[children].parent = qtree->free_block;
+	qtree->free_block = children;
+	qtree->nodes[n].children = NONE;
+}
+
+static void			__gather_points(simp_quadtree* qtree, uint32_t from, uint32_t to)
+{
+	uint32_t res = qtree->resolution;
+	node* src = &qtree->nodes[from];
+	node* dst = &qtree->nodes[to];
+	for(uint32_t k = 0; k < src->count; k++)
+	{
+		uint32_t s = from * res + k;
+		uint32_t d = to * res + dst->count;
+		uint32_t index = qtree->bucket[s];
+		qtree->bucket[d] = index;
+		qtree->points[2u * d + 0u] = qtree->points[2u * s + 0u];
+		qtree->points[2u * d + 1u] = qtree->points[2u * s + 1u];
+		qtree->point_node[index] = to;
+		qtree->point_slot[index] = dst->count;
+		dst->count++;
+	}
+	src->count = src->total = 0u;
+}
+
+static uint32_t		__alloc_block(simp_quadtree* qtree)
+{
+	if(qtree->free_block != NONE)
+	{
+		uint32_t block = qtree->free_block;
+		qtree->free_block = qtree->nodes[block].parent;
+		return block;
+	}
+	if(qtree->node_count + 4u > qtree->node_capacity)
+	{
+		uint32_t capacity = qtree->node_capacity * 2u;
+		uint32_t res = qtree->resolution;
+		node* nodes = realloc(qtree->nodes, capacity * sizeof *nodes);
+		if(!nodes) { return NONE; }
+		qtree->nodes = nodes;
+		uint32_t* bucket = realloc(qtree->bucket, capacity * res * sizeof *bucket);
+		if(!bucket) { return NONE; }
+		qtree->bucket = bucket;
+		float* points = realloc(qtree->points, capacity * res * 2u * sizeof *points);
+		if(!points) { return NONE; }
+		qtree->points = points;
+		qtree->node_capacity = capacity;
+	}
+	uint32_t block = qtree->node_count;
+	qtree->node_count += 4u;
+	return block;
+}
+
+static bool			__reserve_indices(simp_quadtree* qtree, uint32_t count)
+{
+	if(count <= qtree->index_capacity) { return true; }
+	uint32_t capacity = qtree->index_capacity ? qtree->index_capacity : 64u;
+	while(capacity < count)
+		capacity *= 2u;
+	uint32_t* point_node = realloc(qtree->point_node, capacity * sizeof *point_node);
+	if(!point_node) { return false; }
+	qtree->point_node = point_node;
+	uint32_t* point_slot = realloc(qtree->point_slot, capacity * sizeof *point_slot);
+	if(!point_slot) { return false; }
+	qtree->point_slot = point_slot;
+	for(uint32_t i = qtree->index_capacity; i < capacity; i++)
+		qtree->point_node[i] = NONE;
+	qtree->index_capacity = capacity;
+	return true;
+}
+
+static bool			__reserve(uint32_t** buf, uint32_t* capacity, uint32_t size)
+{
+	if(size <= *capacity) { return true; }
+	uint32_t new_capacity = *capacity ? *capacity : 64u;
+	while(new_capacity < size)
+		new_capacity *= 2u;
+	uint32_t* p = realloc(*buf, new_capacity * sizeof *p);
+	if(!p) { return false; }
+	SIMP_PROF_COUNT(SIMP_PROF_ALLOCATIONS, 1u);
+	*buf = p;
+	*capacity = new_capacity;
+	return true;
 }
@@ -4,10 +4,20 @@
 
 typedef struct simp_quadtree simp_quadtree;
 typedef struct simp_qtree_list simp_qtree_list;
+typedef void		(*simp_quadtree_visitor)(void* ctx, uint32_t index, float x, float y);
 
 simp_quadtree*		simp_quadtree_create(float x0, float y0, float x1, float y1, uint32_t resolution);
 void				simp_quadtree_destroy(simp_quadtree* qtree);
 bool				simp_quadtree_insert(simp_quadtree* qtree, float x, float y, uint32_t index);
+bool				simp_quadtree_remove(simp_quadtree* qtree, uint32_t index);
+bool				simp_quadtree_move(simp_quadtree* qtree, uint32_t index, float x, float y);
+void				simp_quadtree_update(simp_quadtree* qtree, const float* pos, uint32_t count);
+void				simp_quadtree_clear(simp_quadtree* qtree);
+uint32_t			simp_quadtree_size(simp_quadtree* qtree);
 simp_list*			simp_quadtree_query(simp_quadtree* qtree, float x0, float y0, float x1, float y1);
+uint32_t			simp_quadtree_query_buffer(simp_quadtree* qtree, float x0, float y0, float x1, float y1,
+											   uint32_t** buf, uint32_t* capacity);
+uint32_t			simp_quadtree_visit(simp_quadtree* qtree, float x0, float y0, float x1, float y1,
+										simp_quadtree_visitor visitor, void* ctx);
 bool				simp_qtree_list_next(simp_qtree_list* list, uint32_t* val);
 void				simp_qtree_list_set(simp_qtree_list* list);
@@ -0,0 +1,64 @@
+#include "simp_queue.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+//head and tail count elements ever popped and pushed; the capacity is a power
+//of two so they index the ring with a mask and may wrap freely
+typedef struct simp_queue
+{
+	unsigned char* data;
+	size_t elem_size;
+	uint32_t mask;
+	_Alignas(64) atomic_uint head;
+	_Alignas(64) atomic_uint tail;
+}simp_queue;
+
+simp_queue*			simp_queue_create(uint32_t capacity, size_t elem_size)
+{
+	uint32_t size = 2u;
+	while(size < capacity)
+		size *= 2u;
+	simp_queue* queue = calloc(1u, sizeof *queue);
+	if(!queue) { return NULL; }
+	queue->data = malloc(size * elem_size);
+	if(!queue->data)
+	{
+		free(queue);
+		return NULL;
+	}
+	queue->elem_size = elem_size;
+	queue->mask = size - 1u;
+	atomic_init(&queue->head, 0u);
+	atomic_init(&queue->tail, 0u);
+	return queue;
+}
+
+void				simp_queue_destroy(simp_queue* queue)
+{
+	if(!queue) { return; }
+	free(queue->data);
+	free(queue);
+}
+
+//Producer side
+bool				simp_queue_push(simp_queue* queue, const void* elem)
+{
+	uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	if(tail - head > queue->mask) { return false; }
+	memcpy(queue->data + (tail & queue->mask) * queue->elem_size, elem, queue->elem_size);
+	atomic_store_explicit(&queue->tail, tail + 1u, memory_order_release);
+	return true;
+}
+
+//Consumer side
+bool				simp_queue_pop(simp_queue* queue, void* elem)
+{
+	uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	if(head == tail) { return false; }
+	memcpy(elem, queue->data + (head & queue->mask) * queue->elem_size, queue->elem_size);
+	atomic_store_explicit(&queue->head, head + 1u, memory_order_release);
+	return true;
+}
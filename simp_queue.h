@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//Bounded lock-free queue of fixed-size elements for one producer and one
+//consumer; push fails instead of blocking when the queue is full
+typedef struct simp_queue simp_queue;
+
+simp_queue*			simp_queue_create(uint32_t capacity, size_t elem_size);
+void				simp_queue_destroy(simp_queue* queue);
+bool				simp_queue_push(simp_queue* queue, const void* elem);
+bool				simp_queue_pop(simp_queue* queue, void* elem);
@@ -0,0 +1,405 @@
+#include "simp_transport.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#ifndef _WIN32
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+
+#define SHM_HEADER 64u
+//Spins between checks on the watched processes
+#define WATCH_SPINS 1024u
+
+typedef struct channel channel;
+
+//One direction of SHM; head and tail count the bytes ever read and written,
+//the ring of capacity bytes follows the header
+struct channel
+{
+	_Alignas(64) _Atomic uint64_t head;
+	_Alignas(64) _Atomic uint64_t tail;
+};
+
+struct simp_transport
+{
+	simp_transport_type type;
+	uint32_t endpoints;
+	uint32_t self;
+	uint64_t bytes;
+	//SOCKET: fds[a * endpoints + b] is the end a holds of the pair (a, b)
+	int* fds;
+	//SHM: the abort flag, then endpoints^2 channels of stride bytes
+	unsigned char* region;
+	size_t region_size;
+	size_t capacity;
+	size_t stride;
+	//Processes of the endpoints forked by this one, 0 where not watched
+	int* pids;
+};
+
+#ifndef _WIN32
+static bool			__write_all(int fd, const void* data, size_t size);
+static bool			__read_all(int fd, void* data, size_t size);
+static channel*		__channel(simp_transport* transport, uint32_t from, uint32_t to);
+static bool			__ring_write(simp_transport* transport, uint32_t peer, channel* ch, const void* data, size_t size);
+static bool			__ring_read(simp_transport* transport, uint32_t peer, channel* ch, void* data, size_t size);
+static bool			__aborted(simp_transport* transport);
+static bool			__peer_exited(simp_transport* transport, uint32_t peer);
+#endif
+
+#ifndef _WIN32
+simp_transport*		simp_transport_create(simp_transport_type type, uint32_t endpoints, size_t channel_capacity)
+{
+	if(endpoints < 2u) { return NULL; }
+	simp_transport* transport = calloc(1u, sizeof *transport);
+	if(!transport) { return NULL; }
+	transport->type = type;
+	transport->endpoints = endpoints;
+	transport->self = UINT32_MAX;
+	if(type == SIMP_TRANSPORT_SOCKET)
+	{
+		transport->fds = malloc((size_t)endpoints * endpoints * sizeof *transport->fds);
+		if(!transport->fds)
+		{
+			free(transport);
+			return NULL;
+		}
+		for(uint32_t k = 0; k < endpoints * endpoints; k++)
+			transport->fds[k] = -1;
+		for(uint32_t a = 0; a < endpoints; a++)
+			for(uint32_t b = a + 1u; b < endpoints; b++)
+			{
+				int sv[2];
+				if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+				{
+					simp_transport_destroy(transport);
+					return NULL;
+				}
+				transport->fds[a * endpoints + b] = sv[0];
+				transport->fds[b * endpoints + a] = sv[1];
+			}
+		return transport;
+	}
+
+	size_t capacity = 4096u;
+	while(capacity < channel_capacity)
+		capacity *= 2u;
+	transport->capacity = capacity;
+	transport->stride = sizeof(channel) + capacity;
+	transport->region_size = SHM_HEADER + (size_t)endpoints * endpoints * transport->stride;
+	void* region = mmap(NULL, transport->region_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if(region == MAP_FAILED)
+	{
+		free(transport);
+		return NULL;
+	}
+	transport->region = region;
+	atomic_init((_Atomic bool*)transport->region, false);
+	for(uint32_t a = 0; a < endpoints; a++)
+		for(uint32_t b = 0; b < endpoints; b++)
+		{
+			channel* ch = __channel(transport, a, b);
+			atomic_init(&ch->head, 0u);
+			atomic_init(&ch->tail, 0u);
+		}
+	return transport;
+}
+
+void				simp_transport_destroy(simp_transport* transport)
+{
+	if(!transport) { return; }
+	if(transport->fds)
+	{
+		for(uint32_t k = 0; k < transport->endpoints * transport->endpoints; k++)
+			if(transport->fds[k] >= 0)
+				close(transport->fds[k]);
+		free(transport->fds);
+	}
+	if(transport->region)
+		munmap(transport->region, transport->region_size);
+	free(transport->pids);
+	free(transport);
+}
+
+//Drops the socket ends of the other endpoints so a peer that exits is seen as end of file
+bool				simp_transport_attach(simp_transport* transport, uint32_t endpoint)
+{
+	if(endpoint >= transport->endpoints) { return false; }
+	transport->self = endpoint;
+	if(transport->fds)
+	{
+		uint32_t n = transport->endpoints;
+		for(uint32_t a = 0; a < n; a++)
+		{
+			if(a == endpoint) { continue; }
+			for(uint32_t b = 0; b < n; b++)
+			{
+				if(transport->fds[a * n + b] < 0) { continue; }
+				close(transport->fds[a * n + b]);
+				transport->fds[a * n + b] = -1;
+			}
+		}
+	}
+	return true;
+}
+
+void				simp_transport_abort(simp_transport* transport)
+{
+	if(transport->region)
+		atomic_store((_Atomic bool*)transport->region, true);
+	if(transport->fds && transport->self < transport->endpoints)
+	{
+		uint32_t n = transport->endpoints;
+		for(uint32_t b = 0; b < n; b++)
+			if(transport->fds[transport->self * n + b] >= 0)
+				shutdown(transport->fds[transport->self * n + b], SHUT_RDWR);
+	}
+}
+
+//The process must be a child of the caller; sockets see it exit on their own
+void				simp_transport_watch(simp_transport* transport, uint32_t endpoint, int pid)
+{
+	if(!transport->region || endpoint >= transport->endpoints) { return; }
+	if(!transport->pids)
+		transport->pids = calloc(transport->endpoints, sizeof *transport->pids);
+	if(transport->pids)
+		transport->pids[endpoint] = pid;
+}
+
+bool				simp_transport_send(simp_transport* transport, uint32_t to, const void* data, size_t size)
+{
+	uint32_t self = transport->self;
+	if(self >= transport->endpoints || to >= transport->endpoints || to == self) { return false; }
+	uint64_t header = size;
+	bool ok;
+	if(transport->fds)
+	{
+		int fd = transport->fds[self * transport->endpoints + to];
+		ok = __write_all(fd, &header, sizeof header) && __write_all(fd, data, size);
+	}
+	else
+	{
+		channel* ch = __channel(transport, self, to);
+		ok = __ring_write(transport, to, ch, &header, sizeof header) && __ring_write(transport, to, ch, data, size);
+	}
+	if(!ok)
+	{
+		simp_transport_abort(transport);
+		return false;
+	}
+	transport->bytes += sizeof header + size;
+	return true;
+}
+
+bool				simp_transport_recv(simp_transport* transport, uint32_t from, void** buf, size_t* capacity,
+										size_t* size)
+{
+	uint32_t self = transport->self;
+	if(self >= transport->endpoints || from >= transport->endpoints || from == self) { return false; }
+	int fd = transport->fds ? transport->fds[self * transport->endpoints + from] : -1;
+	channel* ch = transport->fds ? NULL : __channel(transport, from, self);
+	uint64_t header;
+	bool ok = fd >= 0 ? __read_all(fd, &header, sizeof header) : __ring_read(transport, from, ch, &header, sizeof header);
+	if(ok && header > *capacity)
+	{
+		void* p = realloc(*buf, header);
+		if(p)
+		{
+			*buf = p;
+			*capacity = header;
+		}
+		else
+			ok = false;
+	}
+	if(ok)
+		ok = fd >= 0 ? __read_all(fd, *buf, header) : __ring_read(transport, from, ch, *buf, header);
+	if(!ok)
+	{
+		simp_transport_abort(transport);
+		return false;
+	}
+	*size = header;
+	return true;
+}
+#else
+simp_transport*		simp_transport_create(simp_transport_type type, uint32_t endpoints, size_t channel_capacity)
+{
+	return NULL;
+}
+
+void				simp_transport_destroy(simp_transport* transport)
+{
+	free(transport);
+}
+
+bool				simp_transport_attach(simp_transport* transport, uint32_t endpoint)
+{
+	return false;
+}
+
+void				simp_transport_abort(simp_transport* transport)
+{
+}
+
+void				simp_transport_watch(simp_transport* transport, uint32_t endpoint, int pid)
+{
+}
+
+bool				simp_transport_send(simp_transport* transport, uint32_t to, const void* data, size_t size)
+{
+	return false;
+}
+
+bool				simp_transport_recv(simp_transport* transport, uint32_t from, void** buf, size_t* capacity,
+										size_t* size)
+{
+	return false;
+}
+#endif
+
+//Bytes this endpoint has sent, message headers included
+uint64_t			simp_transport_bytes(simp_transport* transport)
+{
+	return transport->bytes;
+}
+
+const char*			simp_transport_name(simp_transport_type type)
+{
+	switch(type)
+	{
+		case SIMP_TRANSPORT_SOCKET:	return "socket";
+		case SIMP_TRANSPORT_SHM:	return "shm";
+	}
+	return "unknown";
+}
+
+
+
+#ifndef _WIN32
+static bool			__write_all(int fd, const void* data, size_t size)
+{
+	const unsigned char* p = data;
+	while(size)
+	{
+		ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) { continue; }
+		if(n <= 0) { return false; }
+		p += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+static bool			__read_all(int fd, void* data, size_t size)
+{
+	unsigned char* p = data;
+	while(size)
+	{
+		ssize_t n = recv(fd, p, size, 0);
+		if(n < 0 && errno == EINTR) { continue; }
+		if(n <= 0) { return false; }
+		p += n;
+		size -= (size_t)n;
+	}
+	return true;
+}
+
+static channel*		__channel(simp_transport* transport, uint32_t from, uint32_t to)
+{
+	size_t k = (size_t)from * transport->endpoints + to;
+	return (channel*)(transport->region + SHM_HEADER + k * transport->stride);
+}
+
+//Producer side; messages larger than the ring stream through it
+static bool			__ring_write(simp_transport* transport, uint32_t peer, channel* ch, const void* data, size_t size)
+{
+	unsigned char* ring = (unsigned char*)(ch + 1);
+	const unsigned char* p = data;
+	size_t mask = transport->capacity - 1u;
+	uint32_t spins = 0u;
+	while(size)
+	{
+		uint64_t tail = atomic_load_explicit(&ch->tail, memory_order_relaxed);
+		uint64_t head = atomic_load_explicit(&ch->head, memory_order_acquire);
+		size_t space = transport->capacity - (size_t)(tail - head);
+		if(!space)
+		{
+			if(__aborted(transport)) { return false; }
+			if(++spins % WATCH_SPINS == 0u && __peer_exited(transport, peer)) { return false; }
+			sched_yield();
+			continue;
+		}
+		size_t offset = (size_t)tail & mask;
+		size_t n = size < space ? size : space;
+		if(n > transport->capacity - offset)
+			n = transport->capacity - offset;
+		memcpy(ring + offset, p, n);
+		atomic_store_explicit(&ch->tail, tail + n, memory_order_release);
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+//Consumer side
+static bool			__ring_read(simp_transport* transport, uint32_t peer, channel* ch, void* data, size_t size)
+{
+	const unsigned char* ring = (const unsigned char*)(ch + 1);
+	unsigned char* p = data;
+	size_t mask = transport->capacity - 1u;
+	uint32_t spins = 0u;
+	while(size)
+	{
+		uint64_t head = atomic_load_explicit(&ch->head, memory_order_relaxed);
+		uint64_t tail = atomic_load_explicit(&ch->tail, memory_order_acquire);
+		size_t avail = (size_t)(tail - head);
+		if(!avail)
+		{
+			if(__aborted(transport)) { return false; }
+			//What the peer wrote before exiting is visible once its exit is
+			if(++spins % WATCH_SPINS == 0u && __peer_exited(transport, peer) &&
+			   atomic_load_explicit(&ch->tail, memory_order_acquire) == tail) { return false; }
+			sched_yield();
+			continue;
+		}
+		size_t offset = (size_t)head & mask;
+		size_t n = size < avail ? size : avail;
+		if(n > transport->capacity - offset)
+			n = transport->capacity - offset;
+		memcpy(p, ring + offset, n);
+		atomic_store_explicit(&ch->head, head + n, memory_order_release);
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool			__aborted(simp_transport* transport)
+{
+	return atomic_load((_Atomic bool*)transport->region);
+}
+
+//Whether the process at peer has exited; a watched process that was killed
+//or failed aborts the transport. WNOWAIT leaves them to be reaped by the caller.
+static bool			__peer_exited(simp_transport* transport, uint32_t peer)
+{
+	if(!transport->pids) { return false; }
+	bool exited = false;
+	for(uint32_t e = 0; e < transport->endpoints; e++)
+	{
+		if(transport->pids[e] <= 0) { continue; }
+		siginfo_t info;
+		memset(&info, 0, sizeof info);
+		if(waitid(P_PID, (id_t)transport->pids[e], &info, WEXITED | WNOHANG | WNOWAIT) < 0 || !info.si_pid) { continue; }
+		if(info.si_code != CLD_EXITED || info.si_status != 0)
+			simp_transport_abort(transport);
+		exited = exited || e == peer;
+	}
+	return exited;
+}
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//Ordered, reliable messages between a fixed set of endpoints in separate
+//processes on one machine. The transport is created before the processes
+//fork and each of them attaches to its own endpoint; send and recv then
+//block until the whole message is through. SOCKET connects every pair of
+//endpoints with a Unix socket pair, SHM gives every direction a byte ring
+//of channel_capacity bytes in an anonymous shared mapping and spins on it.
+//A failed endpoint aborts the transport, so peers waiting on it fail too.
+//SHM cannot see a peer vanish, so the process that forks the others watches
+//them while it spins: one killed or exiting with an error aborts the
+//transport, and waiting on one that has exited fails.
+//POSIX only; create returns NULL elsewhere.
+typedef enum simp_transport_type
+{
+	SIMP_TRANSPORT_SOCKET,
+	SIMP_TRANSPORT_SHM
+}simp_transport_type;
+
+typedef struct simp_transport simp_transport;
+
+simp_transport*		simp_transport_create(simp_transport_type type, uint32_t endpoints, size_t channel_capacity);
+void				simp_transport_destroy(simp_transport* transport);
+bool				simp_transport_attach(simp_transport* transport, uint32_t endpoint);
+void				simp_transport_abort(simp_transport* transport);
+void				simp_transport_watch(simp_transport* transport, uint32_t endpoint, int pid);
+bool				simp_transport_send(simp_transport* transport, uint32_t to, const void* data, size_t size);
+//Grows *buf to the message size like the index queries; the size goes to *size
+bool				simp_transport_recv(simp_transport* transport, uint32_t from, void** buf, size_t* capacity,
+										size_t* size);
+uint64_t			simp_transport_bytes(simp_transport* transport);
+const char*			simp_transport_name(simp_transport_type type);
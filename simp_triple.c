@@ -0,0 +1,70 @@
+#include "simp_triple.h"
+#include <stdlib.h>
+#include <stdatomic.h>
+
+#define FRESH 0x4u
+
+//middle holds the index of the buffer between the two sides, with FRESH set
+//while it carries a frame the consumer has not taken yet
+typedef struct simp_triple
+{
+	void* buffers[3];
+	uint32_t back;
+	uint32_t front;
+	atomic_uint middle;
+}simp_triple;
+
+simp_triple*		simp_triple_create(size_t size)
+{
+	simp_triple* triple = calloc(1u, sizeof *triple);
+	if(!triple) { return NULL; }
+	for(uint32_t b = 0; b < 3u; b++)
+	{
+		triple->buffers[b] = calloc(1u, size);
+		if(!triple->buffers[b])
+		{
+			simp_triple_destroy(triple);
+			return NULL;
+		}
+	}
+	triple->back = 0u;
+	triple->front = 1u;
+	atomic_init(&triple->middle, 2u);
+	return triple;
+}
+
+void				simp_triple_destroy(simp_triple* triple)
+{
+	if(!triple) { return; }
+	for(uint32_t b = 0; b < 3u; b++)
+		free(triple->buffers[b]);
+	free(triple);
+}
+
+//The producer's buffer, valid until the next publish
+void*				simp_triple_back(simp_triple* triple)
+{
+	return triple->buffers[triple->back];
+}
+
+//Hands the back buffer to the consumer; an untaken older frame is dropped
+void				simp_triple_publish(simp_triple* triple)
+{
+	uint32_t old = atomic_exchange_explicit(&triple->middle, triple->back | FRESH, memory_order_acq_rel);
+	triple->back = old & ~FRESH;
+}
+
+//The latest published buffer, valid until the next call; fresh tells whether
+//it changed since the previous call
+void*				simp_triple_front(simp_triple* triple, bool* fresh)
+{
+	bool changed = (atomic_load_explicit(&triple->middle, memory_order_relaxed) & FRESH) != 0u;
+	if(changed)
+	{
+		uint32_t old = atomic_exchange_explicit(&triple->middle, triple->front, memory_order_acq_rel);
+		triple->front = old & ~FRESH;
+	}
+	if(fresh)
+		*fresh = changed;
+	return triple->buffers[triple->front];
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//Lock-free triple buffer for one producer and one consumer. The producer fills
+//its back buffer and publishes it; the consumer takes the latest published
+//buffer. Neither side ever waits, and a buffer is only touched by one side at
+//a time.
+typedef struct simp_triple simp_triple;
+
+simp_triple*		simp_triple_create(size_t size);
+void				simp_triple_destroy(simp_triple* triple);
+void*				simp_triple_back(simp_triple* triple);
+void				simp_triple_publish(simp_triple* triple);
+void*				simp_triple_front(simp_triple* triple, bool* fresh);
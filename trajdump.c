@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "fluid_traj.h"
+
+static void usage(void);
+
+int main(int argc, char** argv)
+{
+	const char* path = NULL;
+	bool particles = false;
+	for(int a = 1; a < argc; a++)
+	{
+		if(!strcmp(argv[a], "-particles"))
+			particles = true;
+		else if(!path)
+			path = argv[a];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+	if(!path) { usage(); return 1; }
+
+	fluid_traj_reader* reader = fluid_traj_reader_open(path);
+	if(!reader)
+	{
+		fprintf(stderr, "Failed to open %s\n", path);
+		return 1;
+	}
+	uint32_t count = fluid_traj_reader_count(reader);
+	uint32_t flags = fluid_traj_reader_flags(reader);
+	printf("particles: %u, fields 0x%x, %s%s\n", count, fluid_traj_reader_fields(reader),
+		flags & FLUID_TRAJ_QUANTIZE ? "quantized" : "float", flags & FLUID_TRAJ_DELTA ? " delta" : "");
+
+	fluid_traj_frame frame;
+	uint64_t frames = 0u;
+	while(fluid_traj_reader_next(reader, &frame))
+	{
+		double cx = 0.0, cy = 0.0, dens_sum = 0.0;
+		for(uint32_t i = 0; frame.positions && i < count; i++)
+		{
+			cx += frame.positions[2 * i + 0];
+			cy += frame.positions[2 * i + 1];
+		}
+		for(uint32_t i = 0; frame.densities && i < count; i++)
+			dens_sum += frame.densities[i];
+		printf("step %llu time %.5f%s centroid %.6f %.6f mean density %.3f\n", (unsigned long long)frame.step,
+			frame.time, frame.keyframe ? " key" : "", cx / count, cy / count, dens_sum / count);
+		for(uint32_t i = 0; particles && i < count; i++)
+		{
+			printf("  %u", i);
+			if(frame.positions)
+				printf(" %.6f %.6f", frame.positions[2 * i + 0], frame.positions[2 * i + 1]);
+			if(frame.velocities)
+				printf(" %.6f %.6f", frame.velocities[2 * i + 0], frame.velocities[2 * i + 1]);
+			if(frame.densities)
+				printf(" %.4f", frame.densities[i]);
+			printf("\n");
+		}
+		frames++;
+	}
+	printf("frames: %llu\n", (unsigned long long)frames);
+	fluid_traj_reader_close(reader);
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: trajdump [-particles] PATH\n");
+}
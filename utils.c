@@ -1,6 +1,15 @@
 #include "utils.h"
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#define PSAPI_VERSION 2
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
 
 #define PI 3.14159265359
 
@@ -16,6 +25,20 @@ void frand2d(float* x, float* y)
 	*y = cos(t);
 }
 
+//Stateless variant of frand2d: the direction is a hash of seed, so it is
+//reproducible and safe to call from several threads
+void hrand2d(uint32_t seed, float* x, float* y)
+{
+	seed ^= seed >> 16;
+	seed *= 0x7FEB352Du;
+	seed ^= seed >> 15;
+	seed *= 0x846CA68Bu;
+	seed ^= seed >> 16;
+	float t = ((float)seed / 4294967296.0f) * 2.0f * PI - PI;
+	*x = sin(t);
+	*y = cos(t);
+}
+
 inline float dot(float x1, float y1, float x2, float y2)
 {
 	return (x1 * x2 + y1 * y2);
@@ -42,3 +65,77 @@ int isgn(int t)
 {
 	return (t > 0) - (t < 0);
 }
+
+double wtime(void)
+{
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+//Peak resident set size of the process in bytes, 0 if unknown
+uint64_t peak_rss(void)
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof counters)) { return 0u; }
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) { return 0u; }
+#ifdef __APPLE__
+	return (uint64_t)usage.ru_maxrss;
+#else
+	return (uint64_t)usage.ru_maxrss * 1024u;
+#endif
+#endif
+}
+
+//IEEE half precision with round to nearest even; overflow goes to infinity
+uint16_t f32_to_f16(float t)
+{
+	uint32_t x;
+	memcpy(&x, &t, sizeof x);
+	uint32_t sign = x & 0x80000000u;
+	x ^= sign;
+	uint32_t h;
+	if(x >= 0x47800000u)
+		h = x > 0x7F800000u ? 0x7E00u : 0x7C00u;
+	else if(x < 0x38800000u)
+	{
+		//Subnormal: adding 0.5 lines the 10 mantissa bits up at the bottom
+		float f;
+		memcpy(&f, &x, sizeof f);
+		f += 0.5f;
+		memcpy(&h, &f, sizeof h);
+		h -= 0x3F000000u;
+	}
+	else
+	{
+		uint32_t odd = (x >> 13) & 1u;
+		x += ((uint32_t)(15 - 127) << 23) + 0xFFFu + odd;
+		h = x >> 13;
+	}
+	return (uint16_t)((sign >> 16) | h);
+}
+
+float f16_to_f32(uint16_t h)
+{
+	uint32_t sign = (uint32_t)(h & 0x8000u) << 16;
+	uint32_t exponent = (h >> 10) & 0x1Fu;
+	uint32_t mantissa = h & 0x3FFu;
+	uint32_t x;
+	if(exponent == 0x1Fu)
+		x = sign | 0x7F800000u | (mantissa << 13);
+	else if(exponent)
+		x = sign | ((exponent + 112u) << 23) | (mantissa << 13);
+	else
+	{
+		float f = (float)mantissa * 5.9604644775390625e-8f;
+		memcpy(&x, &f, sizeof x);
+		x |= sign;
+	}
+	float t;
+	memcpy(&t, &x, sizeof t);
+	return t;
+}
@@ -1,8 +1,14 @@
 #pragma once
+#include <stdint.h>
 float frand(float min, float max);
 void frand2d(float* x, float* y);
+void hrand2d(uint32_t seed, float* x, float* y);
 float dot(float x1, float y1, float x2, float y2);
 float fclamp(float t, float min, float max);
 int iclamp(int t, int min, int max);
 int fsgn(float t);
 int isgn(int t);
+double wtime(void);
+uint64_t peak_rss(void);
+uint16_t f32_to_f16(float t);
+float f16_to_f32(uint16_t h);